@@ -0,0 +1,57 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "bench_stats.h"
+#include <stdio.h>
+#include <time.h>
+
+uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+void bench_report_header(const char *unit)
+{
+	char p50[16], p90[16], p99[16], p999[16], max[16];
+
+	snprintf(p50, sizeof(p50), "p50 %s", unit);
+	snprintf(p90, sizeof(p90), "p90 %s", unit);
+	snprintf(p99, sizeof(p99), "p99 %s", unit);
+	snprintf(p999, sizeof(p999), "p99.9 %s", unit);
+	snprintf(max, sizeof(max), "max %s", unit);
+	printf("%-24s %8s %10s %10s %10s %10s %10s %12s %6s\n",
+		"operation", "count", p50, p90, p99, p999, max, "ops/s", "errors");
+}
+
+void bench_report(const char *name, uint64_t *lat_ns, int n, uint64_t total_ns,
+	int errors, double unit_ns)
+{
+	if (n <= 0) {
+		return;
+	}
+
+	qsort(lat_ns, n, sizeof(*lat_ns), cmp_u64);
+	printf("%-24s %8d %10.1f %10.1f %10.1f %10.1f %10.1f %12.0f %6d\n",
+		name, n,
+		lat_ns[(int)((n - 1) * 0.5)] / unit_ns,
+		lat_ns[(int)((n - 1) * 0.9)] / unit_ns,
+		lat_ns[(int)((n - 1) * 0.99)] / unit_ns,
+		lat_ns[(int)((n - 1) * 0.999)] / unit_ns,
+		lat_ns[n - 1] / unit_ns,
+		total_ns ? n / (total_ns / 1e9) : 0,
+		errors);
+}
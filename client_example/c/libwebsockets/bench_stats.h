@@ -0,0 +1,32 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _BENCH_STATS_H
+#define _BENCH_STATS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/* monotonic time in ns */
+uint64_t bench_now_ns(void);
+
+/* print the column headings of bench_report() */
+void bench_report_header(const char *unit);
+
+/**
+ * Print the count, latency percentiles, maximum and rate of one operation.
+ * lat_ns is sorted in place.
+ *
+ * /param name - operation name
+ * /param lat_ns - latency of each call
+ * /param n - number of entries in lat_ns
+ * /param total_ns - time taken by all calls, for the rate
+ * /param errors - failed calls
+ * /param unit_ns - latency unit, 1 for ns, 1000 for us
+ */
+void bench_report(const char *name, uint64_t *lat_ns, int n, uint64_t total_ns,
+	int errors, double unit_ns);
+
+#endif /* _BENCH_STATS_H */
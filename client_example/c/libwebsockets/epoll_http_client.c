@@ -0,0 +1,540 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "wasp_interface.h"
+#include "http_client.h"
+#include "http_response.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Built-in HTTP/1.1 transport: an epoll loop per HTTP client thread,
+ * non-blocking sockets, and per device one kept alive request connection
+ * plus the update stream connection.
+ */
+
+#define EPOLL_REQ_LEN (4096 + WASP_IF_BODY_LEN)  /* request line, headers and body */
+#define EPOLL_RESP_LEN 16384                     /* longest response header block */
+#define EPOLL_MAX_EVENTS 64
+
+enum conn_slot {
+	CONN_REQUEST,                                /* GET/PATCH/POST requests, kept alive */
+	CONN_STREAM,                                 /* update stream */
+	NUM_CONN_SLOTS
+};
+
+struct epoll_conn {
+	int fd;                                      /* -1 if not open */
+	enum conn_slot slot;
+	struct device_conn *d;
+	struct wasp_if_msg *ui;                      /* request or stream in progress, NULL while idle */
+	int connected;
+	int reused;                                  /* kept alive from an earlier request, the device
+	                                                may have closed it meanwhile */
+	int received;                                /* response data received */
+	int established;                             /* response headers reported */
+	struct http_response resp;
+	char out[EPOLL_REQ_LEN];                     /* request not yet written */
+	size_t out_len;
+	size_t out_pos;
+	char in[EPOLL_RESP_LEN + 1];                 /* response data not yet parsed, +1 to NUL
+	                                                terminate a body piece in place */
+	size_t in_len;
+};
+
+static int epfds[WASP_IF_MAX_SERVICE_THREADS];
+static int wake_fds[WASP_IF_MAX_SERVICE_THREADS];
+static int num_shards = 1;
+static int num_threads = 1;
+
+/* allocated on the first request of each device */
+static struct epoll_conn *conns[WASP_IF_MAX_DEVICES][NUM_CONN_SLOTS];
+
+/* CLOCK_MONOTONIC expiry of each device timer in us, 0 if not set */
+static uint64_t deadlines[WASP_IF_MAX_DEVICES][HTTP_CLIENT_NUM_TIMERS];
+static struct device_conn *timer_devs[WASP_IF_MAX_DEVICES];
+
+/* earliest timer of each thread, 0 if none, may be earlier than a cancelled timer */
+static uint64_t next_deadline[WASP_IF_MAX_SERVICE_THREADS];
+
+static void conn_close(struct epoll_conn *c)
+{
+	if (c->fd >= 0) {
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->connected = 0;
+	c->reused = 0;
+}
+
+/* start a non-blocking connect to the device of the request */
+static int conn_open(struct epoll_conn *c)
+{
+	struct sockaddr_in addr;
+	struct epoll_event ev;
+	char host[WASP_IF_IPV4_ADDRESS_LEN];
+	char *port = NULL;
+	int one = 1;
+
+	/* "a.b.c.d" or "a.b.c.d:port" */
+	strncpy(host, c->ui->ipv4_address, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+	port = strchr(host, ':');
+	if (port) {
+		*port++ = '\0';
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port ? atoi(port) : 80);
+	if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+		return -1;
+	}
+
+	c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (c->fd < 0) {
+		return -1;
+	}
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) && errno != EINPROGRESS) {
+		conn_close(c);
+		return -1;
+	}
+
+	/* edge triggered, reads and writes continue until EAGAIN */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = c;
+	if (epoll_ctl(epfds[http_client_thread_of(c->d->index)], EPOLL_CTL_ADD, c->fd, &ev)) {
+		conn_close(c);
+		return -1;
+	}
+	c->connected = 0;
+
+	return 0;
+}
+
+static int add_header(void *ctx, const char *name, const char *value, size_t len)
+{
+	struct epoll_conn *c = (struct epoll_conn *)ctx;
+	size_t name_len = strlen(name);
+
+	if (c->out_len + name_len + len + 3 > sizeof(c->out)) {
+		return -1;
+	}
+
+	memcpy(&c->out[c->out_len], name, name_len);
+	c->out_len += name_len;
+	c->out[c->out_len++] = ' ';
+	memcpy(&c->out[c->out_len], value, len);
+	c->out_len += len;
+	c->out[c->out_len++] = '\r';
+	c->out[c->out_len++] = '\n';
+
+	return 0;
+}
+
+/* write what the socket takes of the request */
+static int conn_write(struct epoll_conn *c)
+{
+	ssize_t n = 0;
+
+	while (c->out_pos < c->out_len) {
+		n = send(c->fd, &c->out[c->out_pos], c->out_len - c->out_pos, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* the rest is written on EPOLLOUT */
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		c->out_pos += n;
+	}
+
+	if (c->ui->body_len) {
+		http_client_sent(c->ui, c->ui->body_len);
+	}
+
+	return 0;
+}
+
+/* format and start writing the request of a connected connection */
+static int conn_request(struct epoll_conn *c)
+{
+	struct wasp_if_msg *ui = c->ui;
+	int n = snprintf(c->out, sizeof(c->out), "%s %s HTTP/1.1\r\nHost: %s\r\n",
+		ui->method, ui->path, ui->ipv4_address);
+
+	if (n < 0 || n >= (int)sizeof(c->out)) {
+		return -1;
+	}
+	c->out_len = n;
+	if (http_client_headers(ui, add_header, c) ||
+	    c->out_len + 2 + ui->body_len > sizeof(c->out)) {
+		return -1;
+	}
+	c->out[c->out_len++] = '\r';
+	c->out[c->out_len++] = '\n';
+	memcpy(&c->out[c->out_len], ui->body, ui->body_len);
+	c->out_len += ui->body_len;
+	c->out_pos = 0;
+
+	return conn_write(c);
+}
+
+/* the request or stream ended, status -1 if it failed after connecting */
+static void conn_end(struct epoll_conn *c, int status)
+{
+	struct wasp_if_msg *ui = c->ui;
+
+	/* keep the connection for the device's next request */
+	c->ui = NULL;
+	if (status < 0 || c->slot != CONN_REQUEST || c->resp.close || c->in_len) {
+		conn_close(c);
+	} else {
+		c->reused = 1;
+	}
+
+	http_client_completed(ui, c, status);
+}
+
+static void conn_error(struct epoll_conn *c)
+{
+	struct wasp_if_msg *ui = c->ui;
+
+	/* a kept alive connection closed by the device before the response, send again once */
+	if (c->reused && !c->received) {
+		conn_close(c);
+		c->established = 0;
+		c->in_len = 0;
+		http_response_init(&c->resp);
+		if (!conn_open(c)) {
+			return;
+		}
+	}
+
+	if (c->connected) {
+		conn_end(c, -1);
+		return;
+	}
+
+	c->ui = NULL;
+	conn_close(c);
+	http_client_failed(ui, c);
+}
+
+/*
+ * Parse the data read and report it.  Body pieces are passed from the
+ * read buffer without copying.
+ *
+ * /returns nonzero if the request or stream ended.
+ */
+static int conn_parse(struct epoll_conn *c)
+{
+	const char *body = NULL;
+	size_t body_len = 0;
+	size_t used = 0;
+	char save = 0;
+	int n = 0;
+	int ret = 0;
+
+	while (used < c->in_len) {
+		n = http_response_parse(&c->resp, &c->in[used], c->in_len - used, &body, &body_len);
+		if (n < 0) {
+			printf("Invalid HTTP response from %s\n", c->ui->ipv4_address);
+			conn_end(c, -1);
+			return 1;
+		}
+		if (!n) {
+			break;
+		}
+		used += n;
+
+		if (!c->established && c->resp.state != HTTP_RESPONSE_HEADERS) {
+			c->established = 1;
+			if (http_client_established(c->ui, c, c->resp.status, c->resp.encoding)) {
+				conn_end(c, -1);
+				return 1;
+			}
+		}
+
+		if (body_len) {
+			save = body[body_len];
+			c->in[body - c->in + body_len] = '\0';
+			ret = http_client_data(c->ui, body, body_len);
+			c->in[body - c->in + body_len] = save;
+			if (ret) {
+				conn_end(c, -1);
+				return 1;
+			}
+		}
+
+		if (c->resp.state == HTTP_RESPONSE_DONE) {
+			c->in_len -= used;
+			memmove(c->in, &c->in[used], c->in_len);
+			conn_end(c, c->resp.status);
+			return 1;
+		}
+	}
+
+	c->in_len -= used;
+	memmove(c->in, &c->in[used], c->in_len);
+	if (c->in_len == EPOLL_RESP_LEN) {
+		printf("HTTP response headers from %s too long\n", c->ui->ipv4_address);
+		conn_end(c, -1);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void conn_read(struct epoll_conn *c)
+{
+	ssize_t n = 0;
+
+	while (1) {
+		n = recv(c->fd, &c->in[c->in_len], EPOLL_RESP_LEN - c->in_len, 0);
+		if (n > 0) {
+			c->in_len += n;
+			c->received = 1;
+			if (conn_parse(c)) {
+				return;
+			}
+			continue;
+		}
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		}
+
+		/* closed by the device, the end of a response without a length */
+		if (!n && c->established && !http_response_eof(&c->resp)) {
+			conn_end(c, c->resp.status);
+		} else {
+			conn_error(c);
+		}
+		return;
+	}
+}
+
+static void conn_event(struct epoll_conn *c, uint32_t events)
+{
+	int err = 0;
+	socklen_t err_len = sizeof(err);
+
+	/* an idle kept alive connection closed by the device */
+	if (!c->ui) {
+		conn_close(c);
+		return;
+	}
+
+	if (!c->connected) {
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) || err) {
+			conn_error(c);
+			return;
+		}
+		if (!(events & EPOLLOUT)) {
+			return;
+		}
+		c->connected = 1;
+		if (conn_request(c)) {
+			conn_error(c);
+			return;
+		}
+	} else if ((events & EPOLLOUT) && c->out_pos < c->out_len) {
+		if (conn_write(c)) {
+			conn_error(c);
+			return;
+		}
+	}
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+		conn_read(c);
+	}
+}
+
+static void * epoll_transport_send(struct device_conn *d, struct wasp_if_msg *ui)
+{
+	enum conn_slot slot = ui == &d->stream_ui ? CONN_STREAM : CONN_REQUEST;
+	struct epoll_conn *c = conns[d->index][slot];
+
+	if (!c) {
+		c = malloc(sizeof(*c));
+		if (!c) {
+			printf("Out of memory connecting to %s\n", ui->ipv4_address);
+			return NULL;
+		}
+		memset(c, 0, sizeof(*c));
+		c->fd = -1;
+		c->slot = slot;
+		c->d = d;
+		conns[d->index][slot] = c;
+	}
+
+	c->ui = ui;
+	c->received = 0;
+	c->established = 0;
+	c->in_len = 0;
+	http_response_init(&c->resp);
+
+	/* on the kept alive connection, or a new one if it was closed meanwhile */
+	if (c->fd >= 0 && !conn_request(c)) {
+		return c;
+	}
+	conn_close(c);
+	if (conn_open(c)) {
+		c->ui = NULL;
+		return NULL;
+	}
+
+	return c;
+}
+
+static void epoll_transport_close(struct device_conn *d, void *conn)
+{
+	struct epoll_conn *c = (struct epoll_conn *)conn;
+	struct wasp_if_msg *ui = c->ui;
+
+	(void)d;
+	c->ui = NULL;
+	conn_close(c);
+	if (ui) {
+		http_client_closed(ui, c);
+	}
+}
+
+static void epoll_transport_timer(struct device_conn *d, enum http_client_timer timer, uint64_t delay_us)
+{
+	int thread = http_client_thread_of(d->index);
+	uint64_t t = delay_us ? _wasp_if_time_us() + delay_us : 0;
+
+	timer_devs[d->index] = d;
+	deadlines[d->index][timer] = t;
+	if (t && (!next_deadline[thread] || t < next_deadline[thread])) {
+		next_deadline[thread] = t;
+	}
+}
+
+/* run the expired timers of a thread's devices */
+static void run_timers(int thread)
+{
+	uint64_t now = _wasp_if_time_us();
+	int shard = thread / num_threads;
+	int tsi = thread % num_threads;
+	int i = 0;
+	int t = 0;
+
+	if (!next_deadline[thread] || now < next_deadline[thread]) {
+		return;
+	}
+
+	next_deadline[thread] = 0;
+	for (i = shard + tsi * num_shards; i < WASP_IF_MAX_DEVICES; i += num_shards * num_threads) {
+		for (t = 0; t < HTTP_CLIENT_NUM_TIMERS; t++) {
+			if (deadlines[i][t] && deadlines[i][t] <= now) {
+				deadlines[i][t] = 0;
+				http_client_timer(timer_devs[i], t);
+			}
+
+			/* possibly set again by the timer */
+			if (deadlines[i][t] && (!next_deadline[thread] || deadlines[i][t] < next_deadline[thread])) {
+				next_deadline[thread] = deadlines[i][t];
+			}
+		}
+	}
+}
+
+static void epoll_transport_wake(int thread)
+{
+	uint64_t one = 1;
+
+	if (write(wake_fds[thread], &one, sizeof(one)) < 0) {
+		/* the counter is already nonzero */
+	}
+}
+
+static void epoll_transport_run(int thread)
+{
+	struct epoll_event events[EPOLL_MAX_EVENTS];
+	uint64_t now = 0;
+	uint64_t val = 0;
+	int timeout = -1;
+	int n = 0;
+	int i = 0;
+
+	while (1) {
+		http_client_service(thread);
+
+		timeout = -1;
+		if (next_deadline[thread]) {
+			now = _wasp_if_time_us();
+			timeout = next_deadline[thread] > now ? (next_deadline[thread] - now + 999) / 1000 : 0;
+		}
+
+		n = epoll_wait(epfds[thread], events, EPOLL_MAX_EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			printf("epoll_wait error on HTTP client thread %d: %s\n", thread, strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr) {
+				conn_event((struct epoll_conn *)events[i].data.ptr, events[i].events);
+			} else if (read(wake_fds[thread], &val, sizeof(val)) < 0) {
+				/* woken by another event meanwhile */
+			}
+		}
+
+		run_timers(thread);
+	}
+}
+
+static int epoll_transport_start(int shards, int threads)
+{
+	struct epoll_event ev;
+	int i = 0;
+
+	num_shards = shards;
+	num_threads = threads;
+	if (num_shards * num_threads > WASP_IF_MAX_SERVICE_THREADS) {
+		num_threads = WASP_IF_MAX_SERVICE_THREADS / num_shards;
+	}
+
+	/* an epoll instance per thread, woken by an eventfd when requests are queued */
+	for (i = 0; i < num_shards * num_threads; i++) {
+		epfds[i] = epoll_create1(EPOLL_CLOEXEC);
+		wake_fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epfds[i] < 0 || wake_fds[i] < 0 || epoll_ctl(epfds[i], EPOLL_CTL_ADD, wake_fds[i], &ev)) {
+			printf("ERROR: epoll init failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	return num_threads;
+}
+
+const struct http_transport epoll_transport = {
+	"epoll",
+	epoll_transport_start,
+	epoll_transport_run,
+	epoll_transport_wake,
+	epoll_transport_send,
+	epoll_transport_close,
+	epoll_transport_timer
+};
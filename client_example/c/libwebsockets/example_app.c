@@ -20,6 +20,8 @@ int analog_input(const char *ipv4_address, int index)
 	char schema_id[WASP_IF_OBJ_PROP_LEN];
 	char prop[WASP_IF_OBJ_PROP_LEN];
 	char body[WASP_IF_BODY_LEN];
+	struct wasp_if_update update;
+	int body_len = 0;
 	char name[WASP_IF_OBJ_PROP_LEN];
 	const char *label_prop = "label";
 	const char *type = "block:io";
@@ -250,18 +252,18 @@ int analog_input(const char *ipv4_address, int index)
 
 	/* set the level and phantom in one request */
 	printf("\n---set the level and phantom power state in one request---\n");
-	snprintf(body,
-		WASP_IF_BODY_LEN,
-		"[{\"_id\":%d, \"active\":%s}, {\"_id\":%d, \"level\":%d}]",
-		phantom_ctrl_id,
-		"false",
-		level_ctrl_id,
-		24
-	);
+	wasp_if_update_init(&update, body, sizeof(body));
+	wasp_if_update_bool(&update, phantom_ctrl_id, phantom_active_prop, strlen(phantom_active_prop), 0);
+	wasp_if_update_num(&update, level_ctrl_id, level_level_prop, strlen(level_level_prop), 24);
+	body_len = wasp_if_update_finish(&update);
+	if (body_len < 0) {
+		printf("update body too long\n");
+		return -1;
+	}
 	ret = wasp_if_object_set_multiple_properties(
 		ipv4_address,
 		body,
-		sizeof(body)
+		body_len
 	);
 	if (ret == 200 || ret == 202) {
 		printf("set phantom power state and level success\n");
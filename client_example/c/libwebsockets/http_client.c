@@ -0,0 +1,919 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#define _GNU_SOURCE /* pthread_setaffinity_np() */
+
+#include "wasp_interface.h"
+#include "http_client.h"
+#include "http_inflate.h"
+#include "metrics.h"
+#include "trace_ring.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* a longer partial update event is discarded */
+#define STREAM_EVENT_MAX_LEN (1024 * 1024)
+#define STREAM_EVENT_DELIM "---"
+
+static const struct http_transport *transport = &lws_transport;
+static struct device_conn devs[WASP_IF_MAX_DEVICES];
+static int num_shards = 1;
+static int num_threads = 1;
+static int cpu_affinity = 0;
+
+/* a request that cannot be sent, completed for the thread waiting on it */
+static void msg_failed(const struct wasp_if_msg *msg)
+{
+	if (msg->bulk) {
+		_wasp_if_bulk_complete(msg->bulk, msg->bulk_slot, -1);
+	} else if (msg->waiter) {
+		_wasp_if_notify_request_complete(msg->waiter, -1);
+	}
+}
+
+static void queue_msg(struct device_conn *d, const struct wasp_if_msg *msg, int front)
+{
+	struct pending_msg *pm = malloc(sizeof(*pm));
+	if (!pm) {
+		printf("Out of memory queuing request %s %s\n", msg->method, msg->path);
+		msg_failed(msg);
+		return;
+	}
+
+	pm->msg = *msg;
+	pm->next = NULL;
+	if (!pm->msg.stage_us[WASP_IF_STAGE_WAIT]) {
+		pm->msg.stage_us[WASP_IF_STAGE_WAIT] = _wasp_if_time_us();
+	}
+
+	if (front) {
+		pm->next = d->head;
+		d->head = pm;
+		if (!d->tail) {
+			d->tail = pm;
+		}
+	} else {
+		if (d->tail) {
+			d->tail->next = pm;
+		} else {
+			d->head = pm;
+		}
+		d->tail = pm;
+	}
+
+	d->queue_len++;
+	metrics_set_queue_depth(d->index, d->queue_len);
+}
+
+static int dequeue_msg(struct device_conn *d, struct wasp_if_msg *msg)
+{
+	struct pending_msg *pm = d->head;
+	if (!pm) {
+		return 0;
+	}
+
+	d->head = pm->next;
+	if (!d->head) {
+		d->tail = NULL;
+	}
+	*msg = pm->msg;
+	free(pm);
+
+	d->queue_len--;
+	metrics_set_queue_depth(d->index, d->queue_len);
+
+	return 1;
+}
+
+static void stream_send(const char *ipv4_address);
+static void stream_schedule_reconnect(struct device_conn *d);
+static void request_complete(struct wasp_if_msg *ui, int status);
+
+static void send_msg(struct wasp_if_msg *msg)
+{
+	struct wasp_if_msg * ui = NULL;
+	struct device_conn *d = NULL;
+	void *conn = NULL;
+	int dev_index = _wasp_if_ipv4_to_device_index(msg->ipv4_address);
+	if (dev_index == -1) {
+		/* device not found */
+		msg_failed(msg);
+		return;
+	}
+
+	d = &devs[dev_index];
+	if (strcmp(msg->path, "/wasp/u2/objects")) {
+		d->in_progress = 1;
+		ui = &d->ui;
+	} else {
+		/* a reconnect may be scheduled, this attempt replaces it */
+		transport->timer(d, HTTP_CLIENT_TIMER_STREAM_RECONNECT, 0);
+
+		/* stream already open - close it and reconnect with the current stream options */
+		if (d->stream_conn) {
+			d->stream_restart = 1;
+			transport->close(d, d->stream_conn);
+			return;
+		}
+
+		ui = &d->stream_ui;
+	}
+
+	/* store the request for the transport and for later lookup within the events */
+	strncpy(ui->path, msg->path, sizeof(msg->path));
+	strncpy(ui->method, msg->method, sizeof(msg->method));
+	strncpy(ui->ipv4_address, msg->ipv4_address, sizeof(msg->ipv4_address));
+	ui->flags = msg->flags;
+	ui->bulk = msg->bulk;
+	ui->bulk_slot = msg->bulk_slot;
+	ui->waiter = msg->waiter;
+	ui->body_len = msg->body_len < WASP_IF_BODY_LEN ? msg->body_len : WASP_IF_BODY_LEN - 1;
+	memcpy(ui->body, msg->body, ui->body_len);
+	ui->body[ui->body_len] = '\0';
+	_wasp_if_trace(TRACE_REQ_SEND, dev_index, metrics_method(msg->method), _wasp_if_path_obj_id(msg->path));
+
+	/* requests started on the HTTP client thread (authorization) did not queue or wait */
+	memcpy(ui->stage_us, msg->stage_us, sizeof(ui->stage_us));
+	ui->stage_us[WASP_IF_STAGE_CONNECT] = _wasp_if_time_us();
+	if (!ui->stage_us[WASP_IF_STAGE_WAIT]) {
+		ui->stage_us[WASP_IF_STAGE_WAIT] = ui->stage_us[WASP_IF_STAGE_CONNECT];
+	}
+	if (!ui->stage_us[WASP_IF_STAGE_QUEUE]) {
+		ui->stage_us[WASP_IF_STAGE_QUEUE] = ui->stage_us[WASP_IF_STAGE_WAIT];
+	}
+
+	conn = transport->send(d, ui);
+	if (ui == &d->stream_ui) {
+		d->stream_conn = conn;
+		if (!conn) {
+			stream_schedule_reconnect(d);
+		}
+	} else if (!conn) {
+		/* no connection attempt, the request failed (unless the transport already reported it) */
+		request_complete(ui, -1);
+	}
+}
+
+static void stream_send(const char *ipv4_address)
+{
+	struct wasp_if_msg tmp_msg;
+
+	_wasp_if_msg_init(
+		&tmp_msg,
+		"GET",
+		ipv4_address,
+		"/wasp/u2/objects",
+		NULL);
+	send_msg(&tmp_msg);
+}
+
+/* reconnect after an exponentially increasing delay with jitter */
+static void stream_schedule_reconnect(struct device_conn *d)
+{
+	const struct wasp_if_config *cfg = _wasp_if_get_config();
+	int delay_ms = cfg->stream_backoff_min_ms > 0 ? cfg->stream_backoff_min_ms : 1;
+	int max_ms = cfg->stream_backoff_max_ms > delay_ms ? cfg->stream_backoff_max_ms : delay_ms;
+	int i = 0;
+
+	for (i = 0; i < d->stream_attempts && delay_ms < max_ms; i++) {
+		delay_ms *= 2;
+	}
+	if (delay_ms > max_ms) {
+		delay_ms = max_ms;
+	}
+
+	/* between half and all of the delay, so devices do not reconnect in lockstep */
+	delay_ms = delay_ms / 2 + rand() % (delay_ms / 2 + 1);
+	d->stream_attempts++;
+	METRICS_ADD(d->index, stream_reconnects, 1);
+	_wasp_if_trace(TRACE_STREAM_RECONNECT, d->index, delay_ms, d->stream_attempts);
+
+	transport->timer(d, HTTP_CLIENT_TIMER_STREAM_RECONNECT, (uint64_t)delay_ms * 1000);
+}
+
+static void stream_closed(void *conn, struct wasp_if_msg *ui)
+{
+	struct device_conn *d = http_client_device(ui);
+	if (!d || d->stream_conn != conn) {
+		return;
+	}
+
+	d->stream_conn = NULL;
+	_wasp_if_trace(TRACE_STREAM_CLOSED, d->index, d->stream_restart, 0);
+
+	/* updates may be missed until the stream is reconnected */
+	if (d->stream_up) {
+		d->stream_up = 0;
+		d->stream_resync = 1;
+	}
+
+	if (d->stream_restart) {
+		/* closed to apply new stream options - reconnect */
+		d->stream_restart = 0;
+		stream_send(ui->ipv4_address);
+	} else {
+		stream_schedule_reconnect(d);
+	}
+}
+
+static void stream_established(void *conn, struct wasp_if_msg *ui, int status)
+{
+	struct wasp_if_msg resync_msg;
+	struct device_conn *d = http_client_device(ui);
+	if (!d || d->stream_conn != conn) {
+		return;
+	}
+
+	_wasp_if_trace(TRACE_STREAM_UP, d->index, status, 0);
+	if (status == 401) {
+		/* authorize before the stream is reconnected */
+		d->auth = AUTH_NONE;
+		d->auth_wanted = 1;
+	}
+	if (status >= 300) {
+		return;
+	}
+
+	d->stream_up = 1;
+	d->stream_attempts = 0;
+	d->stream_len = 0;
+
+	/* re-read the objects now the stream is delivering updates again */
+	if (d->stream_resync) {
+		d->stream_resync = 0;
+		if (_wasp_if_get_config()->stream_resync) {
+			_wasp_if_msg_init(
+				&resync_msg,
+				"GET",
+				ui->ipv4_address,
+				"/wasp/r2/objects",
+				NULL);
+			resync_msg.flags = WASP_IF_MSG_RESYNC;
+			queue_msg(d, &resync_msg, 0);
+		}
+	}
+}
+
+static void send_authorization_request(struct device_conn *d)
+{
+	struct wasp_if_msg tmp_msg;
+	_wasp_if_msg_init(
+		&tmp_msg,
+		"POST",
+		d->ui.ipv4_address[0] ? d->ui.ipv4_address : d->stream_ui.ipv4_address,
+		"/wasp/r2/device/auth",
+		NULL);
+
+	d->auth = AUTH_PENDING;
+	d->auth_wanted = 0;
+	d->auth_refresh_due = 0;
+	METRICS_ADD(d->index, auth_requests, 1);
+	_wasp_if_trace(TRACE_AUTH_START, d->index, 0, 0);
+	send_msg(&tmp_msg);
+}
+
+static void auth_complete(struct device_conn *d, int status)
+{
+	int refresh_s = _wasp_if_get_config()->auth_refresh_s;
+
+	_wasp_if_trace(TRACE_AUTH_DONE, d->index, status, 0);
+	if (status != 200) {
+		/* continue without authorization, requests report the device's status */
+		printf("Authorization of %s failed, err: %d\n", d->ui.ipv4_address, status);
+	}
+
+	d->auth = AUTH_VALID;
+
+	/* re-authorize in the background before the authorization expires */
+	if (status == 200 && refresh_s > 0) {
+		transport->timer(d, HTTP_CLIENT_TIMER_AUTH_REFRESH, (uint64_t)refresh_s * 1000000);
+	}
+}
+
+/* send the next request of each idle device of a service thread, authorizing first if needed */
+static void service_devices(int shard, int tsi)
+{
+	struct wasp_if_msg next;
+	struct device_conn *d = NULL;
+	int i = 0;
+
+	/* the devices for which http_client_thread_of() is this thread */
+	for (i = shard + tsi * num_shards; i < WASP_IF_MAX_DEVICES; i += num_shards * num_threads) {
+		d = &devs[i];
+		if (d->in_progress) {
+			continue;
+		}
+
+		if (d->auth == AUTH_PENDING) {
+			continue;
+		}
+
+		if ((d->auth == AUTH_NONE && (d->head || d->auth_wanted)) ||
+		    (d->auth == AUTH_VALID && d->auth_refresh_due)) {
+			if (d->head) {
+				strncpy(d->ui.ipv4_address, d->head->msg.ipv4_address, WASP_IF_IPV4_ADDRESS_LEN);
+			}
+			send_authorization_request(d);
+			continue;
+		}
+
+		if (d->auth != AUTH_VALID) {
+			continue;
+		}
+
+		if (d->stream_pending) {
+			d->stream_pending = 0;
+			stream_send(d->stream_ui.ipv4_address);
+		}
+
+		if (dequeue_msg(d, &next)) {
+			send_msg(&next);
+		}
+	}
+}
+
+/* move requests from a service thread's application pipe to the device queues */
+static void read_requests(int thread)
+{
+	struct wasp_if_msg msg;
+	int dev_index = 0;
+
+	while (_wasp_if_msg_read(thread, &msg)) {
+		dev_index = _wasp_if_ipv4_to_device_index(msg.ipv4_address);
+		if (dev_index == -1) {
+			/* device not found */
+			msg_failed(&msg);
+			continue;
+		}
+
+		/* the update stream is not a request, it stays open */
+		if (!strcmp(msg.path, "/wasp/u2/objects")) {
+			if (devs[dev_index].auth == AUTH_VALID) {
+				send_msg(&msg);
+			} else {
+				/* opened by service_devices() once authorized */
+				strncpy(devs[dev_index].stream_ui.ipv4_address, msg.ipv4_address, WASP_IF_IPV4_ADDRESS_LEN);
+				devs[dev_index].stream_pending = 1;
+				devs[dev_index].auth_wanted = 1;
+			}
+			continue;
+		}
+
+		queue_msg(&devs[dev_index], &msg, 0);
+	}
+}
+
+/* wasp_if_connect_to_devices() - objects read, then schemas (unless lazy), then open the stream */
+static void connect_step_complete(struct device_conn *d, struct wasp_if_msg *ui, int status)
+{
+	struct wasp_if_msg schemas_msg;
+
+	if (status != 200) {
+		_wasp_if_notify_connect_progress(ui->ipv4_address, WASP_IF_CONNECT_FAILED, status);
+		return;
+	}
+
+	if (!strcmp(ui->path, "/wasp/r2/objects") && !_wasp_if_get_config()->lazy_schemas) {
+		_wasp_if_notify_connect_progress(ui->ipv4_address, WASP_IF_CONNECT_OBJECTS, status);
+		_wasp_if_msg_init(
+			&schemas_msg,
+			"GET",
+			ui->ipv4_address,
+			"/wasp/r2/schemas",
+			NULL);
+		schemas_msg.flags = WASP_IF_MSG_CONNECT;
+		queue_msg(d, &schemas_msg, 1);
+	} else if (_wasp_if_notify_connect_progress(ui->ipv4_address, WASP_IF_CONNECT_DONE, status)) {
+		strncpy(d->stream_ui.ipv4_address, ui->ipv4_address, WASP_IF_IPV4_ADDRESS_LEN);
+		d->stream_pending = 1;
+	}
+}
+
+/* a GET/PATCH/POST request of a device completed */
+static void request_complete(struct wasp_if_msg *ui, int status)
+{
+	struct device_conn *d = http_client_device(ui);
+	int resend = status == 401 && !(ui->flags & WASP_IF_MSG_REPLAYED) &&
+		strcmp(ui->path, "/wasp/r2/device/auth");
+
+	int method = metrics_method(ui->method);
+
+	/*
+	 * Complete each request once: lws may report CLIENT_CONNECTION_ERROR from
+	 * within lws_client_connect_via_info() and then return NULL to send_msg().
+	 */
+	if (!d->in_progress) {
+		return;
+	}
+	d->in_progress = 0;
+	http_inflate_end(&d->inflate);
+	_wasp_if_record_request(ui->ipv4_address, ui->stage_us, status, resend);
+	_wasp_if_trace(TRACE_REQ_COMPLETE, d->index, status,
+		(int32_t)(_wasp_if_time_us() - ui->stage_us[WASP_IF_STAGE_QUEUE]));
+	if (method >= 0) {
+		METRICS_ADD(d->index, requests[method][metrics_status_class(status)], 1);
+	}
+
+	if (!strcmp(ui->path, "/wasp/r2/device/auth")) {
+		auth_complete(d, status);
+		return;
+	}
+
+	/* authorization expired - re-authorize and resend this device's request */
+	if (resend) {
+		struct wasp_if_msg replay;
+		int body_len = ui->body_len < WASP_IF_BODY_LEN - 1 ? ui->body_len : WASP_IF_BODY_LEN - 1;
+
+		_wasp_if_msg_init(&replay, ui->method, ui->ipv4_address, ui->path, NULL);
+		if (!strcmp(ui->method, "PATCH")) {
+			memcpy(replay.body, ui->body, body_len);
+			replay.body_len = body_len;
+		}
+		replay.flags = ui->flags | WASP_IF_MSG_REPLAYED;
+		replay.bulk = ui->bulk;
+		replay.bulk_slot = ui->bulk_slot;
+		replay.waiter = ui->waiter;
+		replay.stage_us[WASP_IF_STAGE_QUEUE] = ui->stage_us[WASP_IF_STAGE_QUEUE];
+		replay.stage_us[WASP_IF_STAGE_WAIT] = ui->stage_us[WASP_IF_STAGE_WAIT];
+		queue_msg(d, &replay, 1);
+		d->auth = AUTH_NONE;
+		return;
+	}
+
+	/* one object of wasp_if_object_read_bulk(), the caller waits on the whole set */
+	if (ui->bulk) {
+		_wasp_if_bulk_complete(ui->bulk, ui->bulk_slot, status);
+		return;
+	}
+
+	/* index the downloaded objects */
+	if (!strcmp(ui->path, "/wasp/r2/objects") && status == 200) {
+		_wasp_if_store_objects_done(ui->ipv4_address, ui->flags & (WASP_IF_MSG_RESYNC | WASP_IF_MSG_DIFF));
+	}
+
+	/* store all schemas, or one schema read by ID */
+	if (!strcmp(ui->path, "/wasp/r2/schemas") && status == 200) {
+		_wasp_if_store_schemas_done(ui->ipv4_address, NULL);
+	} else if (!strncmp(ui->path, "/wasp/r2/schemas/", 17) && status == 200) {
+		_wasp_if_store_schemas_done(ui->ipv4_address, &ui->path[17]);
+	}
+
+	if (ui->flags & WASP_IF_MSG_CONNECT) {
+		connect_step_complete(d, ui, status);
+	} else if (ui->waiter) {
+		_wasp_if_notify_request_complete(ui->waiter, status);
+	}
+}
+
+/* count and trace one update event */
+static void count_event(struct device_conn *d, enum wasp_if_event_type type, size_t len)
+{
+	METRICS_ADD(d->index, stream_events[type], 1);
+	_wasp_if_trace(TRACE_STREAM_EVENT, d->index, type, (int32_t)len);
+}
+
+/* fields of an update event, found in one walk of its index */
+struct event_fields {
+	struct json_elem type;
+	struct json_elem body;
+	struct json_elem prop;
+	struct json_elem path;
+};
+
+static int event_field_cb(const char *s, const struct json_elem *e, void *ud)
+{
+	struct event_fields *f = (struct event_fields *)ud;
+	const char *k = &s[e->koff + 1];
+	int n = e->klen - 2;
+
+	if (n == 5 && !memcmp(k, "_type", 5)) {
+		f->type = *e;
+	} else if (n == 4 && !memcmp(k, "body", 4)) {
+		f->body = *e;
+	} else if (n == 4 && !memcmp(k, "prop", 4)) {
+		f->prop = *e;
+	} else if (n == 4 && !memcmp(k, "path", 4)) {
+		f->path = *e;
+	}
+
+	return 0;
+}
+
+/* body element of an update event */
+struct event_body {
+	struct wasp_if_msg *ui;
+	int group;             /* update:group_prefix, keys are object IDs */
+	int obj_id;
+	const char *path;
+	const char *prop;
+};
+
+static int event_body_cb(const char *s, const struct json_elem *e, void *ud)
+{
+	struct event_body *b = (struct event_body *)ud;
+	char key[WASP_IF_UPDATE_STREAM_BODY_KEY_LEN];
+
+	if (b->group) {
+		/* {"id1":value1, "id2":value2, ...} */
+		if (e->klen - 2 >= (int)sizeof(key)) {
+			return 0;
+		}
+		memcpy(key, &s[e->koff + 1], e->klen - 2);
+		key[e->klen - 2] = '\0';
+		_wasp_if_notify_property_rcvd(b->ui->ipv4_address, atoi(key), NULL,
+			b->prop, strlen(b->prop), &s[e->voff], e->vlen);
+	} else {
+		/* {"prop1":value1, "prop2":value2, ...} */
+		_wasp_if_notify_property_rcvd(b->ui->ipv4_address, b->obj_id, b->path,
+			&s[e->koff + 1], e->klen - 2, &s[e->voff], e->vlen);
+	}
+
+	return 0;
+}
+
+/* one update event, NUL terminated */
+static void stream_event(struct device_conn *d, const char *in)
+{
+	struct event_fields f;
+	struct event_body b;
+	char type[WASP_IF_OBJ_TYPE_LEN];
+	char prop[WASP_IF_OBJ_PROP_LEN] = "";
+	char path[WASP_IF_PATH_LEN] = "";
+	size_t len = strlen(in);
+
+	/* index the event once, then read its fields and body from the index */
+	memset(&f, 0, sizeof(f));
+	if (json_index_build(&d->stream_ix, in, len) ||
+	    json_index_foreach(&d->stream_ix, in, 0, event_field_cb, &f) < 0) {
+		return;
+	}
+
+	/* get the update type */
+	if (json_index_get_string(in, &f.type, type, sizeof(type)) < 0) {
+		return;
+	}
+	if (f.body.vtype != '{') {
+		count_event(d, WASP_IF_EVENT_OTHER, len);
+		return;
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.ui = &d->stream_ui;
+	b.obj_id = -1;
+	b.path = path;
+	b.prop = prop;
+
+	/* update:group_prefix - multiple objects of common type, property */
+	if (!strcmp(type, "update:group_prefix")) {
+		count_event(d, WASP_IF_EVENT_GROUP_PREFIX, len);
+
+		/* get the property common to the group */
+		if (json_index_get_string(in, &f.prop, prop, sizeof(prop)) < 0) {
+			prop[0] = '\0';
+		}
+		b.group = 1;
+	} else if (!strcmp(type, "update:obj")) {
+		/* update:obj - one object */
+		count_event(d, WASP_IF_EVENT_OBJ, len);
+		if (json_index_get_string(in, &f.path, path, sizeof(path)) < 0) {
+			path[0] = '\0';
+		}
+		if (strrchr(path, '/')) {
+			b.obj_id = atoi(strrchr(path, '/') + 1);
+		}
+	} else {
+		count_event(d, WASP_IF_EVENT_OTHER, len);
+		return;
+	}
+
+	json_index_foreach(&d->stream_ix, in, f.body.at, event_body_cb, &b);
+}
+
+/*
+ * Update stream data.  Events are separated by "---" and a read may end
+ * anywhere within an event or delimiter, so the incomplete tail is kept
+ * until the rest of it arrives.
+ */
+static void stream_data(struct device_conn *d, const char *p, size_t len)
+{
+	size_t delim_len = strlen(STREAM_EVENT_DELIM);
+	size_t scan = d->stream_len > delim_len ? d->stream_len - delim_len + 1 : 0;
+	size_t start = 0;
+	size_t cap = 0;
+	char *token = NULL;
+	char *tmp = NULL;
+
+	if (d->stream_len + len + 1 > d->stream_cap) {
+		cap = d->stream_cap ? d->stream_cap : 4096;
+		while (cap < d->stream_len + len + 1) {
+			cap *= 2;
+		}
+		tmp = realloc(d->stream_buf, cap);
+		if (!tmp) {
+			printf("Out of memory reading the update stream of %s\n", d->stream_ui.ipv4_address);
+			d->stream_len = 0;
+			return;
+		}
+		d->stream_buf = tmp;
+		d->stream_cap = cap;
+	}
+
+	memcpy(&d->stream_buf[d->stream_len], p, len);
+	d->stream_len += len;
+	d->stream_buf[d->stream_len] = '\0';
+
+	/* scan only the new data, and a delimiter the previous read may have split */
+	while ((token = strstr(&d->stream_buf[scan], STREAM_EVENT_DELIM)) != NULL) {
+		*token = '\0';
+		stream_event(d, &d->stream_buf[start]);
+		start = token - d->stream_buf + delim_len;
+		scan = start;
+	}
+
+	d->stream_len -= start;
+	if (d->stream_len > STREAM_EVENT_MAX_LEN) {
+		printf("Update stream event from %s too long, discarded\n", d->stream_ui.ipv4_address);
+		d->stream_len = 0;
+		d->stream_buf[0] = '\0';
+		return;
+	}
+	memmove(d->stream_buf, &d->stream_buf[start], d->stream_len + 1);
+}
+
+/* store (decoded) response data of a GET/PATCH/POST request */
+static int response_data(const char *p, size_t len, void *ud)
+{
+	struct wasp_if_msg *ui = (struct wasp_if_msg *)ud;
+	char auth_id[WASP_IF_AUTH_ID_LEN];
+	char auth_id_str[WASP_IF_AUTH_STR_LEN];
+
+	/* POST authorization request */
+	if (!strcmp(ui->method, "POST") && !strcmp(ui->path, "/wasp/r2/device/auth")) {
+		/* store the authorization ID */
+		if (json_get_string(p, strlen(p), "$.id", auth_id, WASP_IF_AUTH_ID_LEN) > 0) {
+			snprintf(auth_id_str, sizeof(auth_id_str), "Hawk id=\"%s\"", auth_id);
+			_wasp_if_store_auth_str(ui->ipv4_address, auth_id_str);
+		}
+	}
+
+	/* GET requests */
+	if (ui->bulk) {
+		/* one object of a bulk read, kept apart from the single request response */
+		_wasp_if_bulk_data(ui->bulk, ui->bulk_slot, ui->pos, p, len);
+		ui->pos += len;
+	} else if (!strcmp(ui->method, "GET")) {
+		if (strstr(ui->path, "/wasp/r2/objects/") || !strcmp(ui->path, "/wasp/r2/device/info")) {
+			if (ui->waiter) {
+				_wasp_if_store_single_object(ui->waiter, p);
+			}
+		}
+
+		/* store the schemas. large responses (objects, schemas) arrive in pieces - assemble ourselves */
+		if (!strncmp(ui->path, "/wasp/r2/schemas", 16)) {
+			_wasp_if_store_schema(ui->ipv4_address, ui->pos, p, len);
+			ui->pos += len;
+		}
+		/* store the objects - see above */
+		if (!strcmp(ui->path, "/wasp/r2/objects")) {
+			_wasp_if_store_object(ui->ipv4_address, ui->pos, p, len);
+			ui->pos += len;
+		}
+	}
+
+	return 0;
+}
+
+struct device_conn * http_client_device(const struct wasp_if_msg *ui)
+{
+	const char *p = (const char *)ui;
+
+	if (p < (const char *)devs || p >= (const char *)&devs[WASP_IF_MAX_DEVICES]) {
+		return NULL;
+	}
+
+	return &devs[(p - (const char *)devs) / sizeof(devs[0])];
+}
+
+int http_client_headers(struct wasp_if_msg *ui,
+	int (*add)(void *ctx, const char *name, const char *value, size_t len), void *ctx)
+{
+	const char *auth_str = NULL;
+	char content_length[16];
+
+	/* connected, the request is being sent */
+	ui->stage_us[WASP_IF_STAGE_DEVICE] = _wasp_if_time_us();
+
+	/* authorization request (POST) */
+	if (!strcmp(ui->method, "POST")) {
+		return add(ctx, "Authorization:", "Hawk", 4);
+	}
+
+	/* PATCH requests */
+	if (!strcmp(ui->method, "PATCH")) {
+		snprintf(content_length, sizeof(content_length), "%d", ui->body_len);
+		if (add(ctx, "Content-Length:", content_length, strlen(content_length)) ||
+		    add(ctx, "Content-Type:", "application/json", 16)) {
+			return -1;
+		}
+	}
+
+#ifdef HTTP_INFLATE_ACCEPT_ENCODING
+	/* objects, schemas etc. may be sent compressed */
+	if (!strcmp(ui->method, "GET") && strcmp(ui->path, "/wasp/u2/objects")) {
+		if (add(ctx, "Accept-Encoding:", HTTP_INFLATE_ACCEPT_ENCODING, strlen(HTTP_INFLATE_ACCEPT_ENCODING))) {
+			return -1;
+		}
+	}
+#endif
+
+	/* update stream options */
+	if (!strcmp(ui->path, "/wasp/u2/objects")) {
+		char period[WASP_IF_STREAM_HDR_LEN];
+		char exclude[WASP_IF_STREAM_HDR_LEN];
+
+		if (!_wasp_if_get_stream_headers(ui->ipv4_address,
+			period, sizeof(period), exclude, sizeof(exclude))) {
+			if (strlen(period) &&
+			    add(ctx, "X-Wasp-Stream-Min-Update-Period:", period, strlen(period))) {
+				return -1;
+			}
+			if (strlen(exclude) &&
+			    add(ctx, "X-Wasp-Stream-Exclude-Obj-Type:", exclude, strlen(exclude))) {
+				return -1;
+			}
+		}
+	}
+
+	/* All GET/PATCH requests, add authorization header */
+	auth_str = _wasp_if_ipv4_to_auth_str(ui->ipv4_address);
+	if (auth_str && strlen(auth_str)) {
+		return add(ctx, "Authorization:", auth_str, strlen(auth_str));
+	}
+
+	return 0;
+}
+
+int http_client_established(struct wasp_if_msg *ui, void *conn, int status, const char *encoding)
+{
+	struct device_conn *d = http_client_device(ui);
+
+	ui->pos = 0;
+	ui->stage_us[WASP_IF_STAGE_TRANSFER] = _wasp_if_time_us();
+	if (!strcmp(ui->path, "/wasp/u2/objects")) {
+		stream_established(conn, ui, status);
+		return 0;
+	}
+
+	/* compressed response (Accept-Encoding was sent) */
+	if (http_inflate_start(&d->inflate, encoding) < 0) {
+		printf("Unsupported Content-Encoding %s from %s\n", encoding, ui->ipv4_address);
+		return -1;
+	}
+
+	return 0;
+}
+
+int http_client_data(struct wasp_if_msg *ui, const char *p, size_t len)
+{
+	struct device_conn *d = http_client_device(ui);
+
+	METRICS_ADD(d->index, bytes_in, len);
+
+	/* update stream */
+	if (ui == &d->stream_ui) {
+		stream_data(d, p, len);
+		_wasp_if_trace(TRACE_STREAM_READ, d->index, (int32_t)len, (int32_t)d->stream_len);
+		return 0;
+	}
+
+	/* decode a compressed response before storing it */
+	if (d->inflate.active) {
+		return http_inflate_data(&d->inflate, p, len, response_data, ui) ? -1 : 0;
+	}
+
+	response_data(p, len, ui);
+
+	return 0;
+}
+
+void http_client_sent(struct wasp_if_msg *ui, size_t len)
+{
+	METRICS_ADD(http_client_device(ui)->index, bytes_out, len);
+}
+
+void http_client_completed(struct wasp_if_msg *ui, void *conn, int status)
+{
+	/* object update stream closed - reconnect after a backoff delay */
+	if (!strcmp(ui->path, "/wasp/u2/objects")) {
+		stream_closed(conn, ui);
+	} else {
+		request_complete(ui, status);
+	}
+}
+
+void http_client_failed(struct wasp_if_msg *ui, void *conn)
+{
+	printf("Unable to connect to device at address %s\n", ui->ipv4_address);
+	http_client_completed(ui, conn, -1);
+}
+
+void http_client_closed(struct wasp_if_msg *ui, void *conn)
+{
+	if (!strcmp(ui->path, "/wasp/u2/objects")) {
+		stream_closed(conn, ui);
+	}
+}
+
+void http_client_timer(struct device_conn *d, enum http_client_timer timer)
+{
+	switch (timer) {
+	case HTTP_CLIENT_TIMER_AUTH_REFRESH:
+		/* re-authorized by service_devices() once the device is idle */
+		d->auth_refresh_due = 1;
+		transport->wake(http_client_thread_of(d->index));
+		break;
+	case HTTP_CLIENT_TIMER_STREAM_RECONNECT:
+		stream_send(d->stream_ui.ipv4_address);
+		break;
+	default:
+		break;
+	}
+}
+
+int http_client_thread_of(int dev_index)
+{
+	if (dev_index < 0) {
+		return 0;
+	}
+
+	return (dev_index % num_shards) * num_threads + (dev_index / num_shards) % num_threads;
+}
+
+void http_client_wake(int thread)
+{
+	transport->wake(thread);
+}
+
+void http_client_service(int thread)
+{
+	/* read requests, then send what each device is ready for */
+	read_requests(thread);
+	service_devices(thread / num_threads, thread % num_threads);
+}
+
+static void * http_client_thread(void *args)
+{
+	cpu_set_t cpus;
+	int thread = (int)(intptr_t)args;
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpu_affinity && num_cpus > 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(thread % num_cpus, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+			printf("error setting the CPU affinity of HTTP client thread %d\n", thread);
+		}
+	}
+
+	transport->run(thread);
+
+	return NULL;
+}
+
+int http_client_start(int transport_type, int shards, int threads, int pin_cpus)
+{
+	pthread_t thread_id;
+	int i = 0;
+
+	transport = transport_type == WASP_IF_TRANSPORT_EPOLL ? &epoll_transport : &lws_transport;
+	num_shards = shards > 0 ? shards : 1;
+	num_threads = transport->start(num_shards, threads > 0 ? threads : 1);
+	if (num_threads < 1) {
+		return -1;
+	}
+	if (num_threads < threads) {
+		printf("%s transport supports %d threads per shard, %d requested\n", transport->name, num_threads, threads);
+	}
+	cpu_affinity = pin_cpus;
+
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		devs[i].index = i;
+		devs[i].shard = i % num_shards;
+		devs[i].tsi = (i / num_shards) % num_threads;
+	}
+
+	for (i = 0; i < num_shards * num_threads; i++) {
+		if (pthread_create(&thread_id, NULL, http_client_thread, (void *)(intptr_t)i)) {
+			printf("error starting HTTP client thread\n");
+			return -1;
+		}
+		pthread_detach(thread_id);
+	}
+
+	return num_threads;
+}
@@ -0,0 +1,163 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _HTTP_CLIENT_H
+#define _HTTP_CLIENT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "wasp_interface.h"
+#include "http_inflate.h"
+#include "json_index.h"
+
+/*
+ * Transport independent part of the HTTP client: per-device request
+ * queues, authorization, update stream reassembly and reconnects, and the
+ * mapping of devices to threads.  A transport (libwebsockets, or the
+ * built-in epoll HTTP/1.1 client) connects, moves the bytes and reports
+ * the progress of each request with the http_client_*() event functions.
+ * Everything of a device runs on the one thread serving it.
+ */
+
+enum auth_state {
+	AUTH_NONE,         /* not authorized, authorize before the next request */
+	AUTH_PENDING,      /* authorization request in progress */
+	AUTH_VALID         /* authorized (or the device does not require it) */
+};
+
+struct pending_msg {
+	struct wasp_if_msg msg;
+	struct pending_msg *next;
+};
+
+enum http_client_timer {
+	HTTP_CLIENT_TIMER_AUTH_REFRESH,              /* re-authorize before the authorization expires */
+	HTTP_CLIENT_TIMER_STREAM_RECONNECT,          /* reopen the update stream after a backoff delay */
+	HTTP_CLIENT_NUM_TIMERS
+};
+
+/* per-device request scheduling, owned by the device's HTTP client thread */
+struct device_conn {
+	int index;                                   /* device index */
+	int shard;                                   /* transport context of the device */
+	int tsi;                                     /* thread of the shard serving the device */
+	struct wasp_if_msg ui;                       /* request in progress */
+	int in_progress;                             /* one GET/PATCH/POST request at a time per device */
+	struct http_inflate inflate;                 /* decoder of a compressed response */
+	struct pending_msg *head;                    /* requests waiting to be sent */
+	struct pending_msg *tail;
+	size_t queue_len;
+	enum auth_state auth;
+	int auth_wanted;                             /* authorize even with no request waiting */
+	int auth_refresh_due;                        /* re-authorize once the device is idle */
+	int stream_pending;                          /* open the update stream once authorized */
+	struct wasp_if_msg stream_ui;                /* update stream */
+	void *stream_conn;                           /* transport connection of the update stream */
+	int stream_restart;
+	int stream_up;                               /* stream response received */
+	int stream_attempts;                         /* reconnects since the stream was last up */
+	int stream_resync;                           /* stream dropped, resync once reconnected */
+	char *stream_buf;                            /* update events not yet complete, reads may */
+	size_t stream_len;                           /* split an event anywhere */
+	size_t stream_cap;
+	struct json_index stream_ix;                 /* of the event being decoded, reused */
+};
+
+/* what the core needs of a transport, all called on the device's thread except wake() */
+struct http_transport {
+	const char *name;
+
+	/**
+	 * Create the transport contexts of the shards.
+	 *
+	 * /returns the number of threads per shard, fewer than requested if the
+	 *          transport supports fewer, or -1 on error.
+	 */
+	int (*start)(int shards, int threads);
+
+	/* service loop of an HTTP client thread, calls http_client_service() before each wait */
+	void (*run)(int thread);
+
+	/* make a thread's service loop call http_client_service(), from any thread */
+	void (*wake)(int thread);
+
+	/* connect and send a request, the connection or NULL if no attempt is made */
+	void * (*send)(struct device_conn *d, struct wasp_if_msg *ui);
+
+	/* close the update stream connection, reported by http_client_closed(), possibly before close() returns */
+	void (*close)(struct device_conn *d, void *conn);
+
+	/* call http_client_timer() after delay_us, replacing a pending timer; 0 cancels */
+	void (*timer)(struct device_conn *d, enum http_client_timer timer, uint64_t delay_us);
+};
+
+extern const struct http_transport lws_transport;
+extern const struct http_transport epoll_transport;
+
+/**
+ * Start the HTTP client threads.  Device index i belongs to shard
+ * (i % shards).  Threads are numbered shard * threads + thread of the shard.
+ *
+ * /param transport_type - WASP_IF_TRANSPORT_*
+ * /param shards - independent transport contexts, 1 to WASP_IF_MAX_SHARDS
+ * /param threads - threads per shard
+ * /param pin_cpus - (1) : pin HTTP client thread i to CPU i
+ *
+ * /returns the number of threads per shard, or -1 on error.
+ */
+int http_client_start(int transport_type, int shards, int threads, int pin_cpus);
+
+/* HTTP client thread serving a device, the first thread for -1 */
+int http_client_thread_of(int dev_index);
+
+/* wake an HTTP client thread to read newly queued requests */
+void http_client_wake(int thread);
+
+/* device of a request or update stream message, NULL if none */
+struct device_conn * http_client_device(const struct wasp_if_msg *ui);
+
+/* read a thread's newly queued requests and send what each of its devices is ready for */
+void http_client_service(int thread);
+
+/**
+ * Add the request headers of a request (authorization, body type and
+ * length, accepted encodings, update stream options) by calling add for
+ * each.  Marks the start of the device stage.
+ *
+ * /returns nonzero if add failed.
+ */
+int http_client_headers(struct wasp_if_msg *ui,
+	int (*add)(void *ctx, const char *name, const char *value, size_t len), void *ctx);
+
+/**
+ * The response headers arrived.
+ *
+ * /param encoding - Content-Encoding, "" if none
+ *
+ * /returns nonzero to abort the request.
+ */
+int http_client_established(struct wasp_if_msg *ui, void *conn, int status, const char *encoding);
+
+/**
+ * Response body data, NUL terminated at p[len].
+ *
+ * /returns nonzero to abort the request.
+ */
+int http_client_data(struct wasp_if_msg *ui, const char *p, size_t len);
+
+/* request body bytes written */
+void http_client_sent(struct wasp_if_msg *ui, size_t len);
+
+/* the response is complete */
+void http_client_completed(struct wasp_if_msg *ui, void *conn, int status);
+
+/* the connection failed or was closed, before or after the response */
+void http_client_failed(struct wasp_if_msg *ui, void *conn);
+void http_client_closed(struct wasp_if_msg *ui, void *conn);
+
+/* a timer set with http_transport.timer() expired */
+void http_client_timer(struct device_conn *d, enum http_client_timer timer);
+
+#endif /* _HTTP_CLIENT_H */
@@ -0,0 +1,122 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "http_inflate.h"
+#include "wasp_interface.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef WASP_IF_WITH_ZLIB
+
+/* decoded data, one piece at a time, per HTTP client thread */
+static _Thread_local char out[WASP_IF_RESP_BUF_LEN];
+
+int http_inflate_start(struct http_inflate *hi, const char *content_encoding)
+{
+	memset(hi, 0, sizeof(*hi));
+
+	if (!strlen(content_encoding) || !strcasecmp(content_encoding, "identity")) {
+		return 0;
+	}
+
+	if (strcasecmp(content_encoding, "gzip") && strcasecmp(content_encoding, "x-gzip") &&
+	    strcasecmp(content_encoding, "deflate")) {
+		return -1;
+	}
+
+	/* 15 + 32: detect a gzip or zlib header */
+	if (inflateInit2(&hi->zs, 15 + 32) != Z_OK) {
+		return -1;
+	}
+	hi->active = 1;
+
+	return 1;
+}
+
+int http_inflate_data(struct http_inflate *hi, const char *in, size_t len,
+	http_inflate_cb_t cb, void *ud)
+{
+	size_t have = 0;
+	int ret = Z_OK;
+
+	if (!hi->active) {
+		return -1;
+	}
+
+	hi->zs.next_in = (Bytef *)in;
+	hi->zs.avail_in = len;
+
+	do {
+		hi->zs.next_out = (Bytef *)out;
+		hi->zs.avail_out = sizeof(out) - 1;
+
+		ret = inflate(&hi->zs, Z_NO_FLUSH);
+		if (ret == Z_DATA_ERROR && !hi->raw && !hi->zs.total_out) {
+			/* some servers send "deflate" without the zlib header */
+			inflateEnd(&hi->zs);
+			memset(&hi->zs, 0, sizeof(hi->zs));
+			if (inflateInit2(&hi->zs, -15) != Z_OK) {
+				hi->active = 0;
+				return -1;
+			}
+			hi->raw = 1;
+			hi->zs.next_in = (Bytef *)in;
+			hi->zs.avail_in = len;
+			continue;
+		}
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			printf("Unable to decode response, err: %d\n", ret);
+			return -1;
+		}
+
+		have = sizeof(out) - 1 - hi->zs.avail_out;
+		if (have) {
+			out[have] = '\0';
+			if (cb(out, have, ud)) {
+				return -1;
+			}
+		}
+	} while (ret != Z_STREAM_END && (hi->zs.avail_in || !hi->zs.avail_out));
+
+	return 0;
+}
+
+void http_inflate_end(struct http_inflate *hi)
+{
+	if (hi->active) {
+		inflateEnd(&hi->zs);
+		hi->active = 0;
+	}
+}
+
+#else
+
+int http_inflate_start(struct http_inflate *hi, const char *content_encoding)
+{
+	memset(hi, 0, sizeof(*hi));
+
+	/* no encoding is requested without zlib */
+	return strlen(content_encoding) && strcasecmp(content_encoding, "identity") ? -1 : 0;
+}
+
+int http_inflate_data(struct http_inflate *hi, const char *in, size_t len,
+	http_inflate_cb_t cb, void *ud)
+{
+	(void)hi;
+	(void)in;
+	(void)len;
+	(void)cb;
+	(void)ud;
+
+	return -1;
+}
+
+void http_inflate_end(struct http_inflate *hi)
+{
+	hi->active = 0;
+}
+
+#endif /* WASP_IF_WITH_ZLIB */
@@ -0,0 +1,54 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _HTTP_INFLATE_H
+#define _HTTP_INFLATE_H
+
+#include <stdlib.h>
+
+#ifdef WASP_IF_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+/* value of the Accept-Encoding request header, not sent without zlib */
+#ifdef WASP_IF_WITH_ZLIB
+#define HTTP_INFLATE_ACCEPT_ENCODING "gzip, deflate"
+#endif
+
+/* streaming decoder of a gzip or deflate encoded response body */
+struct http_inflate {
+	int active;            /* response body is being decoded */
+	int raw;               /* deflate without the zlib header */
+#ifdef WASP_IF_WITH_ZLIB
+	z_stream zs;
+#endif
+};
+
+/* called with each piece of decoded data, NUL terminated, return nonzero to stop */
+typedef int (*http_inflate_cb_t)(const char *buf, size_t len, void *ud);
+
+/**
+ * Start decoding a response with the given Content-Encoding.
+ *
+ * /param content_encoding - Content-Encoding header value, "" if none
+ *
+ * /returns 1 if the body is decoded, 0 if it is not encoded,
+ * -1 if the encoding is not supported.
+ */
+int http_inflate_start(struct http_inflate *hi, const char *content_encoding);
+
+/**
+ * Decode a fragment of the response body, passing the decoded data to cb.
+ * The decoded data is in a buffer of the calling thread, valid until cb
+ * returns, so HTTP client threads decode at once.
+ *
+ * /returns nonzero on corrupt data or if cb stopped.
+ */
+int http_inflate_data(struct http_inflate *hi, const char *in, size_t len,
+	http_inflate_cb_t cb, void *ud);
+
+void http_inflate_end(struct http_inflate *hi);
+
+#endif /* _HTTP_INFLATE_H */
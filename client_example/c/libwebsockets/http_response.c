@@ -0,0 +1,241 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#define _GNU_SOURCE /* memmem() */
+
+#include "http_response.h"
+#include <string.h>
+#include <strings.h>
+
+/* longest chunk size or trailer line waited for */
+#define HTTP_RESPONSE_MAX_LINE 1024
+
+void http_response_init(struct http_response *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->state = HTTP_RESPONSE_HEADERS;
+	r->content_length = -1;
+}
+
+/* case insensitive search for a token in a header value */
+static int value_has(const char *v, size_t len, const char *token)
+{
+	size_t n = strlen(token);
+	size_t i = 0;
+
+	for (i = 0; i + n <= len; i++) {
+		if (!strncasecmp(&v[i], token, n)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* one "Name: value" header line, not CRLF terminated */
+static void parse_header(struct http_response *r, const char *line, size_t len)
+{
+	const char *colon = memchr(line, ':', len);
+	const char *v = NULL;
+	size_t name_len = 0;
+	size_t v_len = 0;
+	char num[24];
+
+	if (!colon) {
+		return;
+	}
+	name_len = colon - line;
+	v = colon + 1;
+	v_len = len - name_len - 1;
+	while (v_len && (*v == ' ' || *v == '\t')) {
+		v++;
+		v_len--;
+	}
+	while (v_len && (v[v_len - 1] == ' ' || v[v_len - 1] == '\t')) {
+		v_len--;
+	}
+
+	if (name_len == 14 && !strncasecmp(line, "Content-Length", 14)) {
+		if (v_len && v_len < sizeof(num)) {
+			memcpy(num, v, v_len);
+			num[v_len] = '\0';
+			r->content_length = strtoll(num, NULL, 10);
+		}
+	} else if (name_len == 17 && !strncasecmp(line, "Transfer-Encoding", 17)) {
+		r->chunked = value_has(v, v_len, "chunked");
+	} else if (name_len == 10 && !strncasecmp(line, "Connection", 10)) {
+		if (value_has(v, v_len, "close")) {
+			r->close = 1;
+		} else if (value_has(v, v_len, "keep-alive")) {
+			r->close = 0;
+		}
+	} else if (name_len == 16 && !strncasecmp(line, "Content-Encoding", 16)) {
+		if (v_len >= sizeof(r->encoding)) {
+			v_len = sizeof(r->encoding) - 1;
+		}
+		memcpy(r->encoding, v, v_len);
+		r->encoding[v_len] = '\0';
+	}
+}
+
+static int parse_headers(struct http_response *r, const char *buf, size_t len)
+{
+	const char *end = memmem(buf, len, "\r\n\r\n", 4);
+	const char *line = NULL;
+	const char *eol = NULL;
+
+	if (!end) {
+		return 0;
+	}
+
+	/* "HTTP/1.x SSS reason" */
+	if (end - buf < 12 || memcmp(buf, "HTTP/1.", 7) || buf[8] != ' ' ||
+	    buf[9] < '1' || buf[9] > '5' || buf[10] < '0' || buf[10] > '9' || buf[11] < '0' || buf[11] > '9') {
+		return -1;
+	}
+	http_response_init(r);
+	r->status = (buf[9] - '0') * 100 + (buf[10] - '0') * 10 + (buf[11] - '0');
+
+	/* HTTP/1.0 closes the connection unless asked to keep it */
+	r->close = buf[7] == '0';
+
+	line = (const char *)memchr(buf, '\n', end - buf + 2) + 1;
+	while (line < end + 2) {
+		eol = memchr(line, '\r', end + 2 - line);
+		parse_header(r, line, eol - line);
+		line = eol + 2;
+	}
+
+	/* interim response, the real one follows */
+	if (r->status < 200) {
+		r->status = 0;
+		return end + 4 - buf;
+	}
+
+	if (r->status == 204 || r->status == 304 || (!r->chunked && r->content_length == 0)) {
+		r->state = HTTP_RESPONSE_DONE;
+	} else if (r->chunked) {
+		r->state = HTTP_RESPONSE_CHUNK_SIZE;
+	} else if (r->content_length > 0) {
+		r->state = HTTP_RESPONSE_BODY;
+		r->remaining = r->content_length;
+	} else {
+		/* the body ends when the connection closes */
+		r->state = HTTP_RESPONSE_BODY;
+		r->remaining = -1;
+		r->close = 1;
+	}
+
+	return end + 4 - buf;
+}
+
+/* a CRLF terminated line, its length without the CRLF, or -1 if incomplete, -2 if too long */
+static int find_line(const char *buf, size_t len)
+{
+	const char *eol = memmem(buf, len, "\r\n", 2);
+
+	if (!eol) {
+		return len > HTTP_RESPONSE_MAX_LINE ? -2 : -1;
+	}
+
+	return eol - buf;
+}
+
+static int parse_chunk_size(struct http_response *r, const char *buf, int line_len)
+{
+	long long size = 0;
+	int i = 0;
+	int c = 0;
+
+	for (i = 0; i < line_len && i < 15; i++) {
+		c = buf[i];
+		if (c >= '0' && c <= '9') {
+			size = size * 16 + c - '0';
+		} else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+			size = size * 16 + (c | 0x20) - 'a' + 10;
+		} else {
+			break;
+		}
+	}
+
+	/* chunk extensions after ';' are ignored */
+	if (!i || (i < line_len && buf[i] != ';' && buf[i] != ' ' && buf[i] != '\t')) {
+		return -1;
+	}
+
+	if (size) {
+		r->state = HTTP_RESPONSE_CHUNK_DATA;
+		r->remaining = size;
+	} else {
+		r->state = HTTP_RESPONSE_TRAILERS;
+	}
+
+	return line_len + 2;
+}
+
+int http_response_parse(struct http_response *r, const char *buf, size_t len,
+	const char **body, size_t *body_len)
+{
+	size_t n = 0;
+	int line_len = 0;
+
+	*body = NULL;
+	*body_len = 0;
+
+	switch (r->state) {
+	case HTTP_RESPONSE_HEADERS:
+		return parse_headers(r, buf, len);
+	case HTTP_RESPONSE_BODY:
+	case HTTP_RESPONSE_CHUNK_DATA:
+		n = len;
+		if (r->remaining >= 0 && (long long)n > r->remaining) {
+			n = r->remaining;
+		}
+		*body = buf;
+		*body_len = n;
+		if (r->remaining >= 0) {
+			r->remaining -= n;
+			if (!r->remaining) {
+				r->state = r->state == HTTP_RESPONSE_BODY ? HTTP_RESPONSE_DONE : HTTP_RESPONSE_CHUNK_CRLF;
+			}
+		}
+		return n;
+	case HTTP_RESPONSE_CHUNK_CRLF:
+		if (len < 2) {
+			return 0;
+		}
+		if (buf[0] != '\r' || buf[1] != '\n') {
+			return -1;
+		}
+		r->state = HTTP_RESPONSE_CHUNK_SIZE;
+		return 2;
+	case HTTP_RESPONSE_CHUNK_SIZE:
+		line_len = find_line(buf, len);
+		if (line_len < 0) {
+			return line_len == -1 ? 0 : -1;
+		}
+		return parse_chunk_size(r, buf, line_len);
+	case HTTP_RESPONSE_TRAILERS:
+		line_len = find_line(buf, len);
+		if (line_len < 0) {
+			return line_len == -1 ? 0 : -1;
+		}
+		if (!line_len) {
+			r->state = HTTP_RESPONSE_DONE;
+		}
+		return line_len + 2;
+	default:
+		return 0;
+	}
+}
+
+int http_response_eof(struct http_response *r)
+{
+	if (r->state == HTTP_RESPONSE_BODY && r->remaining < 0) {
+		r->state = HTTP_RESPONSE_DONE;
+	}
+
+	return r->state != HTTP_RESPONSE_DONE;
+}
@@ -0,0 +1,64 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _HTTP_RESPONSE_H
+#define _HTTP_RESPONSE_H
+
+#include <stdlib.h>
+
+/*
+ * Incremental HTTP/1.1 response parser.  It does not copy the body: each
+ * call returns where the next body piece is within the caller's buffer.
+ * Headers are parsed once the whole header block is in the buffer.
+ */
+
+enum http_response_state {
+	HTTP_RESPONSE_HEADERS,
+	HTTP_RESPONSE_BODY,                /* Content-Length body, or until the connection closes */
+	HTTP_RESPONSE_CHUNK_SIZE,
+	HTTP_RESPONSE_CHUNK_DATA,
+	HTTP_RESPONSE_CHUNK_CRLF,
+	HTTP_RESPONSE_TRAILERS,
+	HTTP_RESPONSE_DONE
+};
+
+struct http_response {
+	enum http_response_state state;
+	int status;
+	long long content_length;          /* -1 if not sent */
+	int chunked;                       /* Transfer-Encoding: chunked */
+	int close;                         /* the connection cannot be reused after the response */
+	char encoding[32];                 /* Content-Encoding, "" if none */
+	long long remaining;               /* of the body or the current chunk */
+};
+
+/* prepare for the next response on a connection */
+void http_response_init(struct http_response *r);
+
+/**
+ * Parse the next part of a response: the header block, a chunk size line,
+ * or a body piece.
+ *
+ * /param r - parser state
+ * /param buf - received data not yet consumed
+ * /param len - length of buf
+ * /param body - set to the body piece in buf, if any
+ * /param body_len - set to the length of the body piece, 0 if none
+ *
+ * /returns bytes of buf consumed, 0 if more data is needed (or the
+ *          response is done), or -1 if the response is malformed.
+ */
+int http_response_parse(struct http_response *r, const char *buf, size_t len,
+	const char **body, size_t *body_len);
+
+/**
+ * The connection closed.  Completes a response delimited by the end of the
+ * connection.
+ *
+ * /returns nonzero if the response was not complete.
+ */
+int http_response_eof(struct http_response *r);
+
+#endif /* _HTTP_RESPONSE_H */
@@ -5,6 +5,8 @@
 
 #include "json.h"
 #include "mjson.h"
+#include <string.h>
+#include <math.h>
 
 int json_find(const char *s, int len, const char *path,
                           const char **tokptr, int *toklen)
@@ -34,3 +36,700 @@ int json_next(const char *s, int n, int off, int *koff, int *klen, int *voff,
 	return mjson_next(s, n, off, koff, klen, voff, vlen, vtype);
 }
 
+struct foreach_data {
+	json_foreach_cb_t cb;
+	void *ud;
+	int depth;
+	int koff;
+	int klen;
+	int voff;
+	int count;
+};
+
+static int foreach_cb(int tok, const char *s, int off, int len, void *ud)
+{
+	struct foreach_data *d = (struct foreach_data *)ud;
+
+	switch (tok) {
+	case '{':
+	case '[':
+		if (d->depth == 1) {
+			d->voff = off;
+		}
+		d->depth++;
+		break;
+	case '}':
+	case ']':
+		d->depth--;
+		if (d->depth == 1) {
+			d->count++;
+			if (d->cb(s, d->koff, d->klen, d->voff, off + len - d->voff, d->ud)) {
+				return 1;
+			}
+			d->klen = 0;
+		}
+		break;
+	case MJSON_TOK_KEY:
+		if (d->depth == 1) {
+			d->koff = off;
+			d->klen = len;
+		}
+		break;
+	default:
+		if (d->depth == 1 && MJSON_TOK_IS_VALUE(tok)) {
+			d->count++;
+			if (d->cb(s, d->koff, d->klen, off, len, d->ud)) {
+				return 1;
+			}
+			d->klen = 0;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+int json_foreach(const char *s, int len, json_foreach_cb_t cb, void *ud)
+{
+	struct foreach_data d = { cb, ud, 0, 0, 0, 0, 0 };
+
+	if (mjson(s, len, foreach_cb, &d) < 0) {
+		return -1;
+	}
+
+	return d.count;
+}
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+uint32_t json_hash(const char *s, int len)
+{
+	uint32_t h = FNV_OFFSET;
+	int i = 0;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)s[i]) * FNV_PRIME;
+	}
+
+	return h;
+}
+
+int json_path_compile(struct json_path *p, const char *path, int len)
+{
+	struct json_path_seg *seg = NULL;
+	int used = 0;
+	int start = 0;
+	int i = 0;
+
+	memset(p, 0, sizeof(*p));
+
+	/* a relative path starts with a key, without the '.' */
+	if (len && path[0] == '$') {
+		i = 1;
+	}
+
+	while (i < len) {
+		if (p->num_segs == JSON_PATH_MAX_SEGS) {
+			return -1;
+		}
+		seg = &p->segs[p->num_segs];
+
+		if (path[i] == '[') {
+			/* array index */
+			seg->off = -1;
+			for (start = ++i; i < len && path[i] >= '0' && path[i] <= '9' && i - start < 8; i++) {
+				seg->len = seg->len * 10 + path[i] - '0';
+			}
+			if (i == start || i == len || path[i] != ']') {
+				return -1;
+			}
+			i++;
+		} else {
+			if (path[i] == '.') {
+				i++;
+			} else if (p->num_segs || path[0] == '$') {
+				return -1;
+			}
+
+			/* key, up to the next '.' or '[' */
+			for (start = i; i < len && path[i] != '.' && path[i] != '['; i++) {
+			}
+			if (i == start || used + i - start > JSON_PATH_MAX_LEN) {
+				return -1;
+			}
+			seg->off = used;
+			seg->len = i - start;
+			seg->hash = json_hash(&path[start], seg->len);
+			memcpy(&p->keys[used], &path[start], seg->len);
+			used += seg->len;
+		}
+		p->num_segs++;
+	}
+
+	return 0;
+}
+
+static int skip_ws(const char *s, int len, int i)
+{
+	while (i < len && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) {
+		i++;
+	}
+
+	return i;
+}
+
+/* end of the string starting at s[i] (after the closing quote), -1 if unterminated */
+static int skip_string(const char *s, int len, int i)
+{
+	for (i++; i < len; i++) {
+		if (s[i] == '\\') {
+			i++;
+		} else if (s[i] == '"') {
+			return i + 1;
+		}
+	}
+
+	return -1;
+}
+
+/* as skip_string(), also hashing the text between the quotes */
+static int hash_string(const char *s, int len, int i, uint32_t *hash)
+{
+	uint32_t h = FNV_OFFSET;
+
+	for (i++; i < len && s[i] != '"'; i++) {
+		if (s[i] == '\\' && i + 1 < len) {
+			h = (h ^ (unsigned char)s[i++]) * FNV_PRIME;
+		}
+		h = (h ^ (unsigned char)s[i]) * FNV_PRIME;
+	}
+	*hash = h;
+
+	return i < len ? i + 1 : -1;
+}
+
+/* end of the value starting at s[i], -1 if invalid */
+static int skip_value(const char *s, int len, int i)
+{
+	int depth = 0;
+
+	if (i >= len) {
+		return -1;
+	}
+
+	switch (s[i]) {
+	case '"':
+		return skip_string(s, len, i);
+	case '{':
+	case '[':
+		for (; i < len; i++) {
+			if (s[i] == '"') {
+				i = skip_string(s, len, i);
+				if (i < 0) {
+					return -1;
+				}
+				i--;
+			} else if (s[i] == '{' || s[i] == '[') {
+				depth++;
+			} else if ((s[i] == '}' || s[i] == ']') && !--depth) {
+				return i + 1;
+			}
+		}
+		return -1;
+	default:
+		/* number, true, false or null */
+		for (; i < len; i++) {
+			if (s[i] == ',' || s[i] == '}' || s[i] == ']' ||
+			    s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n') {
+				break;
+			}
+		}
+		return i;
+	}
+}
+
+/* type of the value from s[i] to s[end] */
+static int token_type(const char *s, int i, int end)
+{
+	switch (s[i]) {
+	case '{':
+		return MJSON_TOK_OBJECT;
+	case '[':
+		return MJSON_TOK_ARRAY;
+	case '"':
+		return MJSON_TOK_STRING;
+	case 't':
+		return end - i == 4 && !memcmp(&s[i], "true", 4) ? MJSON_TOK_TRUE : MJSON_TOK_INVALID;
+	case 'f':
+		return end - i == 5 && !memcmp(&s[i], "false", 5) ? MJSON_TOK_FALSE : MJSON_TOK_INVALID;
+	case 'n':
+		return end - i == 4 && !memcmp(&s[i], "null", 4) ? MJSON_TOK_NULL : MJSON_TOK_INVALID;
+	default:
+		return s[i] == '-' || (s[i] >= '0' && s[i] <= '9') ? MJSON_TOK_NUMBER : MJSON_TOK_INVALID;
+	}
+}
+
+/* position of the value of a key in the object at s[i], -1 if not found */
+static int find_key(const struct json_path *p, const struct json_path_seg *seg,
+	const char *s, int len, int i)
+{
+	uint32_t hash = 0;
+	int kend = 0;
+
+	if (i >= len || s[i] != '{') {
+		return -1;
+	}
+
+	for (i = skip_ws(s, len, i + 1); i < len && s[i] == '"'; i = skip_ws(s, len, i + 1)) {
+		kend = hash_string(s, len, i, &hash);
+		if (kend < 0) {
+			return -1;
+		}
+		/* kend - i - 2 is the key length without the quotes */
+		if (hash == seg->hash && kend - i - 2 == seg->len &&
+		    !memcmp(&s[i + 1], &p->keys[seg->off], seg->len)) {
+			i = skip_ws(s, len, kend);
+			return i < len && s[i] == ':' ? skip_ws(s, len, i + 1) : -1;
+		}
+
+		i = skip_ws(s, len, kend);
+		if (i >= len || s[i] != ':') {
+			return -1;
+		}
+		i = skip_value(s, len, skip_ws(s, len, i + 1));
+		if (i < 0) {
+			return -1;
+		}
+		i = skip_ws(s, len, i);
+		if (i >= len || s[i] != ',') {
+			return -1;
+		}
+	}
+
+	return -1;
+}
+
+/* position of an element of the array at s[i], -1 if not found */
+static int find_index(int n, const char *s, int len, int i)
+{
+	if (i >= len || s[i] != '[') {
+		return -1;
+	}
+
+	i = skip_ws(s, len, i + 1);
+	if (i >= len || s[i] == ']') {
+		return -1;
+	}
+	while (n--) {
+		i = skip_value(s, len, i);
+		if (i < 0) {
+			return -1;
+		}
+		i = skip_ws(s, len, i);
+		if (i >= len || s[i] != ',') {
+			return -1;
+		}
+		i = skip_ws(s, len, i + 1);
+	}
+
+	return i < len ? i : -1;
+}
+
+int json_path_find(const struct json_path *p, const char *s, int len,
+                          const char **tokptr, int *toklen)
+{
+	int i = skip_ws(s, len, 0);
+	int end = 0;
+	int n = 0;
+
+	for (n = 0; n < p->num_segs && i >= 0; n++) {
+		if (p->segs[n].off < 0) {
+			i = find_index(p->segs[n].len, s, len, i);
+		} else {
+			i = find_key(p, &p->segs[n], s, len, i);
+		}
+	}
+
+	if (i < 0 || i >= len) {
+		return MJSON_TOK_INVALID;
+	}
+	end = skip_value(s, len, i);
+	if (end <= i) {
+		return MJSON_TOK_INVALID;
+	}
+	if (tokptr) {
+		*tokptr = &s[i];
+	}
+	if (toklen) {
+		*toklen = end - i;
+	}
+
+	return token_type(s, i, end);
+}
+
+int json_path_get_number(const struct json_path *p, const char *s, int len, double *v)
+{
+	const char *tok = NULL;
+	int toklen = 0;
+
+	if (json_path_find(p, s, len, &tok, &toklen) != MJSON_TOK_NUMBER) {
+		return 0;
+	}
+	if (v) {
+		*v = strtod(tok, NULL);
+	}
+
+	return 1;
+}
+
+int json_path_get_bool(const struct json_path *p, const char *s, int len, int *v)
+{
+	int tok = json_path_find(p, s, len, NULL, NULL);
+
+	if (tok == MJSON_TOK_TRUE && v) {
+		*v = 1;
+	}
+	if (tok == MJSON_TOK_FALSE && v) {
+		*v = 0;
+	}
+
+	return tok == MJSON_TOK_TRUE || tok == MJSON_TOK_FALSE ? 1 : 0;
+}
+
+int json_path_get_string(const struct json_path *p, const char *s, int len, char *to, int sz)
+{
+	const char *tok = NULL;
+	int toklen = 0;
+
+	if (json_path_find(p, s, len, &tok, &toklen) != MJSON_TOK_STRING) {
+		return -1;
+	}
+
+	return mjson_unescape(tok + 1, toklen - 2, to, sz);
+}
+
+void json_field_init(struct json_field *f, const char *key)
+{
+	json_field_init_len(f, key, strlen(key));
+}
+
+void json_field_init_len(struct json_field *f, const char *key, int len)
+{
+	memset(f, 0, sizeof(*f));
+	f->key = key;
+	f->key_len = len;
+	f->hash = json_hash(key, len);
+}
+
+int json_extract(const char *s, int len, struct json_field *fields, int num_fields)
+{
+	struct json_field *f = NULL;
+	uint32_t hash = 0;
+	int found = 0;
+	int key = 0;
+	int kend = 0;
+	int end = 0;
+	int i = skip_ws(s, len, 0);
+	int n = 0;
+
+	for (n = 0; n < num_fields; n++) {
+		fields[n].type = MJSON_TOK_INVALID;
+	}
+
+	if (i >= len || s[i] != '{') {
+		return -1;
+	}
+
+	for (i = skip_ws(s, len, i + 1); i < len && s[i] == '"'; i = skip_ws(s, len, i + 1)) {
+		key = i + 1;
+		kend = hash_string(s, len, i, &hash);
+		if (kend < 0) {
+			return -1;
+		}
+		i = skip_ws(s, len, kend);
+		if (i >= len || s[i] != ':') {
+			return -1;
+		}
+		i = skip_ws(s, len, i + 1);
+		end = skip_value(s, len, i);
+		if (end <= i) {
+			return -1;
+		}
+
+		/* the first of duplicate keys is kept, as json_find() does */
+		for (n = 0; n < num_fields; n++) {
+			f = &fields[n];
+			if (f->hash == hash && f->key_len == kend - 1 - key && !f->type &&
+			    !memcmp(&s[key], f->key, f->key_len)) {
+				f->type = token_type(s, i, end);
+				f->tok = &s[i];
+				f->toklen = end - i;
+				found++;
+				break;
+			}
+		}
+		if (found == num_fields) {
+			break;
+		}
+
+		i = skip_ws(s, len, end);
+		if (i >= len || s[i] != ',') {
+			break;
+		}
+	}
+
+	return found;
+}
+
+int json_field_get_number(const struct json_field *f, double *v)
+{
+	if (f->type != MJSON_TOK_NUMBER) {
+		return 0;
+	}
+	if (v) {
+		*v = strtod(f->tok, NULL);
+	}
+
+	return 1;
+}
+
+int json_field_get_string(const struct json_field *f, char *to, int sz)
+{
+	if (f->type != MJSON_TOK_STRING) {
+		return -1;
+	}
+
+	return mjson_unescape(f->tok + 1, f->toklen - 2, to, sz);
+}
+
+int json_field_equals(const struct json_field *f, const char *str, int len)
+{
+	int i = 0;
+	int j = 0;
+	int c = 0;
+
+	if (f->type != MJSON_TOK_STRING) {
+		return 0;
+	}
+
+	for (i = 1, j = 0; i < f->toklen - 1; i++, j++) {
+		c = f->tok[i];
+		if (c == '\\') {
+			c = mjson_esc(f->tok[++i], 0);
+			if (!c) {
+				return 0;
+			}
+		}
+		if (j >= len || str[j] != c) {
+			return 0;
+		}
+	}
+
+	return j == len;
+}
+
+static int builder_print(const char *ptr, int len, void *ud)
+{
+	struct json_builder *b = (struct json_builder *)ud;
+
+	if (b->error || b->len + len >= b->size) {
+		b->error = 1;
+		return 0;
+	}
+	memcpy(&b->buf[b->len], ptr, len);
+	b->len += len;
+	b->buf[b->len] = '\0';
+
+	return len;
+}
+
+void json_builder_init(struct json_builder *b, char *buf, int size)
+{
+	memset(b, 0, sizeof(*b));
+	b->buf = buf;
+	b->size = size;
+	if (size > 0) {
+		buf[0] = '\0';
+	} else {
+		b->error = 1;
+	}
+}
+
+/* the ',' before an element, or an error if a value is not allowed here */
+static void builder_value(struct json_builder *b)
+{
+	uint32_t bit = 1u << b->depth;
+
+	if (b->has_key) {
+		b->has_key = 0;
+		return;
+	}
+
+	/* one top level value, and object values after a key */
+	if ((!b->depth && b->len) || (b->depth && !(b->arrays & bit))) {
+		b->error = 1;
+		return;
+	}
+	if (b->nonempty & bit) {
+		mjson_print_buf(builder_print, b, ",", 1);
+	}
+	b->nonempty |= bit;
+}
+
+static void builder_open(struct json_builder *b, int array)
+{
+	uint32_t bit = 0;
+
+	builder_value(b);
+	if (b->depth == JSON_BUILDER_MAX_DEPTH) {
+		b->error = 1;
+		return;
+	}
+	mjson_print_buf(builder_print, b, array ? "[" : "{", 1);
+	bit = 1u << ++b->depth;
+	b->nonempty &= ~bit;
+	if (array) {
+		b->arrays |= bit;
+	} else {
+		b->arrays &= ~bit;
+	}
+}
+
+void json_builder_object(struct json_builder *b)
+{
+	builder_open(b, 0);
+}
+
+void json_builder_array(struct json_builder *b)
+{
+	builder_open(b, 1);
+}
+
+void json_builder_close(struct json_builder *b)
+{
+	if (!b->depth || b->has_key) {
+		b->error = 1;
+		return;
+	}
+	mjson_print_buf(builder_print, b, b->arrays & (1u << b->depth) ? "]" : "}", 1);
+	b->depth--;
+}
+
+/* a string, escaped: mjson's escapes, other control characters as \u00XX */
+static void builder_string(struct json_builder *b, const char *s, int len)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6] = { '\\', 'u', '0', '0', '0', '0' };
+	int start = 0;
+	int i = 0;
+	int c = 0;
+
+	mjson_print_buf(builder_print, b, "\"", 1);
+	for (i = 0; i < len; i++) {
+		c = (unsigned char)s[i];
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		mjson_print_buf(builder_print, b, &s[start], i - start);
+		start = i + 1;
+		esc[1] = mjson_esc(c, 1);
+		if (c && esc[1]) {
+			mjson_print_buf(builder_print, b, esc, 2);
+		} else {
+			esc[1] = 'u';
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 15];
+			mjson_print_buf(builder_print, b, esc, 6);
+		}
+	}
+	mjson_print_buf(builder_print, b, &s[start], len - start);
+	mjson_print_buf(builder_print, b, "\"", 1);
+}
+
+/* a key, escaped here or already a JSON string */
+static void builder_key(struct json_builder *b, const char *key, int len, int json)
+{
+	uint32_t bit = 1u << b->depth;
+
+	if (!b->depth || (b->arrays & bit) || b->has_key) {
+		b->error = 1;
+		return;
+	}
+	if (b->nonempty & bit) {
+		mjson_print_buf(builder_print, b, ",", 1);
+	}
+	b->nonempty |= bit;
+	if (json) {
+		mjson_print_buf(builder_print, b, key, len);
+	} else {
+		builder_string(b, key, len);
+	}
+	mjson_print_buf(builder_print, b, ":", 1);
+	b->has_key = 1;
+}
+
+void json_builder_key(struct json_builder *b, const char *key, int len)
+{
+	builder_key(b, key, len, 0);
+}
+
+void json_builder_key_json(struct json_builder *b, const char *key, int len)
+{
+	builder_key(b, key, len, 1);
+}
+
+void json_builder_int(struct json_builder *b, int v)
+{
+	char num[12];
+	unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+	int i = sizeof(num);
+
+	builder_value(b);
+	do {
+		num[--i] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	if (v < 0) {
+		num[--i] = '-';
+	}
+	mjson_print_buf(builder_print, b, &num[i], sizeof(num) - i);
+}
+
+void json_builder_double(struct json_builder *b, double v)
+{
+	builder_value(b);
+	if (!isfinite(v)) {
+		/* no NaN or infinity in JSON */
+		b->error = 1;
+		return;
+	}
+	mjson_print_dbl(builder_print, b, v, "%.17g");
+}
+
+void json_builder_bool(struct json_builder *b, int v)
+{
+	builder_value(b);
+	mjson_print_buf(builder_print, b, v ? "true" : "false", v ? 4 : 5);
+}
+
+void json_builder_null(struct json_builder *b)
+{
+	builder_value(b);
+	mjson_print_buf(builder_print, b, "null", 4);
+}
+
+void json_builder_string(struct json_builder *b, const char *s, int len)
+{
+	builder_value(b);
+	builder_string(b, s, len);
+}
+
+int json_builder_finish(const struct json_builder *b)
+{
+	if (b->error || b->depth || b->has_key || !b->len) {
+		return -1;
+	}
+
+	return b->len;
+}
@@ -7,6 +7,19 @@
 #define _JSON_H
 
 #include <stdlib.h>
+#include <stdint.h>
+
+/* token types returned by json_find() etc., the same as mjson's */
+enum json_tok {
+	JSON_TOK_INVALID = 0,
+	JSON_TOK_STRING = 11,
+	JSON_TOK_NUMBER = 12,
+	JSON_TOK_TRUE = 13,
+	JSON_TOK_FALSE = 14,
+	JSON_TOK_NULL = 15,
+	JSON_TOK_ARRAY = '[',
+	JSON_TOK_OBJECT = '{'
+};
 
 int json_find(const char *s, int len, const char *path,
                           const char **tokptr, int *toklen);
@@ -21,4 +34,139 @@ int json_get_string(const char *s, int len, const char *path, char *to, int sz);
 int json_next(const char *s, int n, int off, int *koff, int *klen, int *voff,
                int *vlen, int *vtype);
 
+/*
+ * Called for each element of the top level object or array, return nonzero
+ * to stop.  For array elements klen is 0.
+ */
+typedef int (*json_foreach_cb_t)(const char *s, int koff, int klen, int voff,
+               int vlen, void *ud);
+
+/*
+ * Visit each element of the top level object or array in one pass,
+ * rather than restarting the scan from the beginning as json_next() does.
+ * Returns the number of elements visited, -1 on invalid input.
+ */
+int json_foreach(const char *s, int len, json_foreach_cb_t cb, void *ud);
+
+#define JSON_PATH_MAX_SEGS 8
+#define JSON_PATH_MAX_LEN 128
+
+/* one key, or array index, of a compiled path */
+struct json_path_seg {
+	int off;               /* of the key in json_path.keys, -1 for an array index */
+	int len;               /* key length, or the array index */
+	uint32_t hash;         /* of the key, see json_hash() */
+};
+
+/*
+ * A path compiled once with json_path_compile() and evaluated any number
+ * of times, without formatting or re-parsing the path text.  Keys of the
+ * document are hashed as they are scanned and only compared with a path
+ * segment of the same length and hash.
+ */
+struct json_path {
+	int num_segs;
+	struct json_path_seg segs[JSON_PATH_MAX_SEGS];
+	char keys[JSON_PATH_MAX_LEN];
+};
+
+/* FNV-1a hash of a key */
+uint32_t json_hash(const char *s, int len);
+
+/*
+ * Compile a path such as "$.level" or "$.body.levels[2]".  A path not
+ * starting with '$' is relative to the top level, so "level" is the same
+ * as "$.level".  Returns nonzero if the path is malformed or too long.
+ */
+int json_path_compile(struct json_path *p, const char *path, int len);
+
+/* as json_find(), returns the token type, 0 if not found */
+int json_path_find(const struct json_path *p, const char *s, int len,
+                          const char **tokptr, int *toklen);
+
+int json_path_get_number(const struct json_path *p, const char *s, int len, double *v);
+
+int json_path_get_bool(const struct json_path *p, const char *s, int len, int *v);
+
+int json_path_get_string(const struct json_path *p, const char *s, int len, char *to, int sz);
+
+/* one field of an object to read with json_extract() */
+struct json_field {
+	const char *key;       /* set by json_field_init() */
+	int key_len;
+	uint32_t hash;
+	int type;              /* set by json_extract(): the token type, 0 if not found */
+	const char *tok;
+	int toklen;
+};
+
+void json_field_init(struct json_field *f, const char *key);
+
+/* as json_field_init(), of a key of len bytes, not NUL terminated */
+void json_field_init_len(struct json_field *f, const char *key, int len);
+
+/*
+ * Find a set of top level fields of an object in one pass, stopping once
+ * all are found, rather than scanning the object once per field.  Returns
+ * the number of fields found, -1 on invalid input.
+ */
+int json_extract(const char *s, int len, struct json_field *fields, int num_fields);
+
+/* as json_get_number() etc. of a field found by json_extract() */
+int json_field_get_number(const struct json_field *f, double *v);
+
+int json_field_get_string(const struct json_field *f, char *to, int sz);
+
+/* nonzero if a field is a string equal to str once unescaped */
+int json_field_equals(const struct json_field *f, const char *str, int len);
+
+#define JSON_BUILDER_MAX_DEPTH 31
+
+/*
+ * A JSON text written into a caller owned buffer, e.g. a PATCH body, with
+ * mjson's printers.  Strings are escaped and commas placed by the builder.
+ * Nothing is allocated and no format string is parsed, and the buffer can
+ * be reused for any number of texts.  A text that does not fit, or is not
+ * well formed, makes json_builder_finish() fail.
+ */
+struct json_builder {
+	char *buf;
+	int size;
+	int len;
+	int depth;
+	int error;             /* overflow, or a value or key out of place */
+	int has_key;           /* a key was written, its value is next */
+	uint32_t arrays;       /* bit n set if the container at depth n is an array */
+	uint32_t nonempty;     /* bit n set once the container at depth n has an element */
+};
+
+void json_builder_init(struct json_builder *b, char *buf, int size);
+
+/* open an object or array, as a value */
+void json_builder_object(struct json_builder *b);
+
+void json_builder_array(struct json_builder *b);
+
+/* close the innermost object or array */
+void json_builder_close(struct json_builder *b);
+
+/* the key of the next value of an object */
+void json_builder_key(struct json_builder *b, const char *key, int len);
+
+/* as json_builder_key(), of a key already quoted and escaped, e.g. "\"level\"" */
+void json_builder_key_json(struct json_builder *b, const char *key, int len);
+
+void json_builder_int(struct json_builder *b, int v);
+
+void json_builder_double(struct json_builder *b, double v);
+
+void json_builder_bool(struct json_builder *b, int v);
+
+void json_builder_null(struct json_builder *b);
+
+void json_builder_string(struct json_builder *b, const char *s, int len);
+
+/* the length of the NUL terminated text, -1 if it did not fit or is incomplete */
+int json_builder_finish(const struct json_builder *b);
+
 #endif /*_JSON_H */
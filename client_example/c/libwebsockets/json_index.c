@@ -0,0 +1,422 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "json_index.h"
+#include "json.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(JSON_INDEX_NO_SIMD)
+#define JSON_INDEX_X86
+#include <immintrin.h>
+#endif
+
+/* character classes of one 64 byte block, bit n for byte n */
+struct block_masks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t op;           /* { } [ ] : , */
+};
+
+/* '[' and '{', ']' and '}' differ only in bit 5 */
+static void classify_scalar(const char *p, struct block_masks *m)
+{
+	int i = 0;
+	int c = 0;
+
+	m->quote = 0;
+	m->backslash = 0;
+	m->op = 0;
+	for (i = 0; i < 64; i++) {
+		c = (unsigned char)p[i];
+		if (c == '"') {
+			m->quote |= 1ULL << i;
+		} else if (c == '\\') {
+			m->backslash |= 1ULL << i;
+		} else if ((c | 0x20) == '{' || (c | 0x20) == '}' || c == ':' || c == ',') {
+			m->op |= 1ULL << i;
+		}
+	}
+}
+
+#ifdef JSON_INDEX_X86
+
+__attribute__((target("sse2")))
+static void classify_sse2(const char *p, struct block_masks *m)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i open = _mm_set1_epi8('{');
+	const __m128i close = _mm_set1_epi8('}');
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i bit5 = _mm_set1_epi8(0x20);
+	__m128i v;
+	__m128i lower;
+	uint64_t q = 0;
+	uint64_t b = 0;
+	uint64_t o = 0;
+	int i = 0;
+
+	for (i = 0; i < 4; i++) {
+		v = _mm_loadu_si128((const __m128i *)&p[i * 16]);
+		lower = _mm_or_si128(v, bit5);
+		q |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << (i * 16);
+		b |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << (i * 16);
+		o |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(lower, open), _mm_cmpeq_epi8(lower, close)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)))) << (i * 16);
+	}
+	m->quote = q;
+	m->backslash = b;
+	m->op = o;
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char *p, struct block_masks *m)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i open = _mm256_set1_epi8('{');
+	const __m256i close = _mm256_set1_epi8('}');
+	const __m256i colon = _mm256_set1_epi8(':');
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i bit5 = _mm256_set1_epi8(0x20);
+	__m256i v;
+	__m256i lower;
+	uint64_t q = 0;
+	uint64_t b = 0;
+	uint64_t o = 0;
+	int i = 0;
+
+	for (i = 0; i < 2; i++) {
+		v = _mm256_loadu_si256((const __m256i *)&p[i * 32]);
+		lower = _mm256_or_si256(v, bit5);
+		q |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << (i * 32);
+		b |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)) << (i * 32);
+		o |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(lower, open), _mm256_cmpeq_epi8(lower, close)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)))) << (i * 32);
+	}
+	m->quote = q;
+	m->backslash = b;
+	m->op = o;
+}
+
+#endif /* JSON_INDEX_X86 */
+
+typedef void (*classify_fn)(const char *p, struct block_masks *m);
+
+static classify_fn select_classify(const char **name)
+{
+#ifdef JSON_INDEX_X86
+	if (__builtin_cpu_supports("avx2")) {
+		*name = "avx2";
+		return classify_avx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		*name = "sse2";
+		return classify_sse2;
+	}
+#endif
+	*name = "scalar";
+	return classify_scalar;
+}
+
+const char * json_index_impl(void)
+{
+	const char *name = NULL;
+
+	select_classify(&name);
+
+	return name;
+}
+
+/*
+ * Characters escaped by a backslash, the first of a run of backslashes
+ * escaping the next.  carry is set if the block ends with an escaping
+ * backslash.
+ */
+static uint64_t escaped_chars(uint64_t backslash, uint64_t *carry)
+{
+	uint64_t escaped = *carry;
+	int i = 0;
+
+	*carry = 0;
+	while (backslash) {
+		i = __builtin_ctzll(backslash);
+		backslash &= backslash - 1;
+		if ((escaped >> i) & 1) {
+			continue;
+		}
+		if (i == 63) {
+			*carry = 1;
+		} else {
+			escaped |= 1ULL << (i + 1);
+		}
+	}
+
+	return escaped;
+}
+
+/* bit n set if an odd number of bits 0..n of x are set */
+static uint64_t prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+
+	return x;
+}
+
+void json_index_init(struct json_index *ix)
+{
+	memset(ix, 0, sizeof(*ix));
+}
+
+int json_index_build(struct json_index *ix, const char *s, size_t len)
+{
+	const char *name = NULL;
+	classify_fn classify = select_classify(&name);
+	struct block_masks m;
+	char tail[64];
+	uint64_t escape_carry = 0;
+	uint64_t in_string = 0;
+	uint64_t prev_in_string = 0;
+	uint64_t quotes = 0;
+	uint64_t structural = 0;
+	uint32_t *tmp = NULL;
+	size_t cap = 0;
+	size_t base = 0;
+
+	ix->num = 0;
+	if (len > UINT32_MAX) {
+		return -1;
+	}
+
+	for (base = 0; base < len; base += 64) {
+		/* at most 64 positions per block */
+		if (ix->num + 64 > ix->cap) {
+			cap = ix->cap ? ix->cap : 1024;
+			while (ix->num + 64 > cap) {
+				cap *= 2;
+			}
+			tmp = realloc(ix->pos, cap * sizeof(*ix->pos));
+			if (!tmp) {
+				return -1;
+			}
+			ix->pos = tmp;
+			ix->cap = cap;
+		}
+
+		if (len - base >= 64) {
+			classify(&s[base], &m);
+		} else {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, &s[base], len - base);
+			classify(tail, &m);
+		}
+
+		quotes = m.quote & ~escaped_chars(m.backslash, &escape_carry);
+		in_string = prefix_xor(quotes) ^ prev_in_string;
+		prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+		/* operators outside strings, and the quotes around them */
+		structural = (m.op & ~in_string) | quotes;
+		while (structural) {
+			ix->pos[ix->num++] = base + __builtin_ctzll(structural);
+			structural &= structural - 1;
+		}
+	}
+
+	return prev_in_string ? -1 : 0;
+}
+
+void json_index_free(struct json_index *ix)
+{
+	free(ix->pos);
+	memset(ix, 0, sizeof(*ix));
+}
+
+/* position of the '}' or ']' closing the object or array at at, 0 if none */
+static size_t match_close(const struct json_index *ix, const char *s, size_t at)
+{
+	int depth = 0;
+	size_t i = 0;
+	int c = 0;
+
+	for (i = at; i < ix->num; i++) {
+		c = s[ix->pos[i]] | 0x20;
+		if (c == '{') {
+			depth++;
+		} else if (c == '}' && !--depth) {
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+static int is_space(int c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int json_index_foreach(const struct json_index *ix, const char *s, size_t at,
+	json_index_cb_t cb, void *ud)
+{
+	struct json_elem e;
+	size_t i = at + 1;
+	size_t end = 0;
+	int start = 0;
+	int count = 0;
+	int open = 0;
+	int c = 0;
+
+	if (at >= ix->num) {
+		return -1;
+	}
+	open = s[ix->pos[at]];
+	if (open != '{' && open != '[') {
+		return -1;
+	}
+
+	/* empty object or array */
+	if (i < ix->num && s[ix->pos[i]] == open + 2) {
+		return 0;
+	}
+
+	while (i < ix->num) {
+		e.koff = 0;
+		e.klen = 0;
+		if (open == '{') {
+			if (i + 2 >= ix->num || s[ix->pos[i]] != '"' || s[ix->pos[i + 2]] != ':') {
+				return -1;
+			}
+			e.koff = ix->pos[i];
+			e.klen = ix->pos[i + 1] - ix->pos[i] + 1;
+			i += 3;
+			if (i >= ix->num) {
+				return -1;
+			}
+		}
+
+		c = s[ix->pos[i]];
+		e.at = i;
+		if (c == '{' || c == '[') {
+			end = match_close(ix, s, i);
+			if (!end) {
+				return -1;
+			}
+			e.voff = ix->pos[i];
+			e.vlen = ix->pos[end] - ix->pos[i] + 1;
+			e.vtype = c;
+			i = end + 1;
+		} else if (c == '"') {
+			e.voff = ix->pos[i];
+			e.vlen = ix->pos[i + 1] - ix->pos[i] + 1;
+			e.vtype = c;
+			i += 2;
+		} else {
+			/* number, true, false or null: the text up to the next delimiter */
+			start = ix->pos[i - 1] + 1;
+			end = ix->pos[i];
+			while ((size_t)start < end && is_space(s[start])) {
+				start++;
+			}
+			while (end > (size_t)start && is_space(s[end - 1])) {
+				end--;
+			}
+			if ((size_t)start == end) {
+				return -1;
+			}
+			e.voff = start;
+			e.vlen = end - start;
+			e.vtype = 0;
+		}
+
+		count++;
+		if (cb && cb(s, &e, ud)) {
+			return count;
+		}
+
+		if (i >= ix->num) {
+			return -1;
+		}
+		c = s[ix->pos[i]];
+		if (c == open + 2) {
+			return count;
+		}
+		if (c != ',') {
+			return -1;
+		}
+		i++;
+	}
+
+	return -1;
+}
+
+struct find_data {
+	const char *key;
+	int key_len;
+	struct json_elem *e;
+	int found;
+};
+
+static int find_cb(const char *s, const struct json_elem *e, void *ud)
+{
+	struct find_data *d = (struct find_data *)ud;
+
+	if (e->klen - 2 != d->key_len || memcmp(&s[e->koff + 1], d->key, d->key_len)) {
+		return 0;
+	}
+	*d->e = *e;
+	d->found = 1;
+
+	return 1;
+}
+
+int json_index_find(const struct json_index *ix, const char *s, size_t at,
+	const char *key, int key_len, struct json_elem *e)
+{
+	struct find_data d = { key, key_len, e, 0 };
+
+	if (at >= ix->num || s[ix->pos[at]] != '{') {
+		return 0;
+	}
+	json_index_foreach(ix, s, at, find_cb, &d);
+
+	return d.found;
+}
+
+int json_index_get_string(const char *s, const struct json_elem *e, char *to, int sz)
+{
+	int len = e->vlen - 2;
+
+	if (e->vtype != '"') {
+		return -1;
+	}
+
+	/* escapes, or too long: as json_get_string() would */
+	if (len >= sz || memchr(&s[e->voff + 1], '\\', len)) {
+		return json_get_string(&s[e->voff], e->vlen, "$", to, sz);
+	}
+
+	memcpy(to, &s[e->voff + 1], len);
+	to[len] = '\0';
+
+	return len;
+}
+
+int json_index_get_number(const char *s, const struct json_elem *e, double *v)
+{
+	if (e->vtype) {
+		return 0;
+	}
+
+	return json_get_number(&s[e->voff], e->vlen, "$", v);
+}
@@ -0,0 +1,87 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _JSON_INDEX_H
+#define _JSON_INDEX_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Structural index of a JSON document: the offsets of the characters
+ * { } [ ] : , and of the quotes delimiting strings, found 64 bytes at a time
+ * with SIMD compares (AVX2 or SSE2, chosen at runtime, or a scalar
+ * fallback).  Characters within strings are not indexed, so an object or
+ * array is walked by jumping from one structural character to the next
+ * rather than by scanning every byte.
+ */
+
+struct json_index {
+	uint32_t *pos;         /* offsets of the structural characters, in order */
+	size_t num;
+	size_t cap;
+};
+
+/* one element of an indexed object or array */
+struct json_elem {
+	int koff;              /* key including the quotes, klen 0 for array elements */
+	int klen;
+	int voff;              /* value, strings including the quotes */
+	int vlen;
+	int vtype;             /* '{', '[', '"', or 0 for a number, true, false or null */
+	size_t at;             /* position in json_index.pos of the value's '{', '[' or opening
+	                          quote, for a number etc. of the character following it */
+};
+
+/*
+ * Called for each element of an indexed object or array, return nonzero
+ * to stop.
+ */
+typedef int (*json_index_cb_t)(const char *s, const struct json_elem *e, void *ud);
+
+void json_index_init(struct json_index *ix);
+
+/**
+ * Index a document, reusing the memory of a previous index.
+ *
+ * /returns nonzero on an unterminated string or allocation failure.
+ */
+int json_index_build(struct json_index *ix, const char *s, size_t len);
+
+void json_index_free(struct json_index *ix);
+
+/* the implementation json_index_build() uses: "avx2", "sse2" or "scalar" */
+const char * json_index_impl(void);
+
+/**
+ * Visit each element of an object or array.
+ *
+ * /param ix - index of s
+ * /param s - the document
+ * /param at - position in ix->pos of the object or array, 0 for the
+ *             top level object or array
+ * /param cb - called for each element, may be NULL to count them
+ * /param ud - passed to cb
+ *
+ * /returns the number of elements visited, -1 on invalid input.
+ */
+int json_index_foreach(const struct json_index *ix, const char *s, size_t at,
+	json_index_cb_t cb, void *ud);
+
+/**
+ * Find a key of an object.
+ *
+ * /returns 1 if found, 0 if not (or s is not an object at at).
+ */
+int json_index_find(const struct json_index *ix, const char *s, size_t at,
+	const char *key, int key_len, struct json_elem *e);
+
+/* a string element, unescaped as json_get_string() does, -1 if not a string */
+int json_index_get_string(const char *s, const struct json_elem *e, char *to, int sz);
+
+/* a number element, returns 1 if it is a number, 0 if not */
+int json_index_get_number(const char *s, const struct json_elem *e, double *v);
+
+#endif /* _JSON_INDEX_H */
@@ -0,0 +1,96 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "latency_hist.h"
+
+#define SUB_COUNT (1u << LATENCY_HIST_SUB_BITS)
+
+static int bucket_index(uint64_t v)
+{
+	int msb = 0;
+	int shift = 0;
+
+	if (v < 2 * SUB_COUNT) {
+		return (int)v;
+	}
+	if (v >> LATENCY_HIST_MAX_BITS) {
+		return LATENCY_HIST_BUCKETS - 1;
+	}
+
+	/* the top LATENCY_HIST_SUB_BITS + 1 bits select the bucket */
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - LATENCY_HIST_SUB_BITS;
+
+	return ((shift + 1) << LATENCY_HIST_SUB_BITS) + (int)(v >> shift) - SUB_COUNT;
+}
+
+/* largest value counted in bucket i */
+static uint64_t bucket_upper(int i)
+{
+	int shift = (i >> LATENCY_HIST_SUB_BITS) - 1;
+	uint64_t mantissa = (i & (SUB_COUNT - 1)) + SUB_COUNT;
+
+	if (i < (int)(2 * SUB_COUNT)) {
+		return i;
+	}
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void latency_hist_record(struct latency_hist *h, uint64_t value_us)
+{
+	h->counts[bucket_index(value_us)]++;
+	h->count++;
+	h->sum += value_us;
+	if (value_us > h->max) {
+		h->max = value_us;
+	}
+}
+
+void latency_hist_merge(struct latency_hist *to, const struct latency_hist *from)
+{
+	int i = 0;
+
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		to->counts[i] += from->counts[i];
+	}
+	to->count += from->count;
+	to->sum += from->sum;
+	if (from->max > to->max) {
+		to->max = from->max;
+	}
+}
+
+uint64_t latency_hist_percentile(const struct latency_hist *h, double fraction)
+{
+	uint64_t rank = 0;
+	uint64_t seen = 0;
+	uint64_t upper = 0;
+	int i = 0;
+
+	if (!h->count) {
+		return 0;
+	}
+
+	/* the rank-th smallest value, 1 based */
+	rank = (uint64_t)(fraction * h->count + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > h->count) {
+		rank = h->count;
+	}
+
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= rank) {
+			break;
+		}
+	}
+
+	upper = bucket_upper(i);
+
+	return upper < h->max ? upper : h->max;
+}
@@ -0,0 +1,45 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _LATENCY_HIST_H
+#define _LATENCY_HIST_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear (HDR style) histogram of latencies in microseconds.  Values
+ * below 2^(LATENCY_HIST_SUB_BITS + 1) are counted exactly, larger values
+ * in 2^LATENCY_HIST_SUB_BITS buckets per power of two, so a percentile is
+ * within about 3% of the recorded value.  Values are recorded up to
+ * 2^32 us (71 minutes), larger ones are counted in the last bucket.
+ */
+#define LATENCY_HIST_SUB_BITS 5
+#define LATENCY_HIST_MAX_BITS 32
+#define LATENCY_HIST_BUCKETS ((LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS + 1) << LATENCY_HIST_SUB_BITS)
+
+struct latency_hist {
+	uint64_t counts[LATENCY_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+void latency_hist_record(struct latency_hist *h, uint64_t value_us);
+
+/* add the counts of from to to */
+void latency_hist_merge(struct latency_hist *to, const struct latency_hist *from);
+
+/**
+ * The value below which the given fraction of the recorded values fall.
+ *
+ * /param h - the histogram
+ * /param fraction - 0.0 to 1.0, e.g. 0.99 for the 99th percentile
+ *
+ * /returns the upper bound of the bucket holding that value, at most the
+ *          largest recorded value, 0 if nothing was recorded.
+ */
+uint64_t latency_hist_percentile(const struct latency_hist *h, double fraction);
+
+#endif /* _LATENCY_HIST_H */
@@ -4,261 +4,91 @@
 ***********************************************/
 
 #include "wasp_interface.h"
-#include "lws_http_client.h"
+#include "http_client.h"
+#include "trace_ring.h"
 #include <libwebsockets.h>
 
-static int in_progress = 0;
-static struct wasp_if_msg msg = { 0 };
-static struct lws_client_connect_info ci;
-static struct lws_context *context = NULL;
-static struct wasp_if_msg u_i[WASP_IF_MAX_DEVICES + 1] = { 0 };
-static char type[WASP_IF_OBJ_TYPE_LEN];
-static char prop[WASP_IF_OBJ_PROP_LEN];
-static char key[WASP_IF_UPDATE_STREAM_BODY_KEY_LEN];
-static char val[WASP_IF_UPDATE_STREAM_BODY_VAL_LEN];
-static char path[WASP_IF_PATH_LEN];
-static char update_body[WASP_IF_BODY_LEN];
-
-void lws_http_client_send(struct lws_context *context, struct wasp_if_msg *msg)
-{
-	int dev_index = 0;
-	struct wasp_if_msg * ui = NULL;
-	if (strcmp(msg->path, "/wasp/u2/objects")) {
-		in_progress = 1; /* flag for maintaining only one active GET/PATCH/POST request at a time */
-		ui = &u_i[0];
-	} else {
-		dev_index = _wasp_if_ipv4_to_device_index(msg->ipv4_address);
-		if (dev_index == -1) {
-			/* device not found */
-			return;
-		}
-
-		dev_index += 1;
-		ui = &u_i[dev_index];
-	}
+/* libwebsockets transport: one lws context per shard, each with a service thread per HTTP client thread */
 
-	/* store the path and method for later lookup within callback */
-	strncpy(ui->path, msg->path, sizeof(msg->path));
-	strncpy(ui->method, msg->method, sizeof(msg->method));
-	strncpy(ui->ipv4_address, msg->ipv4_address, sizeof(msg->ipv4_address));
+static struct lws_context *contexts[WASP_IF_MAX_SHARDS];
+static int num_threads = 1;
 
-	ci.protocol = "http";
-	ci.port = 80;
-	ci.address = msg->ipv4_address;
-	ci.method = msg->method;
-	ci.path = msg->path;
-	ci.context = context;
-	ci.opaque_user_data = ui;
-	if (strcmp(msg->body, "")) {
-		int len = strlen(msg->body);
-		strncpy(&ui->body[LWS_PRE], msg->body, len);
-		ui->body_len = len;
-	}
+/* timers of each device, mapped back to the device by their position */
+static lws_sorted_usec_list_t suls[WASP_IF_MAX_DEVICES][HTTP_CLIENT_NUM_TIMERS];
+static struct device_conn *timer_devs[WASP_IF_MAX_DEVICES];
 
-	//printf("%s %s %s %s\n", ci.address, ci.method, ci.path, msg->body);
-	lws_client_connect_via_info(&ci);
-}
+/* lws service thread index (tsi) of the calling thread within its context */
+static _Thread_local int service_tsi = 0;
 
-void send_authorization_request(void)
+/* add one request header, ctx is { wsi, position, end } of the header buffer */
+static int add_header(void *ctx, const char *name, const char *value, size_t len)
 {
-	struct wasp_if_msg tmp_msg;
-	_wasp_if_msg_init(
-		&tmp_msg,
-		"POST",
-		msg.ipv4_address,
-		"/wasp/r2/device/auth",
-		NULL);
-	lws_http_client_send(context, &tmp_msg);
+	void **args = (void **)ctx;
+
+	return lws_add_http_header_by_name((struct lws *)args[0],
+		(const unsigned char *)name, (const unsigned char *)value, len,
+		(unsigned char **)args[1], (unsigned char *)args[2]);
 }
 
 static int lws_callback_http(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
 {
-	/* mjson_next() args */
-	int koff, klen, voff, vlen, vtype;
-
-	const char *body;
-	int body_len;
-	int ret;
-
 	struct wasp_if_msg *ui = (struct wasp_if_msg *)lws_get_opaque_user_data(wsi);
+	struct device_conn *d = ui ? http_client_device(ui) : NULL;
+
+	_wasp_if_trace(TRACE_CALLBACK, d ? d->index : -1, reason, (int32_t)len);
 
 	switch (reason) {
+	/* service thread of a new client connection */
+	case LWS_CALLBACK_GET_THREAD_ID:
+		return service_tsi;
 	/* connection established */
 	case LWS_CALLBACK_ESTABLISHED_CLIENT_HTTP:
 	{
-		ui->pos = 0;
-		break;
+		char encoding[32] = "";
+
+		/* compressed response (Accept-Encoding was sent) */
+		if (lws_hdr_copy(wsi, encoding, sizeof(encoding), WSI_TOKEN_HTTP_CONTENT_ENCODING) < 0) {
+			encoding[0] = '\0';
+		}
+
+		return http_client_established(ui, wsi, lws_http_client_http_response(wsi), encoding) ? -1 : 0;
 	}
 	/* connection error */
 	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
-	{
-		printf("Unable to connect to device at address %s\n", ui->ipv4_address);
+		http_client_failed(ui, wsi);
+		lws_cancel_service(lws_get_context(wsi));
 		break;
-	}
 	/* add custom headers as required */
 	case LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER:
 	{
-		const char *auth_str = NULL;
 		unsigned char **p = (unsigned char **)in;
-		unsigned char *end = (*p) + len;
-
-		/* authorization request (POST) */
-		if (!strcmp(ui->method, "POST")) {
-			if (lws_add_http_header_by_name(wsi,
-				(const unsigned char *)"Authorization:",
-				(const unsigned char *)"Hawk", 4, p, end)) {
-				return -1;
-			}
-		} else {
-
-			/* PATCH requests */
-			if (!strcmp(ui->method, "PATCH")) {
-
-				/* Content Length */
-				if (lws_add_http_header_by_name(wsi,
-					(const unsigned char *)"Content-Length:",
-					(const unsigned char *)"256", 3, p, end)) {
-					return -1;
-				}
-
-				/* Content Type */
-				if (lws_add_http_header_by_name(wsi,
-					(const unsigned char *)"Content-Type:",
-					(const unsigned char *)"application/json", 16, p, end)) {
-					return -1;
-				}
-
-				/* notify a write (PATCH request content) is pending */
-				lws_client_http_body_pending(wsi, 1);
-				lws_callback_on_writable(wsi);
-			}
-
-
-			auth_str = _wasp_if_ipv4_to_auth_str(ui->ipv4_address);
-			if (auth_str) {
-				/* All GET/PATCH requests, add authorization header */
-				if (lws_add_http_header_by_name(wsi,
-					(const unsigned char *)"Authorization:",
-					(const unsigned char *)auth_str, WASP_IF_AUTH_STR_LEN, p, end)) {
-					return -1;
-				}
-			}
-		}
-		break;
-	}
-	case LWS_CALLBACK_RECEIVE_CLIENT_HTTP_READ:
-	{
-		const char *p = in;
-		char auth_id[WASP_IF_AUTH_ID_LEN];
-		char auth_id_str[WASP_IF_AUTH_STR_LEN];
-
-		/* POST authorization request */
-		if (!strcmp(ui->method, "POST") && !strcmp(ui->path, "/wasp/r2/device/auth")) {
-			/* store the authorization ID */
-			json_get_string(p, strlen(p), "$.id", auth_id, WASP_IF_AUTH_ID_LEN);
-			sprintf(auth_id_str, "Hawk id=\"%s\"", auth_id);
-			_wasp_if_store_auth_str(ui->ipv4_address, auth_id_str);
+		void *args[3] = { wsi, p, (*p) + len };
 
+		if (http_client_headers(ui, add_header, args)) {
+			return -1;
 		}
 
-		/* GET requests */
-		if (!strcmp(ui->method, "GET")) {
-
-			/* update stream */
-			if (!strcmp(ui->path, "/wasp/u2/objects")) {
-
-				char *in = (char*)p;
-				char *delim = "---";
-				char *token;
-
-				do {
-					token = strstr(in, delim);
-					if (token) {
-						*token = '\0';
-					}
-
-					/* get the update type */
-					json_get_string(in, strlen(in), "$._type", type, sizeof(type));
-					/* store pointer to update body */
-					json_find(in, strlen(in), "$.body", &body, &body_len);
-					/* update:group_prefix - multiple objects of common type, property */
-					if (!strcmp(type, "update:group_prefix")) {
-						/* get the property common to the group */
-						json_get_string(in, strlen(in), "$.prop", prop, sizeof(prop));
-
-						/* iterate through each body element {{"id1":value1}, {"id2":value2}, ...} */
-						ret = 0;
-						while (1) {
-							ret = json_next(body, body_len, ret, &koff, &klen, &voff, &vlen, &vtype);
-							if (ret == 0) {
-								break;
-							}
-
-							/* get the update body ID */
-							strncpy(key, &body[koff + 1], klen - 1);
-							key[klen - 2] = '\0';
-							/* get the update body value */
-							strncpy(val, &body[voff], vlen);
-							val[vlen] = '\0';
-
-							sprintf(path, "/objects/%d", atoi(key));
-							sprintf(update_body, "{\"%s\":%s}", prop, val);
-							_wasp_if_notify_update_stream_rcvd(ui->ipv4_address, path, update_body);
-						}
-					}
-					/* update:obj - one object */
-					if (!strcmp(type, "update:obj")) {
-						json_get_string(in, strlen(in), "$.path", path, sizeof(path));
-						ret = 0;
-						/* iterate through each body element {{"prop1":value1}, {"prop1":value1}, ...} */
-						while (1) {
-							ret = json_next(body, body_len, ret, &koff, &klen, &voff, &vlen, &vtype);
-							if (ret == 0) {
-								break;
-							}
-
-							/* get the update body property */
-							strncpy(key, &body[koff + 1], klen - 1);
-							key[klen - 2] = '\0';
-							/* get the update body property value */
-							strncpy(val, &body[voff], vlen);
-							val[vlen] = '\0';
-
-							sprintf(update_body, "{\"%s\":%s}", key, val);
-							_wasp_if_notify_update_stream_rcvd(ui->ipv4_address, path, update_body);
-						}
-					}
-
-					in = token + strlen(delim);
-				} while (token != NULL);
-			}
-
-			if (strstr(ui->path, "/wasp/r2/objects/") || !strcmp(ui->path, "/wasp/r2/device/info")) {
-				_wasp_if_store_single_object(p);
-			}
-
-			/* store the schemas. lws does not appear to reassemble large fragmented responses (objects, schemas) - assemble ourselves */
-			if (!strcmp(ui->path, "/wasp/r2/schemas")) {
-				_wasp_if_store_schema(ui->ipv4_address, ui->pos, p, len);
-				ui->pos += len;
-			}
-			/* store the objects - see above */
-			if (!strcmp(ui->path, "/wasp/r2/objects")) {
-				_wasp_if_store_object(ui->ipv4_address, ui->pos, p, len);
-				ui->pos += len;
-			}
+		/* notify a write (PATCH request content) is pending */
+		if (ui->body_len) {
+			lws_client_http_body_pending(wsi, 1);
+			lws_callback_on_writable(wsi);
 		}
-
-		return 0;
+		break;
 	}
+	case LWS_CALLBACK_RECEIVE_CLIENT_HTTP_READ:
+		return http_client_data(ui, (const char *)in, len) ? -1 : 0;
 	/* callback for writing request payload */
 	case LWS_CALLBACK_CLIENT_HTTP_WRITEABLE:
 	{
+		unsigned char buffer[LWS_PRE + WASP_IF_BODY_LEN];
+
 		if (lws_http_is_redirected_to_get(wsi))
 			break;
 
 		/* write PATCH payload data */
-		lws_write(wsi, (unsigned char*)&ui->body[LWS_PRE], ui->body_len, LWS_WRITE_HTTP_FINAL);
+		memcpy(&buffer[LWS_PRE], ui->body, ui->body_len);
+		lws_write(wsi, &buffer[LWS_PRE], ui->body_len, LWS_WRITE_HTTP_FINAL);
+		http_client_sent(ui, ui->body_len);
 		lws_client_http_body_pending(wsi, 0);
 
 		return 0;
@@ -278,35 +108,13 @@ static int lws_callback_http(struct lws *wsi, enum lws_callback_reasons reason,
 	}
 	/* request completed */
 	case LWS_CALLBACK_COMPLETED_CLIENT_HTTP:
-	{
-		/* get the status code */
-		int last_err_code = lws_http_client_http_response(wsi);
-		_wasp_if_store_last_err_code(last_err_code);
-
-		/* object update stream closed - reconnect... */
-		if (!strcmp(ui->path, "/wasp/u2/objects")) {
-			struct wasp_if_msg tmp_msg;
-			_wasp_if_msg_init(
-				&tmp_msg,
-				"GET",
-				ui->ipv4_address,
-				"/wasp/u2/objects",
-				NULL);
-			lws_http_client_send(context, &tmp_msg);
-		}
-
-		if (last_err_code != 401) {
-			if (strcmp(ui->path, "/wasp/r2/device/auth") && strcmp(ui->path, "/wasp/u2/objects")) {
-				_wasp_if_notify_request_complete();
-			}
-
-
-		}
-		in_progress = 0; /* clear in_progress flag to allow another request to be sent */
+		http_client_completed(ui, wsi, lws_http_client_http_response(wsi));
 		lws_cancel_service(lws_get_context(wsi));
 		break;
-	}
 	case LWS_CALLBACK_CLOSED_CLIENT_HTTP:
+		if (ui) {
+			http_client_closed(ui, wsi);
+		}
 		lws_cancel_service(lws_get_context(wsi));
 		break;
 
@@ -330,48 +138,107 @@ static const struct lws_protocols protocols[] = {
 	{ NULL, NULL, 0, 0, 0, NULL, 0 }
 };
 
-void * lws_http_client_thread(void *args)
+static void * lws_transport_send(struct device_conn *d, struct wasp_if_msg *ui)
+{
+	struct lws_client_connect_info ci;
+	char host[WASP_IF_IPV4_ADDRESS_LEN];
+	char *port = NULL;
+
+	/* "a.b.c.d" or "a.b.c.d:port" */
+	strncpy(host, ui->ipv4_address, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+	port = strchr(host, ':');
+	if (port) {
+		*port++ = '\0';
+	}
+
+	memset(&ci, 0, sizeof(ci));
+	ci.protocol = "http";
+	ci.port = port ? atoi(port) : 80;
+	ci.address = host;
+	ci.host = host;
+	ci.method = ui->method;
+	ci.path = ui->path;
+	ci.context = contexts[d->shard];
+	ci.opaque_user_data = ui;
+
+	//printf("%s %s %s %s\n", ci.address, ci.method, ci.path, ui->body);
+	return lws_client_connect_via_info(&ci);
+}
+
+static void lws_transport_close(struct device_conn *d, void *conn)
 {
+	(void)d;
+	lws_set_timeout((struct lws *)conn, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+}
+
+static void timer_expired(lws_sorted_usec_list_t *sul)
+{
+	int n = sul - &suls[0][0];
+
+	http_client_timer(timer_devs[n / HTTP_CLIENT_NUM_TIMERS], n % HTTP_CLIENT_NUM_TIMERS);
+}
+
+static void lws_transport_timer(struct device_conn *d, enum http_client_timer timer, uint64_t delay_us)
+{
+	timer_devs[d->index] = d;
+	if (delay_us) {
+		lws_sul_schedule(contexts[d->shard], d->tsi, &suls[d->index][timer], timer_expired, delay_us);
+	} else {
+		lws_sul_schedule(contexts[d->shard], d->tsi, &suls[d->index][timer], NULL, LWS_SET_TIMER_USEC_CANCEL);
+	}
+}
+
+static void lws_transport_wake(int thread)
+{
+	struct lws_context *context = contexts[thread / num_threads];
+
+	if (context) {
+		lws_cancel_service(context);
+	}
+}
+
+static void lws_transport_run(int thread)
+{
+	int shard = thread / num_threads;
 	int n = 0;
-	int resend = 0;
 
-	(void)args; /* unused */
+	service_tsi = thread % num_threads;
+	while (n >= 0) {
+		http_client_service(thread);
+		n = lws_service_tsi(contexts[shard], 0, service_tsi);
+	}
+}
 
-	/* create the LWS HTTP client context */
+static int lws_transport_start(int shards, int threads)
+{
 	struct lws_context_creation_info info;
+	int i = 0;
+
+	/* create an LWS HTTP client context per shard, one service thread (tsi) per thread */
 	memset(&info, 0, sizeof info);
 	info.protocols = protocols;
-	context = lws_create_context(&info);
-	if (!context) {
-		printf("ERROR: lws init failed\n");
-		return NULL;
-	}
-
-	while (n >= 0) {
-		/* one request allowed at a time */
-		if (!in_progress) {
-			/* permissions error, send the authorization request */
-			if (_wasp_if_get_last_err_code() == 401) {
-				send_authorization_request();
-				resend = 1;
-			} else {
-				if (resend) {
-					/* resend the last (401 failed) request */
-					lws_http_client_send(context, &msg);
-					resend = 0;
-				} else {
-					/* read and send requests */
-					if (_wasp_if_msg_read(&msg)) {
-						lws_http_client_send(context, &msg);
-					}
-				}
-			}
+	info.count_threads = threads;
+	for (i = 0; i < shards; i++) {
+		contexts[i] = lws_create_context(&info);
+		if (!contexts[i]) {
+			printf("ERROR: lws init failed\n");
+			return -1;
 		}
-		n = lws_service(context, 0);
 	}
 
-	lws_context_destroy(context);
+	/* limited to LWS_MAX_SMP of the libwebsockets build */
+	num_threads = lws_get_count_threads(contexts[0]);
 
-	return NULL;
+	return num_threads;
 }
 
+const struct http_transport lws_transport = {
+	"libwebsockets",
+	lws_transport_start,
+	lws_transport_run,
+	lws_transport_wake,
+	lws_transport_send,
+	lws_transport_close,
+	lws_transport_timer
+};
@@ -1,14 +0,0 @@
-
-/**********************************************
-(C) Copyright AudioScience Inc. 2020
-***********************************************/
-
-#ifndef _LWS_HTTP_CLIENT_H
-#define _LWS_HTTP_CLIENT_H
-
-#include <stdlib.h>
-
-void * lws_http_client_thread(void *args);
-
-#endif /* _LWS_HTTP_CLIENT_H */
-
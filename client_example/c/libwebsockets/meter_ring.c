@@ -0,0 +1,76 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "meter_ring.h"
+#include <string.h>
+
+int meter_ring_init(struct meter_ring *ring, size_t capacity)
+{
+	size_t size = 1;
+
+	if (!capacity) {
+		return -1;
+	}
+
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	ring->samples = calloc(size, sizeof(*ring->samples));
+	if (!ring->samples) {
+		return -1;
+	}
+
+	ring->mask = size - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->dropped, 0);
+
+	return 0;
+}
+
+void meter_ring_free(struct meter_ring *ring)
+{
+	free(ring->samples);
+	ring->samples = NULL;
+	ring->mask = 0;
+}
+
+int meter_ring_push(struct meter_ring *ring, const struct wasp_if_meter_sample *sample)
+{
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail > ring->mask) {
+		/* full */
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return -1;
+	}
+
+	ring->samples[head & ring->mask] = *sample;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	return 0;
+}
+
+size_t meter_ring_pop(struct meter_ring *ring, struct wasp_if_meter_sample *samples, size_t max_samples)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t count = head - tail;
+	size_t i = 0;
+
+	if (count > max_samples) {
+		count = max_samples;
+	}
+
+	for (i = 0; i < count; i++) {
+		samples[i] = ring->samples[(tail + i) & ring->mask];
+	}
+
+	atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+
+	return count;
+}
@@ -0,0 +1,52 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _METER_RING_H
+#define _METER_RING_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "wasp_interface.h"
+
+/*
+ * Single producer, single consumer ring of meter samples.  The producer
+ * (HTTP client thread) and the consumer (application thread) never block
+ * each other; when the ring is full new samples are dropped and counted.
+ */
+struct meter_ring {
+	struct wasp_if_meter_sample *samples;
+	size_t mask;
+	atomic_size_t head;    /* next slot to write, owned by the producer */
+	atomic_size_t tail;    /* next slot to read, owned by the consumer */
+	atomic_ullong dropped; /* samples dropped because the ring was full */
+};
+
+/**
+ * Allocate the ring.
+ *
+ * /param ring - the ring to initialize
+ * /param capacity - number of samples, rounded up to a power of two
+ *
+ * /returns nonzero on error.
+ */
+int meter_ring_init(struct meter_ring *ring, size_t capacity);
+
+void meter_ring_free(struct meter_ring *ring);
+
+/**
+ * Write a sample (producer only).
+ *
+ * /returns nonzero if the ring is full and the sample was dropped.
+ */
+int meter_ring_push(struct meter_ring *ring, const struct wasp_if_meter_sample *sample);
+
+/**
+ * Read up to max_samples samples (consumer only).
+ *
+ * /returns the number of samples read.
+ */
+size_t meter_ring_pop(struct meter_ring *ring, struct wasp_if_meter_sample *samples, size_t max_samples);
+
+#endif /* _METER_RING_H */
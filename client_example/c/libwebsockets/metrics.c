@@ -0,0 +1,243 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "metrics.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+struct metrics_block {
+	struct wasp_if_device_counters devs[WASP_IF_MAX_DEVICES];
+	struct metrics_block *next;
+};
+
+static _Thread_local struct metrics_block *thread_block = NULL;
+static struct metrics_block *blocks = NULL;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_size_t queue_depths[WASP_IF_MAX_DEVICES];
+
+#define COUNTERS_LEN (sizeof(struct wasp_if_device_counters) / sizeof(uint64_t))
+
+struct wasp_if_device_counters * metrics_thread_counters(int dev_index)
+{
+	struct metrics_block *b = thread_block;
+
+	if (dev_index < 0 || dev_index >= WASP_IF_MAX_DEVICES) {
+		return NULL;
+	}
+
+	if (!b) {
+		b = calloc(1, sizeof(*b));
+		if (!b) {
+			return NULL;
+		}
+		pthread_mutex_lock(&blocks_lock);
+		b->next = blocks;
+		blocks = b;
+		pthread_mutex_unlock(&blocks_lock);
+		thread_block = b;
+	}
+
+	return &b->devs[dev_index];
+}
+
+void metrics_sum(int dev_index, struct wasp_if_device_counters *counters)
+{
+	struct metrics_block *b = NULL;
+	uint64_t *to = (uint64_t *)counters;
+	uint64_t *from = NULL;
+	size_t i = 0;
+
+	memset(counters, 0, sizeof(*counters));
+
+	pthread_mutex_lock(&blocks_lock);
+	for (b = blocks; b; b = b->next) {
+		from = (uint64_t *)&b->devs[dev_index];
+		for (i = 0; i < COUNTERS_LEN; i++) {
+			to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&blocks_lock);
+}
+
+void metrics_set_queue_depth(int dev_index, size_t depth)
+{
+	atomic_store_explicit(&queue_depths[dev_index], depth, memory_order_relaxed);
+}
+
+size_t metrics_get_queue_depth(int dev_index)
+{
+	return atomic_load_explicit(&queue_depths[dev_index], memory_order_relaxed);
+}
+
+int metrics_status_class(int status)
+{
+	if (status >= 200 && status < 600) {
+		return status / 100 - 2;
+	}
+
+	return WASP_IF_STATUS_ERROR;
+}
+
+int metrics_method(const char *method)
+{
+	if (!strcmp(method, "GET")) {
+		return WASP_IF_METHOD_GET;
+	}
+	if (!strcmp(method, "PATCH")) {
+		return WASP_IF_METHOD_PATCH;
+	}
+	if (!strcmp(method, "POST")) {
+		return WASP_IF_METHOD_POST;
+	}
+
+	return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* text being formatted, len keeps counting once buf is full */
+struct prom_out {
+	char *buf;
+	size_t cap;
+	size_t len;
+};
+
+static void prom_printf(struct prom_out *o, const char *fmt, ...)
+{
+	va_list ap;
+	int n = 0;
+
+	va_start(ap, fmt);
+	n = vsnprintf(o->len < o->cap ? &o->buf[o->len] : NULL, o->len < o->cap ? o->cap - o->len : 0, fmt, ap);
+	va_end(ap);
+	if (n > 0) {
+		o->len += n;
+	}
+}
+
+static void prom_family(struct prom_out *o, const char *name, const char *type, const char *help)
+{
+	prom_printf(o, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* one value per device, offset of a uint64_t or size_t in struct wasp_if_device_metrics */
+static void prom_per_device(struct prom_out *o, const struct wasp_if_metrics *m,
+	const char *name, size_t offset, int is_size)
+{
+	const struct wasp_if_device_metrics *dm = NULL;
+	unsigned long long v = 0;
+	int i = 0;
+
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		dm = &m->devices[i];
+		if (!dm->ipv4_address[0]) {
+			continue;
+		}
+		v = is_size ? *(const size_t *)((const char *)dm + offset) :
+			*(const uint64_t *)((const char *)dm + offset);
+		prom_printf(o, "%s{device=\"%s\"} %llu\n", name, dm->ipv4_address, v);
+	}
+}
+
+size_t metrics_format_prometheus(const struct wasp_if_metrics *m, char *buf, size_t len)
+{
+	static const char *methods[WASP_IF_NUM_METHODS] = { "GET", "PATCH", "POST" };
+	static const char *classes[WASP_IF_NUM_STATUS] = { "2xx", "3xx", "4xx", "5xx", "error" };
+	static const char *events[WASP_IF_NUM_EVENT_TYPES] = { "update:obj", "update:group_prefix", "other" };
+	const struct wasp_if_device_metrics *dm = NULL;
+	struct prom_out o = { buf, len, 0 };
+	int i = 0;
+	int j = 0;
+	int k = 0;
+
+	if (len) {
+		buf[0] = '\0';
+	}
+
+	prom_family(&o, "wasp_requests_total", "counter", "Completed requests by method and status class.");
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		dm = &m->devices[i];
+		for (j = 0; dm->ipv4_address[0] && j < WASP_IF_NUM_METHODS; j++) {
+			for (k = 0; k < WASP_IF_NUM_STATUS; k++) {
+				if (dm->counters.requests[j][k]) {
+					prom_printf(&o, "wasp_requests_total{device=\"%s\",method=\"%s\",status=\"%s\"} %llu\n",
+						dm->ipv4_address, methods[j], classes[k],
+						(unsigned long long)dm->counters.requests[j][k]);
+				}
+			}
+		}
+	}
+
+	prom_family(&o, "wasp_received_bytes_total", "counter", "Response and update stream bytes received.");
+	prom_per_device(&o, m, "wasp_received_bytes_total",
+		offsetof(struct wasp_if_device_metrics, counters.bytes_in), 0);
+
+	prom_family(&o, "wasp_sent_bytes_total", "counter", "Request body bytes sent.");
+	prom_per_device(&o, m, "wasp_sent_bytes_total",
+		offsetof(struct wasp_if_device_metrics, counters.bytes_out), 0);
+
+	prom_family(&o, "wasp_stream_events_total", "counter", "Update stream events received by type.");
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		dm = &m->devices[i];
+		for (j = 0; dm->ipv4_address[0] && j < WASP_IF_NUM_EVENT_TYPES; j++) {
+			prom_printf(&o, "wasp_stream_events_total{device=\"%s\",type=\"%s\"} %llu\n",
+				dm->ipv4_address, events[j], (unsigned long long)dm->counters.stream_events[j]);
+		}
+	}
+
+	prom_family(&o, "wasp_stream_reconnects_total", "counter", "Update stream reconnect attempts.");
+	prom_per_device(&o, m, "wasp_stream_reconnects_total",
+		offsetof(struct wasp_if_device_metrics, counters.stream_reconnects), 0);
+
+	prom_family(&o, "wasp_auth_requests_total", "counter", "Authorization requests, including refreshes.");
+	prom_per_device(&o, m, "wasp_auth_requests_total",
+		offsetof(struct wasp_if_device_metrics, counters.auth_requests), 0);
+
+	prom_family(&o, "wasp_request_queue_depth", "gauge", "Requests waiting to be sent.");
+	prom_per_device(&o, m, "wasp_request_queue_depth",
+		offsetof(struct wasp_if_device_metrics, queue_depth), 1);
+
+	prom_family(&o, "wasp_stored_objects", "gauge", "Objects stored.");
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		dm = &m->devices[i];
+		if (dm->ipv4_address[0]) {
+			prom_printf(&o, "wasp_stored_objects{device=\"%s\"} %d\n", dm->ipv4_address, dm->num_objects);
+		}
+	}
+
+	prom_family(&o, "wasp_store_memory_bytes", "gauge", "Memory of the stored objects and schemas.");
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		dm = &m->devices[i];
+		if (dm->ipv4_address[0]) {
+			prom_printf(&o, "wasp_store_memory_bytes{device=\"%s\",store=\"objects\"} %zu\n"
+				"wasp_store_memory_bytes{device=\"%s\",store=\"schemas\"} %zu\n",
+				dm->ipv4_address, dm->objects_bytes, dm->ipv4_address, dm->schemas_bytes);
+		}
+	}
+
+	prom_family(&o, "wasp_dispatch_updates_total", "counter", "Updates through the dispatch queues by outcome.");
+	prom_printf(&o, "wasp_dispatch_updates_total{result=\"enqueued\"} %llu\n"
+		"wasp_dispatch_updates_total{result=\"delivered\"} %llu\n"
+		"wasp_dispatch_updates_total{result=\"dropped\"} %llu\n"
+		"wasp_dispatch_updates_total{result=\"conflated\"} %llu\n",
+		(unsigned long long)m->dispatch.enqueued, (unsigned long long)m->dispatch.delivered,
+		(unsigned long long)m->dispatch.dropped, (unsigned long long)m->dispatch.conflated);
+
+	prom_family(&o, "wasp_dispatch_blocked_total", "counter", "Times the HTTP client thread waited for queue space.");
+	prom_printf(&o, "wasp_dispatch_blocked_total %llu\n", (unsigned long long)m->dispatch.blocked);
+
+	prom_family(&o, "wasp_dispatch_queue_depth", "gauge", "Updates queued for the dispatch threads.");
+	prom_printf(&o, "wasp_dispatch_queue_depth %zu\n", m->dispatch.depth);
+
+	prom_family(&o, "wasp_dispatch_queue_max_depth", "gauge", "Highest depth of any dispatch queue.");
+	prom_printf(&o, "wasp_dispatch_queue_max_depth %zu\n", m->dispatch.max_depth);
+
+	return o.len;
+}
@@ -0,0 +1,56 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdlib.h>
+#include "wasp_interface.h"
+
+/*
+ * Runtime counters.  Each thread that counts has its own block of
+ * per-device counters, so a counter is only ever written by one thread
+ * and incrementing it is a plain (relaxed atomic) store.  Readers sum
+ * the blocks of all threads.  Blocks are kept when their thread exits, so
+ * the counts stay monotonic.
+ */
+
+/**
+ * The calling thread's counters of a device, allocated on first use.
+ *
+ * /returns NULL on allocation failure or an invalid device index.
+ */
+struct wasp_if_device_counters * metrics_thread_counters(int dev_index);
+
+/* add n to one field of the calling thread's counters of a device */
+#define METRICS_ADD(dev_index, field, n) do { \
+	struct wasp_if_device_counters *_mc = metrics_thread_counters(dev_index); \
+	if (_mc) { \
+		__atomic_store_n(&_mc->field, _mc->field + (n), __ATOMIC_RELAXED); \
+	} \
+} while (0)
+
+/* sum the counters of a device over all threads */
+void metrics_sum(int dev_index, struct wasp_if_device_counters *counters);
+
+/* gauge of the requests waiting in a device's queue */
+void metrics_set_queue_depth(int dev_index, size_t depth);
+size_t metrics_get_queue_depth(int dev_index);
+
+/* WASP_IF_STATUS_* class of an HTTP status, WASP_IF_STATUS_ERROR for no response */
+int metrics_status_class(int status);
+
+/* WASP_IF_METHOD_* of a request method, -1 if unknown */
+int metrics_method(const char *method);
+
+/**
+ * Format a snapshot in the Prometheus text exposition format.
+ *
+ * /returns the length of the text (excluding the NUL), which may be
+ *          len or more if buf was too small.
+ */
+size_t metrics_format_prometheus(const struct wasp_if_metrics *m, char *buf, size_t len);
+
+#endif /* _METRICS_H */
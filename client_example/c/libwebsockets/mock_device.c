@@ -0,0 +1,709 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+/*
+ * Loopback mock WASP device for benchmarking the client without hardware.
+ *
+ * Serves GET /wasp/r2/objects, /wasp/r2/schemas, /wasp/r2/schemas/<id>,
+ * /wasp/r2/device/info, GET/PATCH /wasp/r2/objects/<id>, PATCH
+ * /wasp/r2/objects, POST /wasp/r2/device/auth and the /wasp/u2/objects
+ * update stream.  Every connection is served by its own thread and closed
+ * after the response.  The update stream can be loaded with a configurable
+ * rate and mix of update:obj and update:group_prefix events, written in
+ * arbitrarily split pieces, to measure the client's stream ingest.
+ */
+
+#include "wasp_interface.h"
+#include "object_store.h"
+#include "mock_dump.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MOCK_MAX_STREAMS 64
+#define MOCK_REQ_LEN 8192
+#define MOCK_STREAM_TICK_US 1000
+#define MOCK_STREAM_BATCH_LEN 65536
+
+struct mock_opts {
+	int port;
+	struct mock_dump_cfg dump;
+	int delay_ms;          /* added to every response */
+	int jitter_ms;         /* random extra delay up to jitter_ms */
+	int auth;              /* (1) : 401 without a valid authorization ID */
+	int auth_expiry_s;     /* authorization IDs expire after this, 0 never */
+	int event_rate;        /* update stream events per second, 0 none */
+	int flood;             /* (1) : stream events as fast as the clients read them */
+	int obj_pct;           /* percentage of update:obj events, the rest update:group_prefix */
+	int group_meters;      /* ctrl:meter levels per update:group_prefix, 0 all */
+	int max_chunk;         /* stream writes split at random, 1 to max_chunk bytes, 0 whole events */
+	int keep_alive;        /* (1) : serve further requests on a connection unless the client closes it */
+};
+
+static struct mock_opts opts;
+
+/* the connection of the calling thread stays open after the response */
+static _Thread_local int conn_keep_alive = 0;
+static struct object_store store;
+static char *objects_dump = NULL;
+static size_t objects_len = 0;
+static char *schemas_dump = NULL;
+static size_t schemas_len = 0;
+
+#define MOCK_MAX_AUTH_IDS 64
+
+/* IDs issued by POST /wasp/r2/device/auth, one per client connecting to this device */
+static pthread_mutex_t auth_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int auth_ids[MOCK_MAX_AUTH_IDS];
+static time_t auth_times[MOCK_MAX_AUTH_IDS];
+static unsigned int auth_seq = 0;
+
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static int stream_fds[MOCK_MAX_STREAMS];
+static int num_streams = 0;
+
+static const char *device_info =
+	"{\"_id\":0,\"model\":\"MOCK\",\"serial_number\":\"00000000\",\"version\":\"0.0.0\"}";
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+	ssize_t ret = 0;
+
+	while (len > 0) {
+		ret = send(fd, buf, len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static const char * status_text(int status)
+{
+	switch (status) {
+	case 200: return "OK";
+	case 202: return "Accepted";
+	case 400: return "Bad Request";
+	case 401: return "Unauthorized";
+	case 404: return "Not Found";
+	default: return "Error";
+	}
+}
+
+static void respond(int fd, int status, const char *body, size_t len)
+{
+	char hdr[256];
+	int n = snprintf(hdr, sizeof(hdr),
+		"HTTP/1.1 %d %s\r\n"
+		"Content-Type: application/json\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: %s\r\n\r\n",
+		status, status_text(status), len, conn_keep_alive ? "keep-alive" : "close");
+
+	if (!send_all(fd, hdr, n) && len) {
+		send_all(fd, body, len);
+	}
+}
+
+static void respond_delay(void)
+{
+	int ms = opts.delay_ms;
+
+	if (opts.jitter_ms > 0) {
+		ms += rand() % (opts.jitter_ms + 1);
+	}
+	if (ms > 0) {
+		usleep(ms * 1000);
+	}
+}
+
+/* "Hawk id=\"<id>\"" matching an issued, unexpired ID */
+static int authorized(const char *authorization)
+{
+	unsigned int id = 0;
+	int end = 0;
+	int ok = 0;
+	int i = 0;
+
+	if (!opts.auth) {
+		return 1;
+	}
+
+	/* the closing quote is required, a truncated header is not authorized */
+	if (sscanf(authorization, "Hawk id=\"%u\"%n", &id, &end) != 1 || !id || !end) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&auth_lock);
+	for (i = 0; i < MOCK_MAX_AUTH_IDS; i++) {
+		if (auth_ids[i] == id) {
+			ok = !opts.auth_expiry_s || time(NULL) - auth_times[i] < opts.auth_expiry_s;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&auth_lock);
+
+	return ok;
+}
+
+static void stream_broadcast(const char *buf, size_t len)
+{
+	int i = 0;
+
+	pthread_mutex_lock(&stream_lock);
+	for (i = 0; i < num_streams; i++) {
+		send_all(stream_fds[i], buf, len);
+	}
+	pthread_mutex_unlock(&stream_lock);
+}
+
+struct patch_data {
+	int id;
+	int err;
+};
+
+/* apply one "prop":value of a PATCH body */
+static int patch_prop_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	struct patch_data *pd = (struct patch_data *)ud;
+
+	if (klen == 5 && !strncmp(&s[koff], "\"_id\"", 5)) {
+		return 0;
+	}
+
+	if (object_store_set_prop(&store, pd->id, &s[koff + 1], klen - 2, &s[voff], vlen)) {
+		pd->err = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int patch_object(int id, const char *body, int len)
+{
+	struct patch_data pd;
+	char update[MOCK_REQ_LEN + 128];
+	int n = 0;
+
+	pd.id = id;
+	pd.err = 0;
+	if (json_foreach(body, len, patch_prop_cb, &pd) < 0 || pd.err) {
+		return -1;
+	}
+
+	/* tell the update stream clients */
+	n = snprintf(update, sizeof(update),
+		"{\"_type\":\"update:obj\",\"path\":\"/objects/%d\",\"body\":%.*s}\n---\n", id, len, body);
+	if (n > 0 && (size_t)n < sizeof(update)) {
+		stream_broadcast(update, n);
+	}
+
+	return 0;
+}
+
+/* one {"_id":n, ...} element of a PATCH /wasp/r2/objects array */
+static int patch_elem_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	double num = 0;
+
+	(void)koff;
+	(void)klen;
+
+	if (!json_get_number(&s[voff], vlen, "$._id", &num) ||
+	    patch_object((int)num, &s[voff], vlen)) {
+		*(int *)ud = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void serve_stream(int fd)
+{
+	const char *hdr =
+		"HTTP/1.1 202 Accepted\r\n"
+		"Content-Type: application/json\r\n"
+		"Connection: close\r\n\r\n";
+	char buf[256];
+	int added = 0;
+
+	if (send_all(fd, hdr, strlen(hdr))) {
+		return;
+	}
+
+	pthread_mutex_lock(&stream_lock);
+	if (num_streams < MOCK_MAX_STREAMS) {
+		stream_fds[num_streams++] = fd;
+		added = 1;
+	}
+	pthread_mutex_unlock(&stream_lock);
+	if (!added) {
+		return;
+	}
+
+	/* updates are written by other threads until the client closes */
+	while (recv(fd, buf, sizeof(buf), 0) > 0) {
+	}
+
+	pthread_mutex_lock(&stream_lock);
+	for (added = 0; added < num_streams; added++) {
+		if (stream_fds[added] == fd) {
+			stream_fds[added] = stream_fds[--num_streams];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&stream_lock);
+}
+
+static void serve_request(int fd, const char *method, const char *path,
+	const char *authorization, const char *body, int body_len)
+{
+	struct store_obj *obj = NULL;
+	char resp[128];
+	char *copy = NULL;
+	int copy_len = 0;
+	int err = 0;
+	int id = 0;
+
+	if (!strcmp(method, "POST") && !strcmp(path, "/wasp/r2/device/auth")) {
+		pthread_mutex_lock(&auth_lock);
+		auth_seq++;
+		auth_ids[auth_seq % MOCK_MAX_AUTH_IDS] = auth_seq * 2654435761u | 1;
+		auth_times[auth_seq % MOCK_MAX_AUTH_IDS] = time(NULL);
+		/* zero padded to the longest ID a WASP device issues */
+		snprintf(resp, sizeof(resp), "{\"id\":\"%0*u\"}", WASP_IF_AUTH_ID_LEN - 1,
+			auth_ids[auth_seq % MOCK_MAX_AUTH_IDS]);
+		pthread_mutex_unlock(&auth_lock);
+		respond_delay();
+		respond(fd, 200, resp, strlen(resp));
+		return;
+	}
+
+	if (!authorized(authorization)) {
+		respond(fd, 401, "", 0);
+		return;
+	}
+
+	if (!strcmp(method, "GET") && !strcmp(path, "/wasp/u2/objects")) {
+		serve_stream(fd);
+		return;
+	}
+
+	respond_delay();
+
+	if (!strcmp(method, "GET")) {
+		if (!strcmp(path, "/wasp/r2/objects")) {
+			respond(fd, 200, objects_dump, objects_len);
+		} else if (!strcmp(path, "/wasp/r2/schemas")) {
+			respond(fd, 200, schemas_dump, schemas_len);
+		} else if (!strncmp(path, "/wasp/r2/schemas/", 17)) {
+			const char *schema = NULL;
+			int schema_len = 0;
+			char schema_path[WASP_IF_PATH_LEN + 3];
+
+			snprintf(schema_path, sizeof(schema_path), "$.%s", &path[17]);
+			if (json_find(schemas_dump, schemas_len, schema_path, &schema, &schema_len)) {
+				respond(fd, 200, schema, schema_len);
+			} else {
+				respond(fd, 404, "", 0);
+			}
+		} else if (!strcmp(path, "/wasp/r2/device/info")) {
+			respond(fd, 200, device_info, strlen(device_info));
+		} else if (sscanf(path, "/wasp/r2/objects/%d", &id) == 1) {
+			/* copy under the lock, the object may be patched meanwhile */
+			object_store_read_lock(&store);
+			obj = store_index_find(&store.idx, id);
+			if (obj) {
+				copy = strdup(obj->json);
+				copy_len = obj->len;
+			}
+			object_store_read_unlock(&store);
+			if (copy) {
+				respond(fd, 200, copy, copy_len);
+				free(copy);
+			} else {
+				respond(fd, 404, "", 0);
+			}
+		} else {
+			respond(fd, 404, "", 0);
+		}
+		return;
+	}
+
+	if (!strcmp(method, "PATCH")) {
+		if (!strcmp(path, "/wasp/r2/objects")) {
+			if (json_foreach(body, body_len, patch_elem_cb, &err) < 0 || err) {
+				respond(fd, 400, "", 0);
+			} else {
+				respond(fd, 200, "", 0);
+			}
+		} else if (sscanf(path, "/wasp/r2/objects/%d", &id) == 1) {
+			if (!store_index_find(&store.idx, id)) {
+				respond(fd, 404, "", 0);
+			} else if (patch_object(id, body, body_len)) {
+				respond(fd, 400, "", 0);
+			} else {
+				respond(fd, 200, "", 0);
+			}
+		} else {
+			respond(fd, 404, "", 0);
+		}
+		return;
+	}
+
+	respond(fd, 400, "", 0);
+}
+
+/* value of a request header, "" if not present */
+static void get_header(const char *req, const char *name, char *val, size_t val_len)
+{
+	const char *p = req;
+	size_t name_len = strlen(name);
+	size_t n = 0;
+
+	val[0] = '\0';
+	while ((p = strstr(p, "\r\n")) != NULL) {
+		p += 2;
+		if (!strncasecmp(p, name, name_len) && p[name_len] == ':') {
+			p += name_len + 1;
+			p += strspn(p, " \t");
+			n = strcspn(p, "\r\n");
+			if (n >= val_len) {
+				n = val_len - 1;
+			}
+			memcpy(val, p, n);
+			val[n] = '\0';
+			return;
+		}
+	}
+}
+
+static void * connection_thread(void *args)
+{
+	char req[MOCK_REQ_LEN];
+	char method[WASP_IF_METHOD_LEN];
+	char path[WASP_IF_PATH_LEN];
+	char authorization[WASP_IF_AUTH_STR_LEN + 8];
+	char content_length[16];
+	char connection[16];
+	char *body = NULL;
+	const char *tok = NULL;
+	int tok_len = 0;
+	int fd = (int)(intptr_t)args;
+	int len = 0;
+	int hdr_len = 0;
+	int body_len = 0;
+	char save = 0;
+	ssize_t ret = 0;
+
+	/* requests one after the other, until the client closes or a request ends the connection */
+	do {
+		hdr_len = 0;
+		body_len = 0;
+
+		/* read the headers and the body, a previous read may have both */
+		while (1) {
+			req[len] = '\0';
+			if (!hdr_len && (body = strstr(req, "\r\n\r\n")) != NULL) {
+				body += 4;
+				hdr_len = body - req;
+				get_header(req, "Content-Length", content_length, sizeof(content_length));
+				body_len = atoi(content_length);
+				if (hdr_len + body_len > (int)sizeof(req) - 1) {
+					respond(fd, 400, "", 0);
+					goto done;
+				}
+			}
+			if (hdr_len && len >= hdr_len + body_len) {
+				break;
+			}
+
+			/* the body may be shorter than Content-Length, stop once it is complete JSON */
+			if (hdr_len && body_len && json_find(body, len - hdr_len, "$", &tok, &tok_len)) {
+				body_len = len - hdr_len;
+				break;
+			}
+
+			if (len == sizeof(req) - 1) {
+				goto done;
+			}
+			ret = recv(fd, &req[len], sizeof(req) - 1 - len, 0);
+			if (ret <= 0) {
+				goto done;
+			}
+			len += ret;
+		}
+
+		if (sscanf(req, "%15s %127s", method, path) != 2) {
+			respond(fd, 400, "", 0);
+			goto done;
+		}
+		get_header(req, "Authorization", authorization, sizeof(authorization));
+		get_header(req, "Connection", connection, sizeof(connection));
+		conn_keep_alive = opts.keep_alive && strcasecmp(connection, "close") &&
+			strcmp(path, "/wasp/u2/objects");
+
+		save = body[body_len];
+		body[body_len] = '\0';
+		serve_request(fd, method, path, authorization, body, strlen(body));
+		body[body_len] = save;
+
+		/* a pipelined request may follow */
+		len -= hdr_len + body_len;
+		memmove(req, &req[hdr_len + body_len], len);
+	} while (conn_keep_alive);
+
+done:
+	close(fd);
+
+	return NULL;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* write to every stream client, split into random pieces with -k */
+static void stream_write(const char *buf, size_t len)
+{
+	size_t pos = 0;
+	size_t n = 0;
+
+	if (opts.max_chunk <= 0) {
+		stream_broadcast(buf, len);
+		return;
+	}
+
+	while (pos < len) {
+		n = 1 + rand() % opts.max_chunk;
+		if (n > len - pos) {
+			n = len - pos;
+		}
+		stream_broadcast(&buf[pos], n);
+		pos += n;
+	}
+}
+
+/*
+ * One update event.  update:obj events set the level of a random block
+ * and carry the CLOCK_MONOTONIC send time in "_ts", so a client on the
+ * same host can measure the delivery latency.  update:group_prefix events
+ * carry the levels of group_meters meters, starting after the last group.
+ */
+static size_t stream_event(char *buf, size_t cap, unsigned int seq)
+{
+	static int next_meter = 0;
+	int meters = opts.group_meters > 0 && opts.group_meters < opts.dump.num_blocks ?
+		opts.group_meters : opts.dump.num_blocks;
+	int b = 0;
+	int i = 0;
+	int n = 0;
+
+	if ((int)(rand() % 100) < opts.obj_pct) {
+		b = rand() % opts.dump.num_blocks;
+		n = snprintf(buf, cap, "{\"_type\":\"update:obj\",\"path\":\"/objects/%d\","
+			"\"body\":{\"level\":%d,\"_ts\":%llu}}\n---\n",
+			MOCK_DUMP_BLOCK_ID(b) + 1, (int)(seq % 24), (unsigned long long)now_ns());
+		return n > 0 && (size_t)n < cap ? (size_t)n : 0;
+	}
+
+	n = snprintf(buf, cap, "{\"_type\":\"update:group_prefix\",\"prop\":\"level\",\"body\":{");
+	for (i = 0; i < meters && n > 0 && (size_t)n < cap; i++) {
+		b = (next_meter + i) % opts.dump.num_blocks;
+		n += snprintf(&buf[n], cap - n, "%s\"%d\":[%d,%d]", i ? "," : "",
+			MOCK_DUMP_BLOCK_ID(b) + 4, -(int)((seq + b) % 96), -(int)((seq + 2 * b) % 96));
+	}
+	next_meter = (next_meter + meters) % opts.dump.num_blocks;
+	if (n > 0 && (size_t)n < cap) {
+		n += snprintf(&buf[n], cap - n, "}}\n---\n");
+	}
+
+	return n > 0 && (size_t)n < cap ? (size_t)n : 0;
+}
+
+/* generates the update stream events at event_rate, or as fast as possible */
+static void * stream_thread(void *args)
+{
+	char *buf = NULL;
+	size_t cap = MOCK_STREAM_BATCH_LEN + 64 + opts.dump.num_blocks * 32;
+	size_t len = 0;
+	size_t n = 0;
+	uint64_t start = now_ns();
+	uint64_t report = start;
+	uint64_t due = 0;
+	uint64_t sent = 0;
+	uint64_t reported = 0;
+	unsigned int seq = 0;
+
+	(void)args;
+
+	buf = malloc(cap);
+	if (!buf) {
+		return NULL;
+	}
+
+	while (1) {
+		/* the rate applies from when the first client connects */
+		if (!num_streams) {
+			usleep(MOCK_STREAM_TICK_US);
+			start = report = now_ns();
+			sent = reported = 0;
+			continue;
+		}
+		if (!opts.flood) {
+			usleep(MOCK_STREAM_TICK_US);
+		}
+
+		/* batch the events due since the last tick, the batch is split arbitrarily by -k */
+		due = opts.flood ? sent + MOCK_STREAM_BATCH_LEN : (now_ns() - start) * opts.event_rate / 1000000000;
+		len = 0;
+		while (sent < due && len < MOCK_STREAM_BATCH_LEN) {
+			n = stream_event(&buf[len], cap - len, seq++);
+			if (!n) {
+				break;
+			}
+			len += n;
+			sent++;
+		}
+		if (len) {
+			stream_write(buf, len);
+		}
+
+		if (now_ns() - report >= 1000000000) {
+			printf("stream: %llu events/s to %d client(s)\n",
+				(unsigned long long)(sent - reported), num_streams);
+			fflush(stdout);
+			reported = sent;
+			report = now_ns();
+		}
+	}
+
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-p port] [-b blocks] [-S dump_bytes] [-l label_len] [-d delay_ms]\n"
+		"          [-j jitter_ms] [-a] [-e auth_expiry_s] [-m meter_rate]\n"
+		"          [-r event_rate | -F] [-x obj_pct] [-g group_meters] [-k max_chunk] [-K]\n"
+		"  -m  update:group_prefix events of all meters per second, same as -r rate -x 0\n"
+		"  -r  update stream events per second, -F as fast as the clients read\n"
+		"  -x  percentage of update:obj events in the stream (default 0)\n"
+		"  -g  meter levels per update:group_prefix event (default all)\n"
+		"  -k  split stream writes at random, 1 to max_chunk bytes each\n"
+		"  -K  keep connections open for further requests (HTTP/1.1 keep-alive)\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	struct store_index idx;
+	pthread_t thread_id;
+	size_t dump_size = 0;
+	int listen_fd = 0;
+	int fd = 0;
+	int one = 1;
+	int c = 0;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.port = 8080;
+	opts.dump.num_blocks = 16;
+
+	while ((c = getopt(argc, argv, "p:b:S:l:d:j:ae:m:r:Fx:g:k:Kh")) != -1) {
+		switch (c) {
+		case 'p': opts.port = atoi(optarg); break;
+		case 'b': opts.dump.num_blocks = atoi(optarg); break;
+		case 'S': dump_size = strtoul(optarg, NULL, 0); break;
+		case 'l': opts.dump.label_len = atoi(optarg); break;
+		case 'd': opts.delay_ms = atoi(optarg); break;
+		case 'j': opts.jitter_ms = atoi(optarg); break;
+		case 'a': opts.auth = 1; break;
+		case 'e': opts.auth_expiry_s = atoi(optarg); break;
+		case 'm': opts.event_rate = atoi(optarg); opts.obj_pct = 0; break;
+		case 'r': opts.event_rate = atoi(optarg); break;
+		case 'F': opts.flood = 1; break;
+		case 'x': opts.obj_pct = atoi(optarg); break;
+		case 'g': opts.group_meters = atoi(optarg); break;
+		case 'k': opts.max_chunk = atoi(optarg); break;
+		case 'K': opts.keep_alive = 1; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (dump_size) {
+		opts.dump.num_blocks = mock_dump_blocks_for_size(&opts.dump, dump_size);
+	}
+
+	objects_dump = mock_dump_objects(&opts.dump, &objects_len);
+	schemas_dump = mock_dump_schemas(&opts.dump, &schemas_len);
+	object_store_init(&store);
+	if (!objects_dump || !schemas_dump || object_store_parse(objects_dump, objects_len, &idx)) {
+		printf("error building the mock device objects\n");
+		return 1;
+	}
+	object_store_swap(&store, &idx);
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(opts.port);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listen_fd, 128)) {
+		printf("error listening on port %d: %s\n", opts.port, strerror(errno));
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (opts.event_rate > 0 || opts.flood) {
+		pthread_create(&thread_id, NULL, stream_thread, NULL);
+		pthread_detach(thread_id);
+	}
+
+	printf("mock WASP device on port %d: %d objects (%zu bytes), delay %d+%d ms, auth %s\n",
+		opts.port, opts.dump.num_blocks * MOCK_DUMP_OBJS_PER_BLOCK, objects_len,
+		opts.delay_ms, opts.jitter_ms, opts.auth ? "on" : "off");
+
+	while (1) {
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			printf("accept error: %s\n", strerror(errno));
+			break;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (pthread_create(&thread_id, NULL, connection_thread, (void *)(intptr_t)fd)) {
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread_id);
+	}
+
+	close(listen_fd);
+
+	return 0;
+}
@@ -0,0 +1,127 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "mock_dump.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+struct dump_buf {
+	char *s;
+	size_t len;
+	size_t cap;
+	int err;
+};
+
+static void dump_printf(struct dump_buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	char *tmp = NULL;
+	int n = 0;
+
+	if (b->err) {
+		return;
+	}
+
+	while (1) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->s ? &b->s[b->len] : NULL, b->s ? b->cap - b->len : 0, fmt, ap);
+		va_end(ap);
+		if (n < 0) {
+			b->err = 1;
+			return;
+		}
+		if (b->s && b->len + n < b->cap) {
+			b->len += n;
+			return;
+		}
+
+		b->cap = b->cap ? b->cap * 2 : 4096;
+		while (b->cap <= b->len + n) {
+			b->cap *= 2;
+		}
+		tmp = realloc(b->s, b->cap);
+		if (!tmp) {
+			free(b->s);
+			b->s = NULL;
+			b->err = 1;
+			return;
+		}
+		b->s = tmp;
+	}
+}
+
+static char * dump_done(struct dump_buf *b, size_t *len)
+{
+	if (b->err) {
+		return NULL;
+	}
+
+	*len = b->len;
+
+	return b->s;
+}
+
+char * mock_dump_objects(const struct mock_dump_cfg *cfg, size_t *len)
+{
+	struct dump_buf b = { NULL, 0, 0, 0 };
+	int label_len = cfg->label_len > 0 ? cfg->label_len : 8;
+	int id = 0;
+	int i = 0;
+
+	dump_printf(&b, "{");
+	for (i = 0; i < cfg->num_blocks; i++) {
+		id = MOCK_DUMP_BLOCK_ID(i);
+		dump_printf(&b, "%s\"%d\":{\"_id\":%d,\"_type\":\"block:io\",\"io_type\":\"analog\","
+			"\"io_dir\":\"in\",\"io_idx\":%d,\"label\":\"%0*d\"},",
+			i ? "," : "", id, id, i, label_len, i);
+		dump_printf(&b, "\"%d\":{\"_id\":%d,\"_type\":\"ctrl:trim_level\",\"_parent\":%d,"
+			"\"_schema\":\"level_schema_%d\",\"level\":%d},",
+			id + 1, id + 1, id, i % MOCK_DUMP_NUM_SCHEMAS, i % 24);
+		dump_printf(&b, "\"%d\":{\"_id\":%d,\"_type\":\"ctrl:mute\",\"_parent\":%d,\"active\":false},",
+			id + 2, id + 2, id);
+		dump_printf(&b, "\"%d\":{\"_id\":%d,\"_type\":\"ctrl:phantom\",\"_parent\":%d,\"active\":%s},",
+			id + 3, id + 3, id, i & 1 ? "true" : "false");
+		dump_printf(&b, "\"%d\":{\"_id\":%d,\"_type\":\"ctrl:meter\",\"_parent\":%d,\"level\":[-96,-96]}",
+			id + 4, id + 4, id);
+	}
+	dump_printf(&b, "}");
+
+	return dump_done(&b, len);
+}
+
+char * mock_dump_schemas(const struct mock_dump_cfg *cfg, size_t *len)
+{
+	struct dump_buf b = { NULL, 0, 0, 0 };
+	int i = 0;
+
+	(void)cfg;
+
+	dump_printf(&b, "{");
+	for (i = 0; i < MOCK_DUMP_NUM_SCHEMAS; i++) {
+		dump_printf(&b, "%s\"level_schema_%d\":{\"type\":\"object\",\"properties\":{\"level\":"
+			"{\"type\":\"integer\",\"minimum\":%d,\"maximum\":%d,\"wasp-unit\":\"dBu\"}}}",
+			i ? "," : "", i, -10 - i, 24 + i);
+	}
+	dump_printf(&b, "}");
+
+	return dump_done(&b, len);
+}
+
+int mock_dump_blocks_for_size(const struct mock_dump_cfg *cfg, size_t size)
+{
+	struct mock_dump_cfg one = *cfg;
+	size_t len = 0;
+	char *s = NULL;
+
+	one.num_blocks = 1;
+	s = mock_dump_objects(&one, &len);
+	free(s);
+	if (!s || !len) {
+		return 1;
+	}
+
+	return size / len > 0 ? (int)(size / len) : 1;
+}
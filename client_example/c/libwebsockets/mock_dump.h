@@ -0,0 +1,50 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _MOCK_DUMP_H
+#define _MOCK_DUMP_H
+
+#include <stdlib.h>
+
+/*
+ * Synthetic WASP device contents for the mock device and the benchmarks.
+ * The device has num_blocks analog input blocks, each with a level, mute,
+ * phantom power and meter control:
+ *
+ *   block b        _id MOCK_DUMP_BLOCK_ID(b), "block:io" analog in, io_idx b
+ *   level          _id MOCK_DUMP_BLOCK_ID(b) + 1, "ctrl:trim_level"
+ *   mute           _id MOCK_DUMP_BLOCK_ID(b) + 2, "ctrl:mute"
+ *   phantom power  _id MOCK_DUMP_BLOCK_ID(b) + 3, "ctrl:phantom"
+ *   meter          _id MOCK_DUMP_BLOCK_ID(b) + 4, "ctrl:meter"
+ */
+#define MOCK_DUMP_OBJS_PER_BLOCK 5
+#define MOCK_DUMP_BLOCK_ID(b) (1 + (b) * MOCK_DUMP_OBJS_PER_BLOCK)
+#define MOCK_DUMP_NUM_SCHEMAS 4
+
+struct mock_dump_cfg {
+	int num_blocks;        /* analog input blocks */
+	int label_len;         /* length of each block label, to pad the dump size */
+};
+
+/**
+ * Build the /wasp/r2/objects dump.
+ *
+ * /returns a NUL terminated string to free(), NULL on allocation failure.
+ */
+char * mock_dump_objects(const struct mock_dump_cfg *cfg, size_t *len);
+
+/**
+ * Build the /wasp/r2/schemas document.
+ *
+ * /returns a NUL terminated string to free(), NULL on allocation failure.
+ */
+char * mock_dump_schemas(const struct mock_dump_cfg *cfg, size_t *len);
+
+/**
+ * Number of blocks giving a dump of about the given size in bytes.
+ */
+int mock_dump_blocks_for_size(const struct mock_dump_cfg *cfg, size_t size);
+
+#endif /* _MOCK_DUMP_H */
@@ -0,0 +1,466 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "object_store.h"
+#include "wasp_interface.h"
+#include "json_index.h"
+#include <stdio.h>
+#include <string.h>
+
+struct parse_data {
+	struct store_index *idx;
+	const struct json_index *ix;   /* of the dump */
+	int size;
+	int err;
+};
+
+static int cmp_key(const void *a, const void *b)
+{
+	int x = ((const struct store_key *)a)->id;
+	int y = ((const struct store_key *)b)->id;
+
+	return (x > y) - (x < y);
+}
+
+/* _id of an object of the dump, -1 if none */
+static int object_id(const struct json_index *ix, const char *s, const struct json_elem *e)
+{
+	struct json_elem id;
+	double num = 0;
+
+	if (e->vtype != '{' || !json_index_find(ix, s, e->at, "_id", 3, &id) ||
+	    !json_index_get_number(s, &id, &num)) {
+		return -1;
+	}
+
+	return (int)num;
+}
+
+/* copy one object of the dump to the index */
+static int add_obj(struct parse_data *d, const char *s, int voff, int vlen, uint64_t hash, int id)
+{
+	struct store_index *idx = d->idx;
+	struct store_obj *obj = NULL;
+	struct store_obj *tmp = NULL;
+
+	if (idx->num_objs == d->size) {
+		d->size = d->size ? d->size * 2 : 256;
+		tmp = realloc(idx->objs, d->size * sizeof(*idx->objs));
+		if (!tmp) {
+			d->err = 1;
+			return 1;
+		}
+		idx->objs = tmp;
+	}
+
+	obj = &idx->objs[idx->num_objs];
+	obj->json = malloc(vlen + 1);
+	if (!obj->json) {
+		d->err = 1;
+		return 1;
+	}
+	memcpy(obj->json, &s[voff], vlen);
+	obj->json[vlen] = '\0';
+	obj->len = vlen;
+	obj->cap = vlen + 1;
+	obj->hash = hash;
+	obj->id = id;
+	idx->num_objs++;
+
+	return 0;
+}
+
+static int parse_cb(const char *s, const struct json_elem *e, void *ud)
+{
+	struct parse_data *d = (struct parse_data *)ud;
+
+	return add_obj(d, s, e->voff, e->vlen, store_hash(&s[e->voff], e->vlen), object_id(d->ix, s, e));
+}
+
+void object_store_init(struct object_store *st)
+{
+	memset(st, 0, sizeof(*st));
+	pthread_rwlock_init(&st->lock, NULL);
+}
+
+int object_store_append(struct object_store *st, size_t pos, const char *buf, size_t len)
+{
+	size_t cap = st->raw_cap;
+	char *tmp = NULL;
+
+	if (pos + len + 1 > cap) {
+		cap = cap ? cap : 65536;
+		while (pos + len + 1 > cap) {
+			cap *= 2;
+		}
+		tmp = realloc(st->raw, cap);
+		if (!tmp) {
+			return -1;
+		}
+		st->raw = tmp;
+		st->raw_cap = cap;
+	}
+
+	memcpy(&st->raw[pos], buf, len);
+	st->raw_len = pos + len;
+	st->raw[st->raw_len] = '\0';
+
+	return 0;
+}
+
+int object_store_parse(const char *s, size_t len, struct store_index *idx)
+{
+	struct json_index ix;
+	struct parse_data d = { idx, &ix, 0, 0 };
+	int i = 0;
+
+	memset(idx, 0, sizeof(*idx));
+	json_index_init(&ix);
+
+	if (json_index_build(&ix, s, len) || json_index_foreach(&ix, s, 0, parse_cb, &d) < 0 || d.err) {
+		json_index_free(&ix);
+		store_index_free(idx);
+		return -1;
+	}
+	json_index_free(&ix);
+
+	idx->keys = malloc((idx->num_objs ? idx->num_objs : 1) * sizeof(*idx->keys));
+	if (!idx->keys) {
+		store_index_free(idx);
+		return -1;
+	}
+
+	for (i = 0; i < idx->num_objs; i++) {
+		idx->keys[i].id = idx->objs[i].id;
+		idx->keys[i].pos = i;
+	}
+	qsort(idx->keys, idx->num_objs, sizeof(*idx->keys), cmp_key);
+
+	return 0;
+}
+
+void object_store_swap(struct object_store *st, struct store_index *idx)
+{
+	struct store_index old;
+
+	pthread_rwlock_wrlock(&st->lock);
+	old = st->idx;
+	st->idx = *idx;
+	pthread_rwlock_unlock(&st->lock);
+
+	*idx = old;
+}
+
+/* make room for len bytes of text, with room for a longer value next time */
+static int reserve(struct store_obj *obj, int len)
+{
+	char *tmp = NULL;
+
+	if (len + 1 <= obj->cap) {
+		return 0;
+	}
+	tmp = realloc(obj->json, len + 1 + 32);
+	if (!tmp) {
+		return -1;
+	}
+	obj->json = tmp;
+	obj->cap = len + 1 + 32;
+
+	return 0;
+}
+
+int object_store_set_prop(struct object_store *st, int id,
+	const char *prop, int prop_len, const char *val, int val_len)
+{
+	struct json_path path;
+	struct store_obj *obj = NULL;
+	const char *tok = NULL;
+	const char *end = NULL;
+	int toklen = 0;
+	int empty = 0;
+	int pos = 0;
+	int len = 0;
+
+	/* compiled before the write lock is taken */
+	if (prop_len > WASP_IF_OBJ_PROP_LEN || json_path_compile(&path, prop, prop_len)) {
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&st->lock);
+
+	obj = store_index_find(&st->idx, id);
+	if (!obj) {
+		pthread_rwlock_unlock(&st->lock);
+		return -1;
+	}
+
+	if (json_path_find(&path, obj->json, obj->len, &tok, &toklen)) {
+		/* replace the value in place, the rest of the object moves only if its length changes */
+		pos = tok - obj->json;
+		len = obj->len - toklen + val_len;
+		if (reserve(obj, len)) {
+			pthread_rwlock_unlock(&st->lock);
+			return -1;
+		}
+		if (val_len != toklen) {
+			memmove(&obj->json[pos + val_len], &obj->json[pos + toklen], obj->len - pos - toklen + 1);
+		}
+		memcpy(&obj->json[pos], val, val_len);
+	} else {
+		/* add the property before the closing brace */
+		end = strrchr(obj->json, '}');
+		if (!end) {
+			pthread_rwlock_unlock(&st->lock);
+			return -1;
+		}
+		pos = end - obj->json;
+		empty = strspn(obj->json + 1, " \t\r\n") == (size_t)(pos - 1);
+		len = pos + !empty + prop_len + 3 + val_len + 1;
+		if (reserve(obj, len)) {
+			pthread_rwlock_unlock(&st->lock);
+			return -1;
+		}
+		pos += sprintf(&obj->json[pos], "%s\"%.*s\":", empty ? "" : ",", prop_len, prop);
+		memcpy(&obj->json[pos], val, val_len);
+		pos += val_len;
+		obj->json[pos++] = '}';
+	}
+
+	obj->json[len] = '\0';
+	obj->len = len;
+	obj->hash = 0;
+
+	pthread_rwlock_unlock(&st->lock);
+
+	return 0;
+}
+
+/* what object_store_resync() did with each previously stored object */
+enum prev_use {
+	PREV_REMOVED,          /* not in the new dump, freed */
+	PREV_KEPT,             /* unchanged, moved to the new index */
+	PREV_CHANGED           /* replaced, text handed to the delta */
+};
+
+struct resync_data {
+	struct parse_data pd;
+	const struct store_index *prev;
+	unsigned char *prev_use;
+	struct store_delta *delta;
+	int changes_size;
+};
+
+static int resync_cb(const char *s, const struct json_elem *e, void *ud)
+{
+	struct resync_data *d = (struct resync_data *)ud;
+	struct store_index *idx = d->pd.idx;
+	struct store_delta *delta = d->delta;
+	struct store_change *change = NULL;
+	struct store_obj *prev_obj = NULL;
+	struct store_obj *obj = NULL;
+	void *tmp = NULL;
+	uint64_t hash = store_hash(&s[e->voff], e->vlen);
+	int id = object_id(d->pd.ix, s, e);
+
+	prev_obj = id != -1 ? store_index_find(d->prev, id) : NULL;
+	if (prev_obj && d->prev_use[prev_obj - d->prev->objs] != PREV_REMOVED) {
+		/* duplicate ID, keep the first */
+		prev_obj = NULL;
+	}
+
+	/* patched by an update since it was hashed */
+	if (prev_obj && !prev_obj->hash) {
+		prev_obj->hash = store_hash(prev_obj->json, prev_obj->len);
+	}
+
+	if (prev_obj && prev_obj->hash == hash && prev_obj->len == e->vlen) {
+		/* unchanged - move the stored copy to the new index */
+		if (idx->num_objs == d->pd.size) {
+			d->pd.size = d->pd.size ? d->pd.size * 2 : 256;
+			tmp = realloc(idx->objs, d->pd.size * sizeof(*idx->objs));
+			if (!tmp) {
+				d->pd.err = 1;
+				return 1;
+			}
+			idx->objs = tmp;
+		}
+		idx->objs[idx->num_objs++] = *prev_obj;
+		d->prev_use[prev_obj - d->prev->objs] = PREV_KEPT;
+		delta->num_unchanged++;
+		return 0;
+	}
+
+	if (delta->num_changes == d->changes_size) {
+		d->changes_size = d->changes_size ? d->changes_size * 2 : 64;
+		tmp = realloc(delta->changes, d->changes_size * sizeof(*delta->changes));
+		if (!tmp) {
+			d->pd.err = 1;
+			return 1;
+		}
+		delta->changes = tmp;
+	}
+
+	/* added or changed - copy the new text */
+	if (add_obj(&d->pd, s, e->voff, e->vlen, hash, id)) {
+		return 1;
+	}
+
+	obj = &idx->objs[idx->num_objs - 1];
+	change = &delta->changes[delta->num_changes++];
+	change->pos = obj - idx->objs;
+	change->old_json = NULL;
+	change->old_len = 0;
+	if (prev_obj) {
+		change->old_json = prev_obj->json;
+		change->old_len = prev_obj->len;
+		d->prev_use[prev_obj - d->prev->objs] = PREV_CHANGED;
+	}
+
+	return 0;
+}
+
+int object_store_resync(struct object_store *st, struct store_delta *delta)
+{
+	struct store_index idx;
+	struct json_index ix;
+	struct resync_data d;
+	int i = 0;
+
+	memset(delta, 0, sizeof(*delta));
+	memset(&idx, 0, sizeof(idx));
+	memset(&d, 0, sizeof(d));
+	json_index_init(&ix);
+	d.pd.idx = &idx;
+	d.pd.ix = &ix;
+	d.prev = &st->idx;
+	d.delta = delta;
+
+	/* the HTTP client thread is the only writer, so st->idx is read unlocked */
+	d.prev_use = calloc(st->idx.num_objs ? st->idx.num_objs : 1, 1);
+	if (!d.prev_use) {
+		return -1;
+	}
+
+	if (!st->raw || json_index_build(&ix, st->raw, st->raw_len) ||
+	    json_index_foreach(&ix, st->raw, 0, resync_cb, &d) < 0 || d.pd.err) {
+		goto error;
+	}
+	json_index_free(&ix);
+
+	idx.keys = malloc((idx.num_objs ? idx.num_objs : 1) * sizeof(*idx.keys));
+	if (!idx.keys) {
+		goto error;
+	}
+	for (i = 0; i < idx.num_objs; i++) {
+		idx.keys[i].id = idx.objs[i].id;
+		idx.keys[i].pos = i;
+	}
+	qsort(idx.keys, idx.num_objs, sizeof(*idx.keys), cmp_key);
+
+	/* idx now holds the previous index */
+	object_store_swap(st, &idx);
+
+	for (i = 0; i < idx.num_objs; i++) {
+		if (d.prev_use[i] == PREV_REMOVED) {
+			free(idx.objs[i].json);
+			delta->num_removed++;
+		}
+	}
+	free(idx.objs);
+	free(idx.keys);
+	free(d.prev_use);
+
+	return 0;
+
+error:
+	/* free only the copies made for the new index */
+	for (i = 0; i < delta->num_changes; i++) {
+		free(idx.objs[delta->changes[i].pos].json);
+	}
+	free(idx.objs);
+	free(idx.keys);
+	free(delta->changes);
+	memset(delta, 0, sizeof(*delta));
+	free(d.prev_use);
+	json_index_free(&ix);
+
+	return -1;
+}
+
+void store_delta_free(struct store_delta *delta)
+{
+	int i = 0;
+
+	for (i = 0; i < delta->num_changes; i++) {
+		free(delta->changes[i].old_json);
+	}
+	free(delta->changes);
+	memset(delta, 0, sizeof(*delta));
+}
+
+uint64_t store_hash(const char *s, int len)
+{
+	uint64_t h = 14695981039346656037ULL;
+	int i = 0;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+void object_store_read_lock(struct object_store *st)
+{
+	pthread_rwlock_rdlock(&st->lock);
+}
+
+void object_store_read_unlock(struct object_store *st)
+{
+	pthread_rwlock_unlock(&st->lock);
+}
+
+size_t object_store_memory(struct object_store *st, int *num_objs)
+{
+	size_t bytes = 0;
+	int i = 0;
+
+	pthread_rwlock_rdlock(&st->lock);
+	bytes = st->idx.num_objs * (sizeof(*st->idx.objs) + sizeof(*st->idx.keys));
+	for (i = 0; i < st->idx.num_objs; i++) {
+		bytes += st->idx.objs[i].cap;
+	}
+	*num_objs = st->idx.num_objs;
+	pthread_rwlock_unlock(&st->lock);
+
+	return bytes;
+}
+
+struct store_obj * store_index_find(const struct store_index *idx, int id)
+{
+	struct store_key key = { id, 0 };
+	struct store_key *found = NULL;
+
+	if (!idx->num_objs) {
+		return NULL;
+	}
+
+	found = bsearch(&key, idx->keys, idx->num_objs, sizeof(*idx->keys), cmp_key);
+
+	return found ? &idx->objs[found->pos] : NULL;
+}
+
+void store_index_free(struct store_index *idx)
+{
+	int i = 0;
+
+	for (i = 0; i < idx->num_objs; i++) {
+		free(idx->objs[i].json);
+	}
+	free(idx->objs);
+	free(idx->keys);
+	memset(idx, 0, sizeof(*idx));
+}
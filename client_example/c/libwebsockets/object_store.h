@@ -0,0 +1,134 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _OBJECT_STORE_H
+#define _OBJECT_STORE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+struct store_obj {
+	int id;                /* _id of the object, -1 if none */
+	int len;
+	int cap;               /* size of the json allocation */
+	uint64_t hash;         /* of the object text, see store_hash(), 0 once patched by
+	                          object_store_set_prop() until the next resync */
+	char *json;            /* NUL terminated copy of the object */
+};
+
+struct store_key {
+	int id;
+	int pos;               /* position in store_index.objs */
+};
+
+/* the objects of a /wasp/r2/objects dump, in download order */
+struct store_index {
+	struct store_obj *objs;
+	int num_objs;
+	struct store_key *keys; /* sorted by ID */
+};
+
+/*
+ * Stored objects of one device.  The index is read by application threads
+ * and patched by the HTTP client thread, so it is guarded by a rwlock.
+ */
+struct object_store {
+	pthread_rwlock_t lock;
+	struct store_index idx;
+	char *raw;             /* response being reassembled, HTTP client thread only */
+	size_t raw_len;
+	size_t raw_cap;
+};
+
+void object_store_init(struct object_store *st);
+
+/**
+ * Copy a fragment of the /wasp/r2/objects response into the reassembly
+ * buffer.  A fragment at position 0 starts a new response.
+ *
+ * /returns nonzero on allocation failure.
+ */
+int object_store_append(struct object_store *st, size_t pos, const char *buf, size_t len);
+
+/**
+ * Split a /wasp/r2/objects dump into an index of objects.
+ *
+ * /returns nonzero on invalid input or allocation failure.
+ */
+int object_store_parse(const char *s, size_t len, struct store_index *idx);
+
+/**
+ * Replace the stored index with idx; idx receives the previous index,
+ * which the caller frees with store_index_free().
+ */
+void object_store_swap(struct object_store *st, struct store_index *idx);
+
+/**
+ * Replace (or add) one property value of a stored object, in place when
+ * the object's buffer has room.  The object's hash is recomputed by the
+ * next object_store_resync() rather than on every update.
+ *
+ * /returns nonzero if the object is not stored or on allocation failure.
+ */
+int object_store_set_prop(struct object_store *st, int id,
+	const char *prop, int prop_len, const char *val, int val_len);
+
+void object_store_read_lock(struct object_store *st);
+void object_store_read_unlock(struct object_store *st);
+
+/**
+ * Memory held by the stored objects, not counting the reassembly buffer
+ * owned by the HTTP client thread.
+ *
+ * /param st - the store
+ * /param num_objs - receives the number of stored objects
+ *
+ * /returns the size in bytes.
+ */
+size_t object_store_memory(struct object_store *st, int *num_objs);
+
+/**
+ * Look up an object by ID.
+ *
+ * /returns NULL if not found.
+ */
+struct store_obj * store_index_find(const struct store_index *idx, int id);
+
+void store_index_free(struct store_index *idx);
+
+/* an object added or changed by object_store_resync() */
+struct store_change {
+	int pos;               /* position in the new store_index.objs */
+	char *old_json;        /* previous text of the object, NULL if added */
+	int old_len;
+};
+
+/* the differences found by object_store_resync() */
+struct store_delta {
+	struct store_change *changes;
+	int num_changes;
+	int num_unchanged;
+	int num_removed;
+};
+
+/**
+ * Replace the stored index with the reassembled /wasp/r2/objects dump,
+ * keeping the stored copy of each object whose text is unchanged (same
+ * hash and length).  Only added and changed objects are copied; they are
+ * listed in delta along with their previous text.  Must be called on the
+ * thread that modifies the store.
+ *
+ * /returns nonzero on invalid input or allocation failure, the stored
+ * index is unchanged in that case.
+ */
+int object_store_resync(struct object_store *st, struct store_delta *delta);
+
+void store_delta_free(struct store_delta *delta);
+
+/* 64 bit FNV-1a hash of an object's text */
+uint64_t store_hash(const char *s, int len);
+
+#endif /* _OBJECT_STORE_H */
@@ -0,0 +1,153 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "schema_store.h"
+#include "wasp_interface.h"
+#include <stdio.h>
+#include <string.h>
+
+void schema_store_init(struct schema_store *st)
+{
+	memset(st, 0, sizeof(*st));
+	pthread_rwlock_init(&st->lock, NULL);
+}
+
+int schema_store_append(struct schema_store *st, size_t pos, const char *buf, size_t len)
+{
+	size_t cap = st->raw_cap;
+	char *tmp = NULL;
+
+	if (pos + len + 1 > cap) {
+		cap = cap ? cap : 4096;
+		while (pos + len + 1 > cap) {
+			cap *= 2;
+		}
+		tmp = realloc(st->raw, cap);
+		if (!tmp) {
+			return -1;
+		}
+		st->raw = tmp;
+		st->raw_cap = cap;
+	}
+
+	memcpy(&st->raw[pos], buf, len);
+	st->raw[pos + len] = '\0';
+	st->raw_len = pos + len;
+
+	return 0;
+}
+
+int schema_store_done(struct schema_store *st, const char *id)
+{
+	struct schema_entry *tmp = NULL;
+	struct schema_entry *e = NULL;
+	char *json = NULL;
+	int i = 0;
+
+	if (!st->raw) {
+		return -1;
+	}
+
+	/* the stored copy is trimmed to size, the reassembly buffer is reused */
+	json = malloc(st->raw_len + 1);
+	if (!json) {
+		return -1;
+	}
+	memcpy(json, st->raw, st->raw_len + 1);
+
+	pthread_rwlock_wrlock(&st->lock);
+	if (!id) {
+		free(st->all);
+		st->all = json;
+		st->all_len = st->raw_len;
+		pthread_rwlock_unlock(&st->lock);
+		return 0;
+	}
+
+	for (i = 0; i < st->num_entries; i++) {
+		if (!strcmp(st->entries[i].id, id)) {
+			e = &st->entries[i];
+			break;
+		}
+	}
+
+	if (!e) {
+		tmp = realloc(st->entries, (st->num_entries + 1) * sizeof(*st->entries));
+		if (!tmp) {
+			pthread_rwlock_unlock(&st->lock);
+			free(json);
+			return -1;
+		}
+		st->entries = tmp;
+		e = &st->entries[st->num_entries];
+		e->id = strdup(id);
+		if (!e->id) {
+			pthread_rwlock_unlock(&st->lock);
+			free(json);
+			return -1;
+		}
+		e->json = NULL;
+		st->num_entries++;
+	}
+
+	free(e->json);
+	e->json = json;
+	e->len = st->raw_len;
+	pthread_rwlock_unlock(&st->lock);
+
+	return 0;
+}
+
+int schema_store_find(const struct schema_store *st, const char *id, const char **json, int *len)
+{
+	char path[WASP_IF_OBJ_PROP_LEN + 3];
+	int i = 0;
+
+	for (i = 0; i < st->num_entries; i++) {
+		if (!strcmp(st->entries[i].id, id)) {
+			*json = st->entries[i].json;
+			*len = st->entries[i].len;
+			return 0;
+		}
+	}
+
+	if (st->all) {
+		snprintf(path, sizeof(path), "$.%s", id);
+		/* json_find() returns the token type, '{' for an object */
+		if (json_find(st->all, st->all_len, path, json, len) == '{') {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+void schema_store_read_lock(struct schema_store *st)
+{
+	pthread_rwlock_rdlock(&st->lock);
+}
+
+void schema_store_read_unlock(struct schema_store *st)
+{
+	pthread_rwlock_unlock(&st->lock);
+}
+
+size_t schema_store_memory(struct schema_store *st)
+{
+	size_t bytes = 0;
+	int i = 0;
+
+	pthread_rwlock_rdlock(&st->lock);
+	if (st->all) {
+		bytes += st->all_len + 1;
+	}
+	bytes += st->num_entries * sizeof(*st->entries);
+	for (i = 0; i < st->num_entries; i++) {
+		bytes += strlen(st->entries[i].id) + 1 + st->entries[i].len + 1;
+	}
+	pthread_rwlock_unlock(&st->lock);
+
+	return bytes;
+}
@@ -0,0 +1,67 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _SCHEMA_STORE_H
+#define _SCHEMA_STORE_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/* one schema read from /wasp/r2/schemas/<id> */
+struct schema_entry {
+	char *id;
+	char *json;            /* NUL terminated schema object */
+	int len;
+};
+
+/*
+ * Stored schemas of one device - either the whole /wasp/r2/schemas document,
+ * or (lazy loading) only the schemas that have been looked up.  Read by
+ * application threads and written by the HTTP client thread.
+ */
+struct schema_store {
+	pthread_rwlock_t lock;
+	char *all;             /* /wasp/r2/schemas document, NULL if not read */
+	int all_len;
+	struct schema_entry *entries;
+	int num_entries;
+	char *raw;             /* response being reassembled, HTTP client thread only */
+	size_t raw_len;
+	size_t raw_cap;
+};
+
+void schema_store_init(struct schema_store *st);
+
+/**
+ * Copy a fragment of a /wasp/r2/schemas response into the reassembly
+ * buffer.  A fragment at position 0 starts a new response.
+ *
+ * /returns nonzero on allocation failure.
+ */
+int schema_store_append(struct schema_store *st, size_t pos, const char *buf, size_t len);
+
+/**
+ * Store the reassembled response as the whole schemas document, or as
+ * the schema with the given ID if id is not NULL.
+ *
+ * /returns nonzero on allocation failure.
+ */
+int schema_store_done(struct schema_store *st, const char *id);
+
+/**
+ * Look up a schema by ID.  The caller holds the read lock while using
+ * the returned schema.
+ *
+ * /returns nonzero if not found.
+ */
+int schema_store_find(const struct schema_store *st, const char *id, const char **json, int *len);
+
+void schema_store_read_lock(struct schema_store *st);
+void schema_store_read_unlock(struct schema_store *st);
+
+/* memory held by the stored schemas, not counting the reassembly buffer */
+size_t schema_store_memory(struct schema_store *st);
+
+#endif /* _SCHEMA_STORE_H */
@@ -0,0 +1,130 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "trace_ring.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define DUMP_CHUNK 64
+
+static _Thread_local uint32_t thread_id = 0;
+
+int trace_ring_init(struct trace_ring *ring, size_t capacity)
+{
+	size_t size = 1;
+
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	ring->slots = calloc(size, sizeof(*ring->slots));
+	if (!ring->slots) {
+		return -1;
+	}
+	ring->mask = size - 1;
+	atomic_init(&ring->head, 0);
+
+	return 0;
+}
+
+void trace_ring_record(struct trace_ring *ring, enum trace_type type, int dev, int32_t a, int32_t b)
+{
+	struct trace_slot *slot = NULL;
+	struct timespec ts;
+	unsigned long long seq = 0;
+
+	if (!ring->slots) {
+		return;
+	}
+
+	if (!thread_id) {
+		thread_id = (uint32_t)syscall(SYS_gettid);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	seq = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+	slot = &ring->slots[seq & ring->mask];
+
+	/* odd while the event is written, a dump skips the slot */
+	atomic_store_explicit(&slot->seq, ((seq + 1) << 1) | 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->ev.ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	slot->ev.tid = thread_id;
+	slot->ev.type = (uint16_t)type;
+	slot->ev.dev = (int16_t)dev;
+	slot->ev.a = a;
+	slot->ev.b = b;
+	atomic_store_explicit(&slot->seq, (seq + 1) << 1, memory_order_release);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n = 0;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int trace_ring_dump(struct trace_ring *ring, int fd)
+{
+	struct trace_event chunk[DUMP_CHUNK];
+	struct trace_file_header hdr;
+	struct trace_slot *slot = NULL;
+	struct timespec mono;
+	struct timespec real;
+	unsigned long long head = 0;
+	unsigned long long start = 0;
+	unsigned long long seq = 0;
+	unsigned long long s = 0;
+	int n = 0;
+
+	head = ring->slots ? atomic_load_explicit(&ring->head, memory_order_acquire) : 0;
+	start = head > ring->mask + 1 ? head - (ring->mask + 1) : 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_FILE_MAGIC, sizeof(hdr.magic));
+	hdr.event_size = sizeof(struct trace_event);
+	hdr.num_events = head - start;
+	hdr.lost_events = start;
+	hdr.realtime_offset_ns = ((int64_t)real.tv_sec - mono.tv_sec) * 1000000000ll +
+		(real.tv_nsec - mono.tv_nsec);
+	if (write_all(fd, &hdr, sizeof(hdr))) {
+		return -1;
+	}
+
+	for (s = start; s < head; s++) {
+		slot = &ring->slots[s & ring->mask];
+
+		/* copy the event, then check it was not rewritten meanwhile */
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		chunk[n] = slot->ev;
+		atomic_thread_fence(memory_order_acquire);
+		if (seq != (s + 1) << 1 || atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+			memset(&chunk[n], 0, sizeof(chunk[n]));
+		}
+
+		if (++n == DUMP_CHUNK) {
+			if (write_all(fd, chunk, sizeof(chunk))) {
+				return -1;
+			}
+			n = 0;
+		}
+	}
+
+	return n ? write_all(fd, chunk, n * sizeof(chunk[0])) : 0;
+}
@@ -0,0 +1,94 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _TRACE_RING_H
+#define _TRACE_RING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Flight recorder: a fixed-size ring of binary trace events that any
+ * thread can write without locks.  When the ring is full the oldest events
+ * are overwritten.  Each slot carries the sequence number of the event in
+ * it, so a dump blanks out slots being written or overwritten meanwhile.
+ */
+
+enum trace_type {
+	TRACE_NONE,            /* in a dump, an event overwritten while it was copied */
+	TRACE_REQ_SUBMIT,      /* a = WASP_IF_METHOD_*, b = object ID of the path or -1 */
+	TRACE_REQ_SEND,        /* a = WASP_IF_METHOD_*, b = object ID of the path or -1 */
+	TRACE_REQ_COMPLETE,    /* a = HTTP status or -1, b = submit to complete in us */
+	TRACE_CALLBACK,        /* a = lws callback reason, b = length */
+	TRACE_STREAM_READ,     /* a = bytes read, b = bytes of an incomplete event buffered */
+	TRACE_STREAM_EVENT,    /* a = WASP_IF_EVENT_*, b = event length */
+	TRACE_STREAM_UP,       /* a = HTTP status */
+	TRACE_STREAM_CLOSED,   /* a = 1 if reconnecting at once to apply new options */
+	TRACE_STREAM_RECONNECT, /* a = delay in ms, b = attempts since the stream was last up */
+	TRACE_AUTH_START,
+	TRACE_AUTH_DONE,       /* a = HTTP status */
+	TRACE_NUM_TYPES
+};
+
+/* one event, as stored and as written to a dump */
+struct trace_event {
+	uint64_t ts_ns;        /* CLOCK_MONOTONIC */
+	uint32_t tid;          /* thread ID of the writer */
+	uint16_t type;         /* enum trace_type */
+	int16_t dev;           /* device index, -1 if none */
+	int32_t a;
+	int32_t b;
+};
+
+struct trace_slot {
+	atomic_ullong seq;     /* (sequence + 1) * 2 once written, odd while being written */
+	struct trace_event ev;
+};
+
+struct trace_ring {
+	struct trace_slot *slots;
+	size_t mask;
+	atomic_ullong head;    /* sequence of the next event */
+};
+
+/*
+ * Dump file: a struct trace_file_header followed by num_events
+ * struct trace_event, oldest first.
+ */
+#define TRACE_FILE_MAGIC "WASPTRC1"
+
+struct trace_file_header {
+	char magic[8];
+	uint32_t event_size;   /* sizeof(struct trace_event) */
+	uint32_t reserved;
+	uint64_t num_events;
+	uint64_t lost_events;  /* overwritten before the dump */
+	int64_t realtime_offset_ns; /* CLOCK_REALTIME - CLOCK_MONOTONIC at the dump */
+};
+
+/**
+ * Allocate the ring.
+ *
+ * /param ring - the ring to initialize
+ * /param capacity - number of events, rounded up to a power of two
+ *
+ * /returns nonzero on allocation failure.
+ */
+int trace_ring_init(struct trace_ring *ring, size_t capacity);
+
+/* record one event, does nothing if the ring was not allocated */
+void trace_ring_record(struct trace_ring *ring, enum trace_type type, int dev, int32_t a, int32_t b);
+
+/**
+ * Write the events in the ring to a file descriptor in the dump file
+ * format.  Only uses async-signal-safe calls, so it can be called from a
+ * signal handler.
+ *
+ * /returns nonzero on write error.
+ */
+int trace_ring_dump(struct trace_ring *ring, int fd);
+
+#endif /* _TRACE_RING_H */
@@ -0,0 +1,273 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#include "update_queue.h"
+#include <string.h>
+
+static uint64_t fnv1a(uint64_t h, const char *s, size_t len)
+{
+	size_t i = 0;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+/* key of an update body {"prop":value} is the address, path and property */
+static uint64_t update_key(const char *ipv4_address, const char *path, const char *update_body)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	const char *prop = strchr(update_body, '"');
+	const char *prop_end = prop ? strchr(prop + 1, '"') : NULL;
+
+	h = fnv1a(h, ipv4_address, strlen(ipv4_address) + 1);
+	h = fnv1a(h, path, strlen(path) + 1);
+	if (prop && prop_end) {
+		h = fnv1a(h, prop, prop_end - prop);
+	}
+
+	return h;
+}
+
+static struct update_entry * entry_at(struct update_queue *q, uint64_t seq)
+{
+	return &q->entries[seq & q->mask];
+}
+
+static int same_key(const struct update_entry *e, uint64_t key,
+	const char *ipv4_address, const char *path, const char *update_body)
+{
+	const char *prop = strchr(update_body, '"');
+	const char *prop_end = prop ? strchr(prop + 1, '"') : NULL;
+	size_t prefix_len = 0;
+
+	if (!prop_end) {
+		return 0;
+	}
+
+	/* both bodies are {"prop":value}, compare up to the end of the property name */
+	prefix_len = prop_end - update_body + 1;
+
+	return e->key == key &&
+	       !strcmp(e->ipv4_address, ipv4_address) &&
+	       !strcmp(e->path, path) &&
+	       !strncmp(e->body, update_body, prefix_len);
+}
+
+/* remove a queued entry from the conflation index (linear probing, backward shift) */
+static void index_remove(struct update_queue *q, struct update_entry *e)
+{
+	size_t i = e->slot;
+	size_t j = i;
+	size_t k = 0;
+	struct update_entry *moved = NULL;
+
+	while (1) {
+		j = (j + 1) & q->index_mask;
+		if (!q->index[j]) {
+			break;
+		}
+
+		moved = entry_at(q, q->index[j] - 1);
+		k = moved->key & q->index_mask;
+		/* move slot j back to i unless its home lies cyclically in (i, j] */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+
+		q->index[i] = q->index[j];
+		moved->slot = i;
+		i = j;
+	}
+
+	q->index[i] = 0;
+}
+
+static void drop_oldest(struct update_queue *q)
+{
+	if (q->index) {
+		index_remove(q, entry_at(q, q->tail));
+	}
+	q->tail++;
+	q->stats.dropped++;
+}
+
+int update_queue_init(struct update_queue *q, size_t capacity, enum wasp_if_overflow_policy policy)
+{
+	size_t size = 1;
+
+	memset(q, 0, sizeof(*q));
+
+	if (!capacity) {
+		return -1;
+	}
+
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	q->entries = calloc(size, sizeof(*q->entries));
+	if (!q->entries) {
+		return -1;
+	}
+	q->mask = size - 1;
+
+	if (policy == WASP_IF_OVERFLOW_CONFLATE) {
+		/* at most half full to keep probe sequences short */
+		q->index = calloc(size * 2, sizeof(*q->index));
+		if (!q->index) {
+			free(q->entries);
+			q->entries = NULL;
+			return -1;
+		}
+		q->index_mask = size * 2 - 1;
+	}
+
+	q->policy = policy;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+
+	return 0;
+}
+
+void update_queue_destroy(struct update_queue *q)
+{
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+	free(q->entries);
+	free(q->index);
+	q->entries = NULL;
+	q->index = NULL;
+}
+
+int update_queue_push(struct update_queue *q, const char *ipv4_address, const char *path, const char *update_body)
+{
+	struct update_entry *e = NULL;
+	uint64_t key = 0;
+	size_t slot = 0;
+
+	pthread_mutex_lock(&q->lock);
+
+	if (q->index) {
+		/* replace the value of a queued update of the same property */
+		key = update_key(ipv4_address, path, update_body);
+		slot = key & q->index_mask;
+		while (q->index[slot]) {
+			e = entry_at(q, q->index[slot] - 1);
+			if (same_key(e, key, ipv4_address, path, update_body)) {
+				strncpy(e->body, update_body, WASP_IF_BODY_LEN - 1);
+				e->body[WASP_IF_BODY_LEN - 1] = '\0';
+				q->stats.conflated++;
+				pthread_mutex_unlock(&q->lock);
+				return 0;
+			}
+			slot = (slot + 1) & q->index_mask;
+		}
+	}
+
+	if (q->head - q->tail > q->mask) {
+		if (q->policy == WASP_IF_OVERFLOW_BLOCK) {
+			q->stats.blocked++;
+			while (q->head - q->tail > q->mask && !q->stop) {
+				pthread_cond_wait(&q->not_full, &q->lock);
+			}
+			if (q->stop) {
+				pthread_mutex_unlock(&q->lock);
+				return -1;
+			}
+		} else {
+			drop_oldest(q);
+			if (q->index) {
+				/* the removal may have shifted the free slot */
+				slot = key & q->index_mask;
+				while (q->index[slot]) {
+					slot = (slot + 1) & q->index_mask;
+				}
+			}
+		}
+	}
+
+	e = entry_at(q, q->head);
+	e->key = key;
+	e->slot = slot;
+	strncpy(e->ipv4_address, ipv4_address, WASP_IF_IPV4_ADDRESS_LEN - 1);
+	e->ipv4_address[WASP_IF_IPV4_ADDRESS_LEN - 1] = '\0';
+	strncpy(e->path, path, WASP_IF_PATH_LEN - 1);
+	e->path[WASP_IF_PATH_LEN - 1] = '\0';
+	strncpy(e->body, update_body, WASP_IF_BODY_LEN - 1);
+	e->body[WASP_IF_BODY_LEN - 1] = '\0';
+	if (q->index) {
+		q->index[slot] = q->head + 1;
+	}
+	q->head++;
+
+	q->stats.enqueued++;
+	if (q->head - q->tail > q->stats.max_depth) {
+		q->stats.max_depth = q->head - q->tail;
+	}
+
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+
+	return 0;
+}
+
+int update_queue_pop(struct update_queue *q, struct update_entry *entry)
+{
+	struct update_entry *e = NULL;
+
+	pthread_mutex_lock(&q->lock);
+
+	while (q->head == q->tail && !q->stop) {
+		pthread_cond_wait(&q->not_empty, &q->lock);
+	}
+
+	if (q->stop) {
+		pthread_mutex_unlock(&q->lock);
+		return 0;
+	}
+
+	e = entry_at(q, q->tail);
+	memcpy(entry, e, sizeof(*entry));
+	if (q->index) {
+		index_remove(q, e);
+	}
+	q->tail++;
+	q->stats.delivered++;
+
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+
+	return 1;
+}
+
+void update_queue_stop(struct update_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->stop = 1;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void update_queue_add_stats(struct update_queue *q, struct wasp_if_dispatch_stats *stats)
+{
+	pthread_mutex_lock(&q->lock);
+	stats->enqueued += q->stats.enqueued;
+	stats->delivered += q->stats.delivered;
+	stats->dropped += q->stats.dropped;
+	stats->conflated += q->stats.conflated;
+	stats->blocked += q->stats.blocked;
+	stats->depth += q->head - q->tail;
+	if (q->stats.max_depth > stats->max_depth) {
+		stats->max_depth = q->stats.max_depth;
+	}
+	pthread_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,78 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+#ifndef _UPDATE_QUEUE_H
+#define _UPDATE_QUEUE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "wasp_interface.h"
+
+struct update_entry {
+	uint64_t key;                                /* hash of address, path and property */
+	size_t slot;                                 /* conflation index slot */
+	char ipv4_address[WASP_IF_IPV4_ADDRESS_LEN];
+	char path[WASP_IF_PATH_LEN];
+	char body[WASP_IF_BODY_LEN];
+};
+
+/*
+ * Bounded queue of update stream events between the HTTP client thread
+ * (producer) and a dispatcher thread (consumer).
+ */
+struct update_queue {
+	struct update_entry *entries;
+	size_t mask;
+	uint64_t head;                               /* next sequence number to write */
+	uint64_t tail;                               /* next sequence number to read */
+	uint64_t *index;                             /* conflation index, sequence number + 1, 0 if empty */
+	size_t index_mask;
+	enum wasp_if_overflow_policy policy;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct wasp_if_dispatch_stats stats;
+};
+
+/**
+ * Allocate the queue.
+ *
+ * /param q - the queue to initialize
+ * /param capacity - maximum queued events, rounded up to a power of two
+ * /param policy - what to do when the queue is full
+ *
+ * /returns nonzero on error.
+ */
+int update_queue_init(struct update_queue *q, size_t capacity, enum wasp_if_overflow_policy policy);
+
+void update_queue_destroy(struct update_queue *q);
+
+/**
+ * Queue an update event, applying the overflow policy.
+ *
+ * /returns nonzero if the event was dropped.
+ */
+int update_queue_push(struct update_queue *q, const char *ipv4_address, const char *path, const char *update_body);
+
+/**
+ * Wait for and remove the oldest event.
+ *
+ * /returns zero once the queue is stopped.
+ */
+int update_queue_pop(struct update_queue *q, struct update_entry *entry);
+
+/**
+ * Wake all waiting threads and make update_queue_pop() return zero.
+ */
+void update_queue_stop(struct update_queue *q);
+
+/**
+ * Add the counters of the queue to stats.
+ */
+void update_queue_add_stats(struct update_queue *q, struct wasp_if_dispatch_stats *stats);
+
+#endif /* _UPDATE_QUEUE_H */
@@ -0,0 +1,235 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+/*
+ * Benchmark of the wasp_if_* request API against mock_device (or a real
+ * device).  Reports the latency percentiles and rate of each operation.
+ */
+
+#include "wasp_interface.h"
+#include "mock_dump.h"
+#include "bench_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+static atomic_ulong updates_rcvd;
+
+static void update_cb(const char *ipv4_address, const char *path, const char *update_body)
+{
+	(void)ipv4_address;
+	(void)path;
+	(void)update_body;
+
+	atomic_fetch_add(&updates_rcvd, 1);
+}
+
+enum bench_op {
+	OP_GET_CACHED,
+	OP_GET,
+	OP_SET,
+	OP_GET_OBJ_ID,
+	OP_GET_BULK,
+	NUM_OPS
+};
+
+/* level controls read by each OP_GET_BULK call */
+#define BULK_READS 64
+
+static const char *op_names[NUM_OPS] = {
+	"get_property cached",
+	"get_property (GET)",
+	"set_property (PATCH)",
+	"get_obj_id",
+	"read_bulk x64"
+};
+
+/* the level controls of BULK_READS blocks from block b, one GET each */
+static int run_bulk(const char *address, int b, int num_blocks)
+{
+	struct wasp_if_bulk_read reads[BULK_READS];
+	int n = 0;
+	int i = 0;
+
+	for (i = 0; i < BULK_READS; i++) {
+		reads[i].obj_id = MOCK_DUMP_BLOCK_ID((b + i) % num_blocks) + 1;
+		reads[i].prop_name = "level";
+		reads[i].type = WASP_IF_PROP_NUM;
+	}
+	n = wasp_if_object_read_bulk(address, reads, BULK_READS, 0);
+
+	return n != BULK_READS;
+}
+
+/* run one operation against the level control of block b */
+static int run_op(enum bench_op op, const char *address, int b, int i, int num_blocks)
+{
+	const char *level = "level";
+	int val = 0;
+	int ret = 0;
+
+	switch (op) {
+	case OP_GET_CACHED:
+		ret = wasp_if_object_get_property_num(address, MOCK_DUMP_BLOCK_ID(b) + 1,
+			level, strlen(level), &val, 1);
+		return ret == -1;
+	case OP_GET:
+		ret = wasp_if_object_get_property_num(address, MOCK_DUMP_BLOCK_ID(b) + 1,
+			level, strlen(level), &val, 0);
+		return ret != 200;
+	case OP_SET:
+		ret = wasp_if_object_set_property_num(address, MOCK_DUMP_BLOCK_ID(b) + 1,
+			level, strlen(level), i % 24);
+		return ret != 200 && ret != 202;
+	case OP_GET_OBJ_ID:
+		ret = wasp_if_get_obj_id(address, "block:io", 8, "analog", 6, "in", 2, b);
+		return ret == -1;
+	case OP_GET_BULK:
+		return run_bulk(address, b, num_blocks);
+	default:
+		return 1;
+	}
+}
+
+static const char *stage_names[WASP_IF_NUM_STAGES] = {
+	"queue",
+	"wait",
+	"connect",
+	"device",
+	"transfer",
+	"total"
+};
+
+/* where the time of the requests went, from the interface's histograms */
+static void report_stages(void)
+{
+	struct wasp_if_request_stats rs;
+	struct wasp_if_stage_stats *st = NULL;
+	int i = 0;
+
+	if (wasp_if_stats(NULL, &rs)) {
+		return;
+	}
+
+	printf("\n%llu requests, %llu errors, %llu resent after a 401\n",
+		(unsigned long long)rs.requests, (unsigned long long)rs.errors,
+		(unsigned long long)rs.replays);
+	printf("%-10s %9s %10s %10s %10s %10s %10s %10s\n",
+		"stage", "count", "mean us", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+	for (i = 0; i < WASP_IF_NUM_STAGES; i++) {
+		st = &rs.stages[i];
+		printf("%-10s %9llu %10llu %10llu %10llu %10llu %10llu %10llu\n", stage_names[i],
+			(unsigned long long)st->count, (unsigned long long)st->mean_us,
+			(unsigned long long)st->p50_us, (unsigned long long)st->p90_us,
+			(unsigned long long)st->p99_us, (unsigned long long)st->p999_us,
+			(unsigned long long)st->max_us);
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-a a.b.c.d:port] [-c devices] [-b blocks] [-n iterations] [-s] [-E]\n"
+		"  -c  devices at consecutive addresses a.b.c.d, a.b.c.(d+1), ...\n"
+		"  -b  blocks of the mock device, requests are spread over them\n"
+		"  -s  open the update stream and report the update rate\n"
+		"  -E  built-in epoll HTTP/1.1 transport instead of libwebsockets\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct wasp_if_connect_device *devs = NULL;
+	struct wasp_if_config cfg;
+	char (*addrs)[WASP_IF_IPV4_ADDRESS_LEN] = NULL;
+	const char *address = "127.0.0.1:8080";
+	unsigned int a0, a1, a2, a3;
+	uint64_t *lat_ns = NULL;
+	uint64_t start = 0;
+	uint64_t t = 0;
+	int num_devices = 1;
+	int num_blocks = 16;
+	int iterations = 1000;
+	int stream = 0;
+	int port = 80;
+	int errors = 0;
+	int op = 0;
+	int i = 0;
+	int c = 0;
+
+	wasp_if_config_init(&cfg);
+
+	while ((c = getopt(argc, argv, "a:c:b:n:sEh")) != -1) {
+		switch (c) {
+		case 'a': address = optarg; break;
+		case 'c': num_devices = atoi(optarg); break;
+		case 'b': num_blocks = atoi(optarg); break;
+		case 'n': iterations = atoi(optarg); break;
+		case 's': stream = 1; break;
+		case 'E': cfg.transport = WASP_IF_TRANSPORT_EPOLL; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (sscanf(address, "%u.%u.%u.%u:%d", &a0, &a1, &a2, &a3, &port) < 4 ||
+	    num_devices < 1 || num_devices > WASP_IF_MAX_DEVICES || num_blocks < 1 || iterations < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	devs = calloc(num_devices, sizeof(*devs));
+	addrs = calloc(num_devices, sizeof(*addrs));
+	lat_ns = calloc(iterations, sizeof(*lat_ns));
+	if (!devs || !addrs || !lat_ns) {
+		return 1;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		snprintf(addrs[i], sizeof(addrs[i]), "%u.%u.%u.%u:%d", a0, a1, a2, a3 + i, port);
+		devs[i].device_index = i;
+		devs[i].ipv4_address = addrs[i];
+		devs[i].enable_update_stream = stream;
+	}
+
+	if (wasp_if_init_ex(stream ? update_cb : NULL, &cfg)) {
+		return 1;
+	}
+
+	start = bench_now_ns();
+	if (wasp_if_connect_to_devices(devs, num_devices, NULL, NULL, NULL)) {
+		printf("error connecting to the devices\n");
+		return 1;
+	}
+	printf("connected %d device(s) in %.1f ms\n\n", num_devices, (bench_now_ns() - start) / 1e6);
+
+	bench_report_header("us");
+
+	/* only the benchmark requests, not the connect */
+	wasp_if_stats_reset(NULL);
+	atomic_store(&updates_rcvd, 0);
+	t = bench_now_ns();
+	for (op = 0; op < NUM_OPS; op++) {
+		errors = 0;
+		start = bench_now_ns();
+		for (i = 0; i < iterations; i++) {
+			uint64_t t0 = bench_now_ns();
+			errors += run_op(op, addrs[i % num_devices], i % num_blocks, i, num_blocks);
+			lat_ns[i] = bench_now_ns() - t0;
+		}
+		bench_report(op_names[op], lat_ns, iterations, bench_now_ns() - start, errors, 1000);
+	}
+
+	report_stages();
+
+	if (stream) {
+		printf("\nupdate stream: %lu updates, %.0f updates/s\n",
+			atomic_load(&updates_rcvd), atomic_load(&updates_rcvd) / ((bench_now_ns() - t) / 1e9));
+	}
+
+	free(lat_ns);
+	free(addrs);
+	free(devs);
+
+	return 0;
+}
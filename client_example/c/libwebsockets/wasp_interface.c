@@ -4,7 +4,14 @@
 ***********************************************/
 
 #include "wasp_interface.h"
-#include "lws_http_client.h"
+#include "http_client.h"
+#include "meter_ring.h"
+#include "update_queue.h"
+#include "object_store.h"
+#include "schema_store.h"
+#include "latency_hist.h"
+#include "metrics.h"
+#include "trace_ring.h"
 
 #include <signal.h>
 #include <pthread.h>
@@ -12,51 +19,320 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <inttypes.h>
 #include <errno.h>
 #include <semaphore.h>
+#include <time.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-#define MAX_LEN 65536 /* 64 KB */
 
-static char objects[WASP_IF_MAX_DEVICES][MAX_LEN];
-static char schemas[WASP_IF_MAX_DEVICES][MAX_LEN];
+static struct object_store objects[WASP_IF_MAX_DEVICES];
+static struct schema_store schemas[WASP_IF_MAX_DEVICES];
 static char devices[WASP_IF_MAX_DEVICES][WASP_IF_IPV4_ADDRESS_LEN] = { 0 };
 static char wasp_auth_strs[WASP_IF_MAX_DEVICES][WASP_IF_AUTH_STR_LEN] = { 0 };
+static char stream_period_hdrs[WASP_IF_MAX_DEVICES][WASP_IF_STREAM_HDR_LEN] = { 0 };
+static char stream_exclude_hdrs[WASP_IF_MAX_DEVICES][WASP_IF_STREAM_HDR_LEN] = { 0 };
+static int stream_enabled[WASP_IF_MAX_DEVICES] = { 0 };
+static pthread_mutex_t stream_opts_locks[WASP_IF_MAX_SHARDS];
+
+/* wasp_if_connect_to_devices() progress, updated by the HTTP client thread */
+static pthread_mutex_t connect_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connect_cond = PTHREAD_COND_INITIALIZER;
+static enum wasp_if_connect_state connect_states[WASP_IF_MAX_DEVICES];
+static int connect_errs[WASP_IF_MAX_DEVICES];
+static int connect_active = 0;
+
+/* per-device request lifecycle histograms, recorded by the HTTP client threads */
+struct request_hists {
+	struct latency_hist stages[WASP_IF_NUM_STAGES];
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t replays;
+};
+static struct request_hists req_stats[WASP_IF_MAX_DEVICES];
+static pthread_mutex_t stats_locks[WASP_IF_MAX_SHARDS];
+
+/* metrics writer thread, a file rewritten every period_ms or a local socket */
+#define METRICS_PATH_LEN 256
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t metrics_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t metrics_thread;
+static atomic_int metrics_running = 0;
+static int metrics_listen_fd = -1;
+static int metrics_period_ms = 0;
+static char metrics_path[METRICS_PATH_LEN];
+
+/* flight recorder, and the file its signal handler dumps to */
+#define TRACE_PATH_LEN 256
+static struct trace_ring trace;
+static char trace_signal_path[TRACE_PATH_LEN];
+
+/* sorted ctrl:meter object IDs of a device */
+struct meter_ids {
+	int num_ids;
+	int ids[];
+};
+
+struct meter_channel {
+	atomic_int active;     /* divert ctrl:meter updates into the ring */
+	struct meter_ring ring;
+	struct meter_ids *_Atomic ids;  /* replaced by the device's HTTP client thread each time
+	                                   the objects are read, NULL until read or enabled */
+};
+
+static struct meter_channel meters[WASP_IF_MAX_DEVICES];
 
 async_cb_t _u_cb = NULL;
 
-static int fd[2];
-static sem_t s_request_done;
+static struct wasp_if_config config;
+static struct update_queue *dispatch_queues = NULL;   /* config.dispatch_threads per shard */
 
-static int last_err_code = 0;
-static char resp_buffer[WASP_IF_RESP_BUF_LEN] = { 0 };
-static struct wasp_if_msg msg = { 0 };
+/* request pipe of each HTTP client (lws service) thread */
+static int fd[WASP_IF_MAX_SERVICE_THREADS][2];
+
+/*
+ * Completion of a blocking request.  Each application thread waits on its
+ * own, so blocking calls on different threads (and shards) do not wake
+ * each other or read each other's status.
+ */
+struct wasp_if_waiter {
+	sem_t done;
+	int init;
+	int status;                                  /* of the thread's last blocking request */
+	char resp[WASP_IF_RESP_BUF_LEN];             /* single object GET response */
+};
+
+static _Thread_local struct wasp_if_waiter waiter;
 
 ///////////////////////////////////////////////////////////////////////////////
 
+void wasp_if_config_init(struct wasp_if_config *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->dispatch_threads = 1;
+	cfg->dispatch_queue_len = 4096;
+	cfg->overflow_policy = WASP_IF_OVERFLOW_CONFLATE;
+	cfg->stream_backoff_min_ms = 250;
+	cfg->stream_backoff_max_ms = 30000;
+	cfg->stream_resync = 1;
+	cfg->auth_refresh_s = 300;
+	cfg->trace_events = 65536;
+	cfg->shards = 1;
+	cfg->service_threads = 1;
+	cfg->validate_writes = 1;
+}
+
+const struct wasp_if_config * _wasp_if_get_config(void)
+{
+	return &config;
+}
+
+/* the lock of a device's shard, so devices of different shards share no lock */
+static pthread_mutex_t * _wasp_if_shard_lock(pthread_mutex_t *locks, int index)
+{
+	return &locks[config.shards > 1 ? index % config.shards : 0];
+}
+
+static void * _wasp_if_dispatch_thread(void *args)
+{
+	struct update_queue *q = (struct update_queue *)args;
+	struct update_entry entry;
+
+	while (update_queue_pop(q, &entry)) {
+		_u_cb(entry.ipv4_address, entry.path, entry.body);
+	}
+
+	return NULL;
+}
+
+static int _wasp_if_start_dispatch(void)
+{
+	pthread_t dispatch_thread_id;
+	int i = 0;
+
+	if (config.dispatch_threads <= 0) {
+		/* callbacks run on the HTTP client thread */
+		config.dispatch_threads = 0;
+		return 0;
+	}
+
+	dispatch_queues = calloc(config.shards * config.dispatch_threads, sizeof(*dispatch_queues));
+	if (!dispatch_queues) {
+		return -1;
+	}
+
+	for (i = 0; i < config.shards * config.dispatch_threads; i++) {
+		if (update_queue_init(&dispatch_queues[i], config.dispatch_queue_len, config.overflow_policy)) {
+			printf("error allocating update dispatch queue\n");
+			return -1;
+		}
+		if (pthread_create(&dispatch_thread_id, NULL, _wasp_if_dispatch_thread, &dispatch_queues[i])) {
+			printf("error starting update dispatch thread\n");
+			return -1;
+		}
+		pthread_detach(dispatch_thread_id);
+	}
+
+	return 0;
+}
+
 int wasp_if_init(async_cb_t u_cb)
 {
+	return wasp_if_init_ex(u_cb, NULL);
+}
+
+int wasp_if_init_ex(async_cb_t u_cb, const struct wasp_if_config *cfg)
+{
+	int i = 0;
+
 	_u_cb = u_cb;
 
-	pipe(fd);
-	if (fcntl(fd[0], F_SETFL, O_NONBLOCK) < 0) {
-		printf("error setting up pipe\n");
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		object_store_init(&objects[i]);
+		schema_store_init(&schemas[i]);
+	}
+
+	if (cfg) {
+		config = *cfg;
+	} else {
+		wasp_if_config_init(&config);
+	}
+
+	if (config.shards < 1) {
+		config.shards = 1;
+	} else if (config.shards > WASP_IF_MAX_SHARDS) {
+		config.shards = WASP_IF_MAX_SHARDS;
+	}
+	for (i = 0; i < config.shards; i++) {
+		pthread_mutex_init(&stats_locks[i], NULL);
+		pthread_mutex_init(&stream_opts_locks[i], NULL);
+	}
+
+	if (config.trace_events && !trace.slots && trace_ring_init(&trace, config.trace_events)) {
+		printf("error allocating trace ring, tracing disabled\n");
+	}
+
+	if (_wasp_if_start_dispatch()) {
+		return -1;
+	}
+
+	if (config.service_threads < 1) {
+		config.service_threads = 1;
+	} else if (config.shards * config.service_threads > WASP_IF_MAX_SERVICE_THREADS) {
+		config.service_threads = WASP_IF_MAX_SERVICE_THREADS / config.shards;
+	}
+
+	for (i = 0; i < config.shards * config.service_threads; i++) {
+		if (pipe(fd[i]) || fcntl(fd[i][0], F_SETFL, O_NONBLOCK) < 0) {
+			printf("error setting up pipe\n");
+			return -1;
+		}
+	}
+
+	if (http_client_start(config.transport, config.shards, config.service_threads,
+		config.service_cpu_affinity) < 0) {
 		return -1;
 	}
 
-	sem_init(&s_request_done, 0, 0);
-	pthread_t new_thread_id;
-	pthread_create(&new_thread_id, NULL, lws_http_client_thread, NULL);
+	return 0;
+}
+
+static int _wasp_if_format_stream_opts(
+	int index,
+	const struct wasp_if_stream_opts *opts
+)
+{
+	char period[WASP_IF_STREAM_HDR_LEN] = { 0 };
+	char exclude[WASP_IF_STREAM_HDR_LEN] = { 0 };
+	size_t pos = 0;
+	int ret = 0;
+	int i = 0;
+
+	if (opts) {
+		if (opts->num_periods < 0 || opts->num_periods > WASP_IF_STREAM_MAX_PERIODS ||
+		    opts->num_exclude_obj_types < 0 ||
+		    opts->num_exclude_obj_types > WASP_IF_STREAM_MAX_EXCLUDES) {
+			/* size validation */
+			return -1;
+		}
+
+		/* e.g. "1000,100 ctrl:meter" */
+		if (opts->default_period_ms > 0 || opts->num_periods) {
+			ret = snprintf(period, sizeof(period), "%d", opts->default_period_ms);
+			pos = ret;
+		}
+		for (i = 0; i < opts->num_periods; i++) {
+			ret = snprintf(&period[pos], sizeof(period) - pos, ",%d %s",
+				opts->periods[i].period_ms,
+				opts->periods[i].obj_type);
+			if (ret < 0 || (size_t)ret >= sizeof(period) - pos) {
+				return -1;
+			}
+			pos += ret;
+		}
+
+		/* e.g. "ctrl:meter,ctrl:gpi" */
+		pos = 0;
+		for (i = 0; i < opts->num_exclude_obj_types; i++) {
+			ret = snprintf(&exclude[pos], sizeof(exclude) - pos, "%s%s",
+				i ? "," : "",
+				opts->exclude_obj_types[i]);
+			if (ret < 0 || (size_t)ret >= sizeof(exclude) - pos) {
+				return -1;
+			}
+			pos += ret;
+		}
+	}
+
+	pthread_mutex_lock(_wasp_if_shard_lock(stream_opts_locks, index));
+	strcpy(stream_period_hdrs[index], period);
+	strcpy(stream_exclude_hdrs[index], exclude);
+	pthread_mutex_unlock(_wasp_if_shard_lock(stream_opts_locks, index));
 
 	return 0;
 }
 
+/* send a request and wait for its response on the calling thread's waiter, returns the HTTP status or -1 */
+static int _wasp_if_request(struct wasp_if_msg *msg)
+{
+	if (!waiter.init) {
+		sem_init(&waiter.done, 0, 0);
+		waiter.init = 1;
+	}
+	waiter.status = -1;
+	waiter.resp[0] = '\0';
+
+	msg->waiter = &waiter;
+	if (_wasp_if_msg_write(msg)) {
+		return -1;
+	}
+	sem_wait(&waiter.done);
+
+	return waiter.status;
+}
+
 int wasp_if_connect_to_device(
 	unsigned int device_index,
 	const char *ipv4_address,
 	int enable_update_stream
 )
 {
+	return wasp_if_connect_to_device_ex(device_index, ipv4_address, enable_update_stream, NULL);
+}
+
+int wasp_if_connect_to_device_ex(
+	unsigned int device_index,
+	const char *ipv4_address,
+	int enable_update_stream,
+	const struct wasp_if_stream_opts *stream_opts
+)
+{
+	struct wasp_if_msg msg;
+
 	if (device_index >= WASP_IF_MAX_DEVICES) {
 		printf("Device index %d is greater than MAX_DEVICES (%d)\n",
 			device_index,
@@ -67,7 +343,12 @@ int wasp_if_connect_to_device(
 	strncpy(devices[device_index], ipv4_address, WASP_IF_IPV4_ADDRESS_LEN-1);
 	devices[device_index][WASP_IF_IPV4_ADDRESS_LEN-1] = '\0';
 
-	/* wait for objects and schemas to be read upon startup of lws_http_client */
+	if (_wasp_if_format_stream_opts(device_index, stream_opts)) {
+		printf("Invalid update stream options for %s\n", ipv4_address);
+		return -1;
+	}
+
+	/* wait for objects and schemas to be read upon startup of the HTTP client */
 	printf("Connecting to %s and reading objects and schemas - can take several seconds...\n",
 		ipv4_address);
 
@@ -79,21 +360,22 @@ int wasp_if_connect_to_device(
 		"/wasp/r2/objects",
 		NULL);
 
-	_wasp_if_msg_write(&msg);
-	sem_wait(&s_request_done);
+	_wasp_if_request(&msg);
 
-	/* get all schemas */
-	_wasp_if_msg_init(
-		&msg,
-		"GET",
-		ipv4_address,
-		"/wasp/r2/schemas",
-		NULL);
+	/* get all schemas, unless they are read as they are looked up */
+	if (!config.lazy_schemas) {
+		_wasp_if_msg_init(
+			&msg,
+			"GET",
+			ipv4_address,
+			"/wasp/r2/schemas",
+			NULL);
 
-	_wasp_if_msg_write(&msg);
-	sem_wait(&s_request_done);
+		_wasp_if_request(&msg);
+	}
 
 	/* object update stream */
+	stream_enabled[device_index] = enable_update_stream;
 	if (enable_update_stream) {
 		_wasp_if_msg_init(
 			&msg,
@@ -105,158 +387,1670 @@ int wasp_if_connect_to_device(
 		_wasp_if_msg_write(&msg);
 	}
 
-	printf("Done\n");
+	printf("Done\n");
+
+	return 0;
+}
+
+/* a CLOCK_REALTIME deadline ms from now, for pthread_cond_timedwait() */
+static void _wasp_if_deadline(struct timespec *ts, int ms)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static int _wasp_if_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+int wasp_if_connect_to_devices(
+	const struct wasp_if_connect_device *devs,
+	int num_devs,
+	const struct wasp_if_connect_opts *opts,
+	connect_cb_t cb,
+	void *user
+)
+{
+	struct wasp_if_msg connect_msg;
+	enum wasp_if_connect_state state;
+	struct timespec *start_at = NULL;
+	struct timespec *wake = NULL;
+	struct timespec now;
+	int *reported = NULL;
+	int max_downloads = WASP_IF_CONNECT_MAX_DOWNLOADS;
+	int jitter_ms = 0;
+	int progress = 0;
+	int first = 0;
+	int next = 0;
+	int done = 0;
+	int failed = 0;
+	int index = 0;
+	int err_code = 0;
+	int i = 0;
+
+	if (!devs || num_devs <= 0) {
+		return -1;
+	}
+
+	if (opts) {
+		if (opts->max_downloads > 0) {
+			max_downloads = opts->max_downloads;
+		}
+		jitter_ms = opts->jitter_ms;
+	}
+
+	for (i = 0; i < num_devs; i++) {
+		if (devs[i].device_index >= WASP_IF_MAX_DEVICES) {
+			printf("Device index %d is greater than MAX_DEVICES (%d)\n",
+				devs[i].device_index,
+				WASP_IF_MAX_DEVICES);
+			return -1;
+		}
+		if (_wasp_if_format_stream_opts(devs[i].device_index, devs[i].stream_opts)) {
+			printf("Invalid update stream options for %s\n", devs[i].ipv4_address);
+			return -1;
+		}
+	}
+
+	reported = malloc(num_devs * sizeof(*reported));
+	start_at = malloc(num_devs * sizeof(*start_at));
+	if (!reported || !start_at) {
+		free(reported);
+		free(start_at);
+		return -1;
+	}
+
+	pthread_mutex_lock(&connect_lock);
+	for (i = 0; i < num_devs; i++) {
+		index = devs[i].device_index;
+		strncpy(devices[index], devs[i].ipv4_address, WASP_IF_IPV4_ADDRESS_LEN-1);
+		devices[index][WASP_IF_IPV4_ADDRESS_LEN-1] = '\0';
+		stream_enabled[index] = devs[i].enable_update_stream;
+		connect_states[index] = WASP_IF_CONNECT_QUEUED;
+		connect_errs[index] = 0;
+		reported[i] = -1;
+	}
+	connect_active = 0;
+
+	printf("Connecting to %d devices, %d at a time...\n", num_devs, max_downloads);
+
+	while (done < num_devs) {
+		/* report state changes, outside the lock */
+		progress = 0;
+		for (i = 0; i < num_devs; i++) {
+			index = devs[i].device_index;
+			state = connect_states[index];
+			if ((int)state == reported[i]) {
+				continue;
+			}
+
+			reported[i] = state;
+			progress = 1;
+			err_code = connect_errs[index];
+			if (state == WASP_IF_CONNECT_DONE || state == WASP_IF_CONNECT_FAILED) {
+				done++;
+				failed += state == WASP_IF_CONNECT_FAILED;
+			}
+			if (cb) {
+				pthread_mutex_unlock(&connect_lock);
+				cb(devs[i].ipv4_address, state, err_code, user);
+				pthread_mutex_lock(&connect_lock);
+			}
+		}
+
+		if (done >= num_devs) {
+			break;
+		}
+
+		/*
+		 * Give each device a download slot as one is free, and a start time a
+		 * random delay of up to jitter_ms later, which spreads the connections
+		 * out rather than opening them all at once.  The delays of the devices
+		 * holding slots run at the same time.
+		 */
+		while (next < num_devs && connect_active < max_downloads) {
+			connect_active++;
+			_wasp_if_deadline(&start_at[next], jitter_ms > 0 ? rand() % (jitter_ms + 1) : 0);
+			next++;
+		}
+
+		/* start the devices whose delay has passed, devices first to next - 1 hold slots */
+		clock_gettime(CLOCK_REALTIME, &now);
+		wake = NULL;
+		for (i = first; i < next; i++) {
+			if (connect_states[devs[i].device_index] != WASP_IF_CONNECT_QUEUED) {
+				continue;
+			}
+			if (_wasp_if_before(&now, &start_at[i])) {
+				if (!wake || _wasp_if_before(&start_at[i], wake)) {
+					wake = &start_at[i];
+				}
+				continue;
+			}
+
+			connect_states[devs[i].device_index] = WASP_IF_CONNECT_STARTED;
+			pthread_mutex_unlock(&connect_lock);
+
+			/* the HTTP client thread authorizes the device, then reads objects and schemas */
+			_wasp_if_msg_init(
+				&connect_msg,
+				"GET",
+				devs[i].ipv4_address,
+				"/wasp/r2/objects",
+				NULL);
+			connect_msg.flags = WASP_IF_MSG_CONNECT;
+			_wasp_if_msg_write(&connect_msg);
+
+			pthread_mutex_lock(&connect_lock);
+			progress = 1;
+		}
+		while (first < next && connect_states[devs[first].device_index] != WASP_IF_CONNECT_QUEUED) {
+			first++;
+		}
+
+		if (progress) {
+			/* the lock was released, report any progress made meanwhile */
+			continue;
+		} else if (wake) {
+			pthread_cond_timedwait(&connect_cond, &connect_lock, wake);
+		} else {
+			pthread_cond_wait(&connect_cond, &connect_lock);
+		}
+	}
+	pthread_mutex_unlock(&connect_lock);
+
+	free(start_at);
+	free(reported);
+
+	printf("Done, %d of %d devices connected\n", num_devs - failed, num_devs);
+
+	return failed;
+}
+
+int _wasp_if_notify_connect_progress(
+	const char *ipv4_address,
+	enum wasp_if_connect_state state,
+	int err_code
+)
+{
+	int open_stream = 0;
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&connect_lock);
+	connect_states[index] = state;
+	connect_errs[index] = err_code;
+	if (state == WASP_IF_CONNECT_DONE || state == WASP_IF_CONNECT_FAILED) {
+		/* frees a download slot */
+		connect_active--;
+		open_stream = state == WASP_IF_CONNECT_DONE && stream_enabled[index];
+	}
+	pthread_cond_signal(&connect_cond);
+	pthread_mutex_unlock(&connect_lock);
+
+	return open_stream;
+}
+
+int wasp_if_set_stream_options(
+	const char *ipv4_address,
+	const struct wasp_if_stream_opts *stream_opts
+)
+{
+	struct wasp_if_msg stream_msg;
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		/* device not found */
+		return -1;
+	}
+
+	if (_wasp_if_format_stream_opts(index, stream_opts)) {
+		return -1;
+	}
+
+	if (stream_enabled[index]) {
+		/* the HTTP client reconnects an open stream with the new headers */
+		_wasp_if_msg_init(
+			&stream_msg,
+			"GET",
+			ipv4_address,
+			"/wasp/u2/objects",
+			NULL);
+
+		return _wasp_if_msg_write(&stream_msg);
+	}
+
+	return 0;
+}
+
+int _wasp_if_get_stream_headers(
+	const char *ipv4_address,
+	char *period,
+	size_t period_len,
+	char *exclude,
+	size_t exclude_len
+)
+{
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		return -1;
+	}
+
+	pthread_mutex_lock(_wasp_if_shard_lock(stream_opts_locks, index));
+	strncpy(period, stream_period_hdrs[index], period_len - 1);
+	period[period_len - 1] = '\0';
+	strncpy(exclude, stream_exclude_hdrs[index], exclude_len - 1);
+	exclude[exclude_len - 1] = '\0';
+	pthread_mutex_unlock(_wasp_if_shard_lock(stream_opts_locks, index));
+
+	return 0;
+}
+
+int _wasp_if_msg_write(struct wasp_if_msg *msg)
+{
+	size_t bytes_left = sizeof(*msg);
+	uint8_t *buf_ptr = (uint8_t *)msg;
+	int index = _wasp_if_ipv4_to_device_index(msg->ipv4_address);
+
+	/* to the thread serving the device, an unknown device is reported by the first */
+	int thread = http_client_thread_of(index);
+
+	msg->stage_us[WASP_IF_STAGE_QUEUE] = _wasp_if_time_us();
+	_wasp_if_trace(TRACE_REQ_SUBMIT, index, metrics_method(msg->method), _wasp_if_path_obj_id(msg->path));
+	while (bytes_left > 0) {
+		ssize_t retval = write(fd[thread][1], buf_ptr, bytes_left);
+		if (retval < 0) {
+			printf("fail writing to pipe\n");
+			return -1;
+		}
+		bytes_left -= retval;
+		buf_ptr += retval;
+	}
+
+	/* the HTTP client thread may be waiting in lws_service_tsi() or epoll_wait() */
+	http_client_wake(thread);
+
+	return 0;
+}
+
+int _wasp_if_msg_read(int thread, struct wasp_if_msg *msg)
+{
+	ssize_t ret = read(fd[thread][0], msg, sizeof(*msg));
+	if (ret < 0) {
+		if (errno != EAGAIN) {
+			printf("read pipe error\n");
+		}
+	} else if (!ret) {
+		printf("EOF reading from pipe\n");
+	} else {
+		return 1;
+	}
+
+	return 0;
+}
+
+void _wasp_if_msg_init(
+	struct wasp_if_msg *msg,
+	const char *method,
+	const char *ipv4_address,
+	const char *path,
+	const char *body
+)
+{
+	memset(msg, 0, sizeof(*msg));
+	strncpy(msg->method, method, WASP_IF_METHOD_LEN-1);
+	msg->method[WASP_IF_METHOD_LEN-1] = '\0';
+	strncpy(msg->ipv4_address, ipv4_address, WASP_IF_IPV4_ADDRESS_LEN-1);
+	msg->ipv4_address[WASP_IF_IPV4_ADDRESS_LEN-1] = '\0';
+	strncpy(msg->path, path, WASP_IF_PATH_LEN-1);
+	msg->path[WASP_IF_PATH_LEN-1] = '\0';
+	if (body) {
+		strncpy(msg->body, body, WASP_IF_BODY_LEN-1);
+		msg->body[WASP_IF_BODY_LEN-1] = '\0';
+		msg->body_len = strlen(msg->body);
+	}
+}
+
+/* set the body of a request to exactly len bytes, a NUL within them (e.g. a buffer size passed as the length) is rejected */
+static int _wasp_if_msg_body(struct wasp_if_msg *msg, const char *body, size_t len)
+{
+	if (len >= WASP_IF_BODY_LEN || memchr(body, '\0', len)) {
+		return -1;
+	}
+
+	memcpy(msg->body, body, len);
+	msg->body[len] = '\0';
+	msg->body_len = len;
+
+	return 0;
+}
+
+void _wasp_if_notify_update_stream_rcvd(
+	const char *ipv4_address,
+	const char *path,
+	const char *update_body
+)
+{
+	int index = 0;
+	int queue = 0;
+
+	if (!config.dispatch_threads) {
+		_u_cb(ipv4_address, path, update_body);
+		return;
+	}
+
+	/* each device is served by one dispatch thread of its shard to keep its updates in order */
+	index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		return;
+	}
+
+	queue = (index % config.shards) * config.dispatch_threads + (index / config.shards) % config.dispatch_threads;
+	update_queue_push(&dispatch_queues[queue], ipv4_address, path, update_body);
+}
+
+int wasp_if_get_dispatch_stats(struct wasp_if_dispatch_stats *stats)
+{
+	int i = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < config.shards * config.dispatch_threads; i++) {
+		update_queue_add_stats(&dispatch_queues[i], stats);
+	}
+
+	return 0;
+}
+
+int wasp_if_stats(const char *ipv4_address, struct wasp_if_request_stats *stats)
+{
+	struct latency_hist h;
+	struct wasp_if_stage_stats *st = NULL;
+	int first = 0;
+	int last = WASP_IF_MAX_DEVICES - 1;
+	int stage = 0;
+	int i = 0;
+
+	if (ipv4_address) {
+		first = last = _wasp_if_ipv4_to_device_index(ipv4_address);
+		if (first == -1) {
+			return -1;
+		}
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = first; i <= last; i++) {
+		pthread_mutex_lock(_wasp_if_shard_lock(stats_locks, i));
+		stats->requests += req_stats[i].requests;
+		stats->errors += req_stats[i].errors;
+		stats->replays += req_stats[i].replays;
+		pthread_mutex_unlock(_wasp_if_shard_lock(stats_locks, i));
+	}
+	for (stage = 0; stage < WASP_IF_NUM_STAGES; stage++) {
+		memset(&h, 0, sizeof(h));
+		for (i = first; i <= last; i++) {
+			pthread_mutex_lock(_wasp_if_shard_lock(stats_locks, i));
+			latency_hist_merge(&h, &req_stats[i].stages[stage]);
+			pthread_mutex_unlock(_wasp_if_shard_lock(stats_locks, i));
+		}
+
+		st = &stats->stages[stage];
+		st->count = h.count;
+		st->mean_us = h.count ? h.sum / h.count : 0;
+		st->p50_us = latency_hist_percentile(&h, 0.5);
+		st->p90_us = latency_hist_percentile(&h, 0.9);
+		st->p99_us = latency_hist_percentile(&h, 0.99);
+		st->p999_us = latency_hist_percentile(&h, 0.999);
+		st->max_us = h.max;
+	}
+
+	return 0;
+}
+
+int wasp_if_stats_reset(const char *ipv4_address)
+{
+	int first = 0;
+	int last = WASP_IF_MAX_DEVICES - 1;
+	int i = 0;
+
+	if (ipv4_address) {
+		first = last = _wasp_if_ipv4_to_device_index(ipv4_address);
+		if (first == -1) {
+			return -1;
+		}
+	}
+
+	for (i = first; i <= last; i++) {
+		pthread_mutex_lock(_wasp_if_shard_lock(stats_locks, i));
+		memset(&req_stats[i], 0, sizeof(req_stats[i]));
+		pthread_mutex_unlock(_wasp_if_shard_lock(stats_locks, i));
+	}
+
+	return 0;
+}
+
+int wasp_if_metrics_snapshot(struct wasp_if_metrics *m)
+{
+	struct wasp_if_device_metrics *dm = NULL;
+	int i = 0;
+
+	memset(m, 0, sizeof(*m));
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		if (!devices[i][0]) {
+			continue;
+		}
+
+		dm = &m->devices[i];
+		memcpy(dm->ipv4_address, devices[i], sizeof(dm->ipv4_address));
+		metrics_sum(i, &dm->counters);
+		dm->queue_depth = metrics_get_queue_depth(i);
+		dm->objects_bytes = object_store_memory(&objects[i], &dm->num_objects);
+		dm->schemas_bytes = schema_store_memory(&schemas[i]);
+	}
+
+	return wasp_if_get_dispatch_stats(&m->dispatch);
+}
+
+size_t wasp_if_metrics_format(const struct wasp_if_metrics *m, char *buf, size_t len)
+{
+	return metrics_format_prometheus(m, buf, len);
+}
+
+/* the current metrics as Prometheus text, to free() */
+static char * _wasp_if_metrics_text(size_t *len)
+{
+	struct wasp_if_metrics *m = malloc(sizeof(*m));
+	char *text = NULL;
+
+	if (!m || wasp_if_metrics_snapshot(m)) {
+		free(m);
+		return NULL;
+	}
+
+	*len = wasp_if_metrics_format(m, NULL, 0);
+	text = malloc(*len + 1);
+	if (text) {
+		wasp_if_metrics_format(m, text, *len + 1);
+	}
+	free(m);
+
+	return text;
+}
+
+static void * _wasp_if_metrics_file_thread(void *args)
+{
+	char tmp_path[METRICS_PATH_LEN + 4];
+	struct timespec ts;
+	char *text = NULL;
+	size_t len = 0;
+	FILE *f = NULL;
+	int ok = 0;
+
+	(void)args;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", metrics_path);
+
+	pthread_mutex_lock(&metrics_lock);
+	while (atomic_load(&metrics_running)) {
+		pthread_mutex_unlock(&metrics_lock);
+
+		/* written beside the file and renamed, so readers never see part of it */
+		text = _wasp_if_metrics_text(&len);
+		f = text ? fopen(tmp_path, "w") : NULL;
+		if (f) {
+			ok = fwrite(text, 1, len, f) == len;
+			ok = !fclose(f) && ok;
+			if (!ok || rename(tmp_path, metrics_path)) {
+				printf("error writing metrics to %s\n", metrics_path);
+			}
+		}
+		free(text);
+
+		pthread_mutex_lock(&metrics_lock);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += metrics_period_ms / 1000;
+		ts.tv_nsec += (metrics_period_ms % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		while (atomic_load(&metrics_running) &&
+		       pthread_cond_timedwait(&metrics_cond, &metrics_lock, &ts) != ETIMEDOUT) {
+		}
+	}
+	pthread_mutex_unlock(&metrics_lock);
+
+	return NULL;
+}
+
+/* one connection to the metrics socket */
+static void _wasp_if_metrics_serve(int conn_fd)
+{
+	struct pollfd pfd = { conn_fd, POLLIN, 0 };
+	char req[1024] = "";
+	char hdr[128];
+	char *text = NULL;
+	size_t len = 0;
+	ssize_t n = 0;
+	int http = 0;
+
+	/* an HTTP client sends a request first, a plain reader may send nothing */
+	if (poll(&pfd, 1, 100) > 0) {
+		n = recv(conn_fd, req, sizeof(req) - 1, 0);
+		http = n >= 4 && !strncmp(req, "GET ", 4);
+	}
+
+	text = _wasp_if_metrics_text(&len);
+	if (!text) {
+		return;
+	}
+
+	if (http) {
+		n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n\r\n", len);
+		send(conn_fd, hdr, n, MSG_NOSIGNAL);
+	}
+	send(conn_fd, text, len, MSG_NOSIGNAL);
+	free(text);
+}
+
+static void * _wasp_if_metrics_socket_thread(void *args)
+{
+	int conn_fd = 0;
+
+	(void)args;
+
+	while (atomic_load(&metrics_running)) {
+		conn_fd = accept(metrics_listen_fd, NULL, NULL);
+		if (conn_fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		_wasp_if_metrics_serve(conn_fd);
+		close(conn_fd);
+	}
+
+	return NULL;
+}
+
+static int _wasp_if_metrics_start(const char *path, int period_ms)
+{
+	struct sockaddr_un addr;
+
+	if (!path || strlen(path) >= sizeof(metrics_path) || atomic_load(&metrics_running)) {
+		return -1;
+	}
+
+	strcpy(metrics_path, path);
+	metrics_period_ms = period_ms;
+
+	/* a local socket for period 0 */
+	if (!period_ms) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(addr.sun_path)) {
+			return -1;
+		}
+		strcpy(addr.sun_path, path);
+		unlink(path);
+		metrics_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (metrics_listen_fd < 0 ||
+		    bind(metrics_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+		    listen(metrics_listen_fd, 8)) {
+			printf("error listening on %s: %s\n", path, strerror(errno));
+			if (metrics_listen_fd >= 0) {
+				close(metrics_listen_fd);
+			}
+			metrics_listen_fd = -1;
+			return -1;
+		}
+	}
+
+	atomic_store(&metrics_running, 1);
+	if (pthread_create(&metrics_thread, NULL,
+		period_ms ? _wasp_if_metrics_file_thread : _wasp_if_metrics_socket_thread, NULL)) {
+		atomic_store(&metrics_running, 0);
+		if (metrics_listen_fd >= 0) {
+			close(metrics_listen_fd);
+			metrics_listen_fd = -1;
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+int wasp_if_metrics_write_file(const char *path, int period_ms)
+{
+	if (period_ms <= 0) {
+		return -1;
+	}
+
+	return _wasp_if_metrics_start(path, period_ms);
+}
+
+int wasp_if_metrics_listen(const char *socket_path)
+{
+	return _wasp_if_metrics_start(socket_path, 0);
+}
+
+void wasp_if_metrics_stop(void)
+{
+	if (!atomic_load(&metrics_running)) {
+		return;
+	}
+
+	pthread_mutex_lock(&metrics_lock);
+	atomic_store(&metrics_running, 0);
+	pthread_cond_signal(&metrics_cond);
+	pthread_mutex_unlock(&metrics_lock);
+
+	/* wakes accept() */
+	if (metrics_listen_fd >= 0) {
+		shutdown(metrics_listen_fd, SHUT_RDWR);
+	}
+
+	pthread_join(metrics_thread, NULL);
+
+	if (metrics_listen_fd >= 0) {
+		close(metrics_listen_fd);
+		metrics_listen_fd = -1;
+		unlink(metrics_path);
+	}
+}
+
+int wasp_if_trace_dump(const char *path)
+{
+	int out = -1;
+	int ret = 0;
+
+	if (!trace.slots) {
+		return -1;
+	}
+
+	out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		printf("error opening %s\n", path);
+		return -1;
+	}
+	ret = trace_ring_dump(&trace, out);
+	close(out);
+
+	return ret;
+}
+
+static void _wasp_if_trace_signal(int signum)
+{
+	int saved_errno = errno;
+	int out = -1;
+
+	(void)signum;
+	out = open(trace_signal_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out >= 0) {
+		trace_ring_dump(&trace, out);
+		close(out);
+	}
+	errno = saved_errno;
+}
+
+int wasp_if_trace_dump_on_signal(int signum, const char *path)
+{
+	struct sigaction sa;
+
+	if (!path || strlen(path) >= sizeof(trace_signal_path)) {
+		return -1;
+	}
+	strcpy(trace_signal_path, path);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _wasp_if_trace_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(signum, &sa, NULL)) {
+		printf("error installing signal handler\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void _wasp_if_trace(int type, int dev_index, int32_t a, int32_t b)
+{
+	trace_ring_record(&trace, (enum trace_type)type, dev_index, a, b);
+}
+
+int _wasp_if_path_obj_id(const char *path)
+{
+	const char *p = strstr(path, "/objects/");
+
+	if (!p || p[9] < '0' || p[9] > '9') {
+		return -1;
+	}
+
+	return atoi(&p[9]);
+}
+
+uint64_t _wasp_if_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+void _wasp_if_record_request(const char *ipv4_address, const uint64_t *stage_us, int status, int replayed)
+{
+	struct request_hists *rs = NULL;
+	uint64_t now = _wasp_if_time_us();
+	uint64_t end = 0;
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	int i = 0;
+	if (index == -1) {
+		return;
+	}
+
+	rs = &req_stats[index];
+	pthread_mutex_lock(_wasp_if_shard_lock(stats_locks, index));
+
+	/* the resent request is recorded once it completes */
+	if (replayed) {
+		rs->replays++;
+		pthread_mutex_unlock(_wasp_if_shard_lock(stats_locks, index));
+		return;
+	}
+
+	rs->requests++;
+	if (status < 0 || status >= 400) {
+		rs->errors++;
+	}
+
+	/* each stage ends when the next starts, the last stage reached ends now */
+	for (i = 0; i < WASP_IF_STAGE_TOTAL && stage_us[i]; i++) {
+		end = i + 1 < WASP_IF_STAGE_TOTAL && stage_us[i + 1] ? stage_us[i + 1] : now;
+		latency_hist_record(&rs->stages[i], end > stage_us[i] ? end - stage_us[i] : 0);
+	}
+	if (stage_us[WASP_IF_STAGE_QUEUE]) {
+		latency_hist_record(&rs->stages[WASP_IF_STAGE_TOTAL], now - stage_us[WASP_IF_STAGE_QUEUE]);
+	}
+
+	pthread_mutex_unlock(_wasp_if_shard_lock(stats_locks, index));
+}
+
+static int _wasp_if_cmp_int(const void *a, const void *b)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+
+	return (x > y) - (x < y);
+}
+
+static struct meter_ids * _wasp_if_collect_meter_ids(int index)
+{
+	struct json_field type;
+	struct store_index *idx = &objects[index].idx;
+	struct meter_ids *m = NULL;
+	int count = 0;
+	int i = 0;
+
+	object_store_read_lock(&objects[index]);
+
+	m = malloc(sizeof(*m) + idx->num_objs * sizeof(int));
+	if (!m) {
+		object_store_read_unlock(&objects[index]);
+		return NULL;
+	}
+
+	json_field_init(&type, "_type");
+	for (i = 0; i < idx->num_objs; i++) {
+		if (json_extract(idx->objs[i].json, idx->objs[i].len, &type, 1) != 1 ||
+		    !json_field_equals(&type, WASP_IF_METER_OBJ_TYPE, strlen(WASP_IF_METER_OBJ_TYPE))) {
+			continue;
+		}
+
+		m->ids[count++] = idx->objs[i].id;
+	}
+
+	object_store_read_unlock(&objects[index]);
+
+	if (count) {
+		qsort(m->ids, count, sizeof(int), _wasp_if_cmp_int);
+	}
+	m->num_ids = count;
+
+	return m;
+}
+
+/*
+ * Called on the device's HTTP client thread once its objects are read (at
+ * connect, on a resync or after a reconnect), so ctrl:meter objects added
+ * since are diverted too.  The IDs are only looked up on this thread, so the
+ * previous set can be freed at once.
+ */
+static void _wasp_if_refresh_meter_ids(int index)
+{
+	struct meter_channel *mc = &meters[index];
+	struct meter_ids *m = _wasp_if_collect_meter_ids(index);
+
+	if (m) {
+		free(atomic_exchange_explicit(&mc->ids, m, memory_order_acq_rel));
+	}
+}
+
+int wasp_if_meter_channel_enable(
+	const char *ipv4_address,
+	size_t capacity
+)
+{
+	struct meter_channel *mc = NULL;
+	struct meter_ids *ids = NULL;
+	struct meter_ids *none = NULL;
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		/* device not found */
+		return -1;
+	}
+
+	mc = &meters[index];
+	if (!atomic_load_explicit(&mc->ids, memory_order_acquire)) {
+		/* the objects are not read yet, the HTTP client thread replaces these IDs once they are */
+		ids = _wasp_if_collect_meter_ids(index);
+		if (!ids) {
+			return -1;
+		}
+		if (!atomic_compare_exchange_strong(&mc->ids, &none, ids)) {
+			free(ids);
+		}
+	}
+
+	if (!mc->ring.samples && meter_ring_init(&mc->ring, capacity)) {
+		return -1;
+	}
+
+	/* publish the ring and IDs to the HTTP client thread */
+	atomic_store_explicit(&mc->active, 1, memory_order_release);
+
+	return 0;
+}
+
+int wasp_if_meter_channel_disable(const char *ipv4_address)
+{
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		/* device not found */
+		return -1;
+	}
+
+	atomic_store_explicit(&meters[index].active, 0, memory_order_release);
+
+	return 0;
+}
+
+int wasp_if_meter_read(
+	const char *ipv4_address,
+	struct wasp_if_meter_sample *samples,
+	int max_samples,
+	uint64_t *dropped
+)
+{
+	struct meter_channel *mc = NULL;
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1 || max_samples < 0) {
+		return -1;
+	}
+
+	mc = &meters[index];
+	if (!mc->ring.samples) {
+		/* channel never enabled */
+		return -1;
+	}
+
+	if (dropped) {
+		*dropped = atomic_load_explicit(&mc->ring.dropped, memory_order_relaxed);
+	}
+
+	return (int)meter_ring_pop(&mc->ring, samples, max_samples);
+}
+
+static int _wasp_if_notify_meter_rcvd(
+	const char *ipv4_address,
+	int obj_id,
+	const char *prop,
+	int prop_len,
+	const char *val,
+	int val_len
+)
+{
+	struct wasp_if_meter_sample sample;
+	struct meter_channel *mc = NULL;
+	struct meter_ids *ids = NULL;
+	struct timespec ts;
+	const char *p = val;
+	const char *end = val + val_len;
+	char *next = NULL;
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		return 0;
+	}
+
+	mc = &meters[index];
+	if (!atomic_load_explicit(&mc->active, memory_order_acquire)) {
+		return 0;
+	}
+
+	ids = atomic_load_explicit(&mc->ids, memory_order_acquire);
+	if (!ids || !bsearch(&obj_id, ids->ids, ids->num_ids, sizeof(int), _wasp_if_cmp_int)) {
+		/* not a meter */
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	sample.timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	sample.obj_id = obj_id;
+	if (prop_len >= WASP_IF_METER_PROP_LEN) {
+		prop_len = WASP_IF_METER_PROP_LEN - 1;
+	}
+	memcpy(sample.prop, prop, prop_len);
+	sample.prop[prop_len] = '\0';
+
+	/* a number, or an array of numbers (one per channel) */
+	sample.num_vals = 0;
+	if (p < end && *p == '[') {
+		p++;
+	}
+	while (p < end && sample.num_vals < WASP_IF_METER_MAX_VALS) {
+		while (p < end && (*p == ' ' || *p == ',')) {
+			p++;
+		}
+		if (p >= end || *p == ']') {
+			break;
+		}
+		sample.vals[sample.num_vals] = strtod(p, &next);
+		if (next == p) {
+			break;
+		}
+		sample.num_vals++;
+		p = next;
+	}
+
+	meter_ring_push(&mc->ring, &sample);
+
+	return 1;
+}
+
+int _wasp_if_ipv4_to_device_index(const char *ipv4_address)
+{
+	/* HTTP client threads look up the same few devices over and over */
+	static _Thread_local int last_index = 0;
+	int i = 0;
+
+	if (!strcmp(ipv4_address, devices[last_index]) && devices[last_index][0]) {
+		return last_index;
+	}
+
+	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
+		if (!strcmp(ipv4_address, devices[i])) {
+			last_index = i;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void _wasp_if_store_schema(
+	const char *ipv4_address,
+	int pos,
+	const char *buf,
+	int len
+)
+{
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		return;
+	}
+
+	if (schema_store_append(&schemas[index], pos, buf, len)) {
+		printf("Out of memory storing schemas of %s\n", ipv4_address);
+	}
+}
+
+void _wasp_if_store_schemas_done(const char *ipv4_address, const char *schema_id)
+{
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		return;
+	}
+
+	if (schema_store_done(&schemas[index], schema_id)) {
+		printf("Out of memory storing schemas of %s\n", ipv4_address);
+	}
+}
+
+/*
+ * Look up a schema, reading it from the device first in lazy mode.
+ * Returns with the schema store read lock held on success.
+ */
+static int _wasp_if_schema_get(
+	int index,
+	const char *schema_id,
+	const char **schema,
+	int *schema_len
+)
+{
+	struct wasp_if_msg msg;
+	char buf[WASP_IF_PATH_LEN];
+	int all_read = 0;
+
+	schema_store_read_lock(&schemas[index]);
+	if (!schema_store_find(&schemas[index], schema_id, schema, schema_len)) {
+		return 0;
+	}
+	all_read = schemas[index].all != NULL;
+	schema_store_read_unlock(&schemas[index]);
+
+	/* not found in the whole schemas document, the device does not have it */
+	if (!config.lazy_schemas || all_read) {
+		return -1;
+	}
+
+	/* read just this schema, or all schemas if the device cannot */
+	snprintf(buf, sizeof(buf), "/wasp/r2/schemas/%s", schema_id);
+	_wasp_if_msg_init(&msg, "GET", devices[index], buf, NULL);
+	if (_wasp_if_request(&msg) != 200) {
+		_wasp_if_msg_init(&msg, "GET", devices[index], "/wasp/r2/schemas", NULL);
+		_wasp_if_request(&msg);
+	}
+
+	schema_store_read_lock(&schemas[index]);
+	if (!schema_store_find(&schemas[index], schema_id, schema, schema_len)) {
+		return 0;
+	}
+	schema_store_read_unlock(&schemas[index]);
+
+	return -1;
+}
+
+int wasp_if_schema_prefetch(
+	const char *ipv4_address,
+	const char * const *obj_types,
+	int num_types
+)
+{
+	char (*ids)[WASP_IF_OBJ_PROP_LEN] = NULL;
+	struct json_field fields[2];
+	char obj_type[WASP_IF_OBJ_TYPE_LEN];
+	char schema_id[WASP_IF_OBJ_PROP_LEN];
+	const char *schema = NULL;
+	struct store_index *idx = NULL;
+	int schema_len = 0;
+	int num_ids = 0;
+	int failed = 0;
+	int index = 0;
+	int i = 0;
+	int j = 0;
+
+	index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		/* device not found */
+		return -1;
+	}
+
+	/* collect the schema IDs of the stored objects of the given types */
+	json_field_init(&fields[0], "_type");
+	json_field_init(&fields[1], "_schema");
+	object_store_read_lock(&objects[index]);
+	idx = &objects[index].idx;
+	ids = malloc((idx->num_objs + 1) * sizeof(*ids));
+	if (!ids) {
+		object_store_read_unlock(&objects[index]);
+		return -1;
+	}
+	for (i = 0; i < idx->num_objs; i++) {
+		json_extract(idx->objs[i].json, idx->objs[i].len, fields, 2);
+		if (json_field_get_string(&fields[0], obj_type, sizeof(obj_type)) <= 0 ||
+		    json_field_get_string(&fields[1], schema_id, sizeof(schema_id)) <= 0) {
+			continue;
+		}
+		for (j = 0; j < num_types; j++) {
+			if (!strcmp(obj_type, obj_types[j])) {
+				break;
+			}
+		}
+		if (j == num_types) {
+			continue;
+		}
+		for (j = 0; j < num_ids; j++) {
+			if (!strcmp(ids[j], schema_id)) {
+				break;
+			}
+		}
+		if (j == num_ids) {
+			strcpy(ids[num_ids++], schema_id);
+		}
+	}
+	object_store_read_unlock(&objects[index]);
+
+	/* read each schema not stored yet */
+	for (i = 0; i < num_ids; i++) {
+		if (_wasp_if_schema_get(index, ids[i], &schema, &schema_len)) {
+			failed++;
+			continue;
+		}
+		schema_store_read_unlock(&schemas[index]);
+	}
+
+	free(ids);
+
+	return failed ? -1 : 0;
+}
+
+int wasp_if_schema_copy_all(
+	const char *ipv4_address,
+	char **json,
+	size_t *json_len
+)
+{
+	struct wasp_if_msg msg;
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		/* device not found */
+		return -1;
+	}
+
+	schema_store_read_lock(&schemas[index]);
+	if (!schemas[index].all) {
+		schema_store_read_unlock(&schemas[index]);
+		_wasp_if_msg_init(&msg, "GET", devices[index], "/wasp/r2/schemas", NULL);
+		_wasp_if_request(&msg);
+		schema_store_read_lock(&schemas[index]);
+	}
+
+	*json = schemas[index].all ? malloc(schemas[index].all_len + 1) : NULL;
+	if (!*json) {
+		schema_store_read_unlock(&schemas[index]);
+		return -1;
+	}
+	memcpy(*json, schemas[index].all, schemas[index].all_len + 1);
+	*json_len = schemas[index].all_len;
+	schema_store_read_unlock(&schemas[index]);
+
+	return 0;
+}
+
+void _wasp_if_store_object(
+	const char *ipv4_address,
+	int pos,
+	const char *buf,
+	int len
+)
+{
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		return;
+	}
+
+	if (object_store_append(&objects[index], pos, buf, len)) {
+		printf("Out of memory storing objects of %s\n", ipv4_address);
+	}
+}
+
+/* emit an update for each property of obj that differs from old_obj */
+static void _wasp_if_emit_changed_props(
+	const char *ipv4_address,
+	const struct store_obj *obj,
+	const struct store_obj *old_obj
+)
+{
+	char path[WASP_IF_PATH_LEN];
+	struct json_path prop_path;
+	char update_body[WASP_IF_BODY_LEN];
+	int koff, klen, voff, vlen, vtype;
+	const char *old_val = NULL;
+	int old_len = 0;
+	int offset = 0;
+
+	snprintf(path, sizeof(path), "/objects/%d", obj->id);
+
+	while (1) {
+		offset = json_next(obj->json, obj->len, offset, &koff, &klen, &voff, &vlen, &vtype);
+		if (offset == 0) {
+			break;
+		}
+
+		if (klen - 2 > WASP_IF_OBJ_PROP_LEN) {
+			continue;
+		}
+
+		if (old_obj) {
+			if (!json_path_compile(&prop_path, &obj->json[koff + 1], klen - 2) &&
+			    json_path_find(&prop_path, old_obj->json, old_obj->len, &old_val, &old_len) &&
+			    old_len == vlen && !memcmp(old_val, &obj->json[voff], vlen)) {
+				continue;
+			}
+		}
+
+		snprintf(update_body, sizeof(update_body), "{%.*s:%.*s}",
+			klen, &obj->json[koff], vlen, &obj->json[voff]);
+		_wasp_if_notify_update_stream_rcvd(ipv4_address, path, update_body);
+	}
+}
+
+void _wasp_if_store_objects_done(const char *ipv4_address, int resync)
+{
+	struct store_index idx;
+	struct store_delta delta;
+	struct store_change *change = NULL;
+	struct store_obj old_obj;
+	struct object_store *st = NULL;
+	int i = 0;
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1) {
+		return;
+	}
+
+	st = &objects[index];
+	if (!resync) {
+		if (object_store_parse(st->raw, st->raw_len, &idx)) {
+			printf("Unable to parse objects of %s\n", ipv4_address);
+			return;
+		}
+
+		/* idx now holds the objects stored before this download */
+		object_store_swap(st, &idx);
+		store_index_free(&idx);
+		_wasp_if_refresh_meter_ids(index);
+		return;
+	}
+
+	/* keep unchanged objects, replace only those that differ */
+	if (object_store_resync(st, &delta)) {
+		printf("Unable to parse objects of %s\n", ipv4_address);
+		return;
+	}
+
+	/*
+	 * Only this thread modifies the store, so the new objects can be
+	 * read without the lock.  Updates are emitted for the properties of
+	 * the changed objects that differ from the stored copy.
+	 */
+	for (i = 0; i < delta.num_changes; i++) {
+		change = &delta.changes[i];
+		old_obj.id = st->idx.objs[change->pos].id;
+		old_obj.json = change->old_json;
+		old_obj.len = change->old_len;
+		_wasp_if_emit_changed_props(ipv4_address, &st->idx.objs[change->pos],
+			change->old_json ? &old_obj : NULL);
+	}
+
+	store_delta_free(&delta);
+	_wasp_if_refresh_meter_ids(index);
+}
+
+int wasp_if_load_device(
+	unsigned int device_index,
+	const char *ipv4_address,
+	const char *objects_json,
+	size_t objects_json_len,
+	const char *schemas_json,
+	size_t schemas_json_len
+)
+{
+	struct store_index idx;
+
+	if (device_index >= WASP_IF_MAX_DEVICES) {
+		printf("Device index %d is greater than MAX_DEVICES (%d)\n",
+			device_index,
+			WASP_IF_MAX_DEVICES);
+		return -1;
+	}
+
+	strncpy(devices[device_index], ipv4_address, WASP_IF_IPV4_ADDRESS_LEN-1);
+	devices[device_index][WASP_IF_IPV4_ADDRESS_LEN-1] = '\0';
+
+	if (object_store_parse(objects_json, objects_json_len, &idx)) {
+		printf("Unable to parse objects of %s\n", ipv4_address);
+		return -1;
+	}
+	object_store_swap(&objects[device_index], &idx);
+	store_index_free(&idx);
+
+	if (schemas_json) {
+		if (schema_store_append(&schemas[device_index], 0, schemas_json, schemas_json_len) ||
+		    schema_store_done(&schemas[device_index], NULL)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int wasp_if_resync_device(const char *ipv4_address)
+{
+	struct wasp_if_msg msg;
+
+	if (_wasp_if_ipv4_to_device_index(ipv4_address) == -1) {
+		/* device not found */
+		return -1;
+	}
+
+	/* the HTTP client thread diffs the objects against the stored objects */
+	_wasp_if_msg_init(
+		&msg,
+		"GET",
+		ipv4_address,
+		"/wasp/r2/objects",
+		NULL);
+	msg.flags = WASP_IF_MSG_DIFF;
+
+	return _wasp_if_request(&msg) == 200 ? 0 : -1;
+}
+
+/* one distinct object of a wasp_if_object_read_bulk() call */
+struct bulk_obj {
+	int obj_id;
+	int status;            /* of its GET */
+	int err;               /* response not stored, out of memory */
+	char *json;            /* response, NUL terminated */
+	int len;
+	int cap;
+};
+
+struct wasp_if_bulk {
+	sem_t done;            /* posted when the last GET completes */
+	atomic_int remaining;
+	struct bulk_obj *objs; /* sorted by ID */
+	int num_objs;
+};
+
+/* response data of a bulk read GET, on the HTTP client thread */
+void _wasp_if_bulk_data(struct wasp_if_bulk *bulk, int slot, int pos, const char *buf, int len)
+{
+	struct bulk_obj *o = &bulk->objs[slot];
+	int cap = o->cap;
+	char *tmp = NULL;
+
+	if (pos + len + 1 > cap) {
+		cap = cap ? cap : 1024;
+		while (pos + len + 1 > cap) {
+			cap *= 2;
+		}
+		tmp = realloc(o->json, cap);
+		if (!tmp) {
+			o->err = 1;
+			return;
+		}
+		o->json = tmp;
+		o->cap = cap;
+	}
+
+	memcpy(&o->json[pos], buf, len);
+	o->len = pos + len;
+	o->json[o->len] = '\0';
+}
 
-	return 0;
+void _wasp_if_bulk_complete(struct wasp_if_bulk *bulk, int slot, int status)
+{
+	bulk->objs[slot].status = bulk->objs[slot].err ? -1 : status;
+	if (atomic_fetch_sub(&bulk->remaining, 1) == 1) {
+		sem_post(&bulk->done);
+	}
 }
 
-int _wasp_if_msg_write(struct wasp_if_msg *msg)
+/* read one property of a bulk read from the object's text */
+static int _wasp_if_bulk_fill(struct wasp_if_bulk_read *r, const char *json, int len)
 {
-	size_t bytes_left = sizeof(*msg);
-	uint8_t *buf_ptr = (uint8_t *)msg;
-	while (bytes_left > 0) {
-		ssize_t retval = write(fd[1], buf_ptr, bytes_left);
-		if (retval < 0) {
-			printf("fail writing to pipe\n");
-			return -1;
+	struct json_path prop_path;
+	double num = 0;
+
+	r->status = -1;
+	if (!r->prop_name || json_path_compile(&prop_path, r->prop_name, strlen(r->prop_name))) {
+		return -1;
+	}
+
+	switch (r->type) {
+	case WASP_IF_PROP_NUM:
+		if (json_path_get_number(&prop_path, json, len, &num)) {
+			r->num = (int)num;
+			r->status = 0;
 		}
-		bytes_left -= retval;
-		buf_ptr += retval;
+		break;
+	case WASP_IF_PROP_BOOL:
+		if (json_path_get_bool(&prop_path, json, len, &r->num)) {
+			r->status = 0;
+		}
+		break;
+	case WASP_IF_PROP_STR:
+		if (json_path_get_string(&prop_path, json, len, r->str, sizeof(r->str)) != -1) {
+			r->status = 0;
+		}
+		break;
+	default:
+		break;
 	}
 
-	return 0;
+	return r->status;
 }
 
-int _wasp_if_msg_read(struct wasp_if_msg *msg)
+/* bulk read from the stored objects, under one read lock */
+static int _wasp_if_bulk_read_stored(int index, struct wasp_if_bulk_read *reads, int num_reads)
 {
-	ssize_t ret = read(fd[0], msg, sizeof(*msg));
-	if (ret < 0) {
-		if (errno != EAGAIN) {
-			printf("read pipe error\n");
+	const struct store_obj *obj = NULL;
+	int count = 0;
+	int i = 0;
+
+	object_store_read_lock(&objects[index]);
+	for (i = 0; i < num_reads; i++) {
+		obj = store_index_find(&objects[index].idx, reads[i].obj_id);
+		if (!obj) {
+			reads[i].status = -1;
+		} else if (!_wasp_if_bulk_fill(&reads[i], obj->json, obj->len)) {
+			count++;
 		}
-	} else if (!ret) {
-		printf("EOF reading from pipe\n");
-	} else {
-		return 1;
 	}
+	object_store_read_unlock(&objects[index]);
 
-	return 0;
+	return count;
 }
 
-void _wasp_if_msg_init(
-	struct wasp_if_msg *msg,
-	const char *method,
-	const char *ipv4_address,
-	const char *path,
-	const char *body
-)
+static int _wasp_if_cmp_bulk_obj(const void *a, const void *b)
 {
-	memset(msg, 0, sizeof(*msg));
-	strncpy(msg->method, method, WASP_IF_METHOD_LEN-1);
-	msg->method[WASP_IF_METHOD_LEN-1] = '\0';
-	strncpy(msg->ipv4_address, ipv4_address, WASP_IF_IPV4_ADDRESS_LEN-1);
-	msg->ipv4_address[WASP_IF_IPV4_ADDRESS_LEN-1] = '\0';
-	strncpy(msg->path, path, WASP_IF_PATH_LEN-1);
-	msg->path[WASP_IF_PATH_LEN-1] = '\0';
-	if (body) {
-		strncpy(msg->body, body, WASP_IF_BODY_LEN-1);
-		msg->body[WASP_IF_BODY_LEN-1] = '\0';
-	}
+	int x = ((const struct bulk_obj *)a)->obj_id;
+	int y = ((const struct bulk_obj *)b)->obj_id;
+
+	return (x > y) - (x < y);
 }
 
-void _wasp_if_notify_update_stream_rcvd(
-	const char *ipv4_address,
-	const char *path,
-	const char *update_body
-)
+/* GET path, or each object of the set if NULL, and wait for all of the responses */
+static void _wasp_if_bulk_fetch(struct wasp_if_bulk *bulk, const char *ipv4_address, const char *path)
 {
-	_u_cb(ipv4_address, path, update_body);
+	struct wasp_if_msg bulk_msg;
+	char obj_path[WASP_IF_PATH_LEN];
+	int num = path ? 1 : bulk->num_objs;
+	int j = 0;
+
+	sem_init(&bulk->done, 0, 0);
+	atomic_init(&bulk->remaining, num);
+	for (j = 0; j < num; j++) {
+		if (!path) {
+			snprintf(obj_path, sizeof(obj_path), "/wasp/r2/objects/%d", bulk->objs[j].obj_id);
+		}
+		_wasp_if_msg_init(&bulk_msg, "GET", ipv4_address, path ? path : obj_path, NULL);
+		bulk_msg.bulk = bulk;
+		bulk_msg.bulk_slot = j;
+		if (_wasp_if_msg_write(&bulk_msg)) {
+			_wasp_if_bulk_complete(bulk, j, -1);
+		}
+	}
+	if (num) {
+		sem_wait(&bulk->done);
+	}
+	sem_destroy(&bulk->done);
 }
 
-int _wasp_if_ipv4_to_device_index(const char *ipv4_address)
+/* bulk read from one GET of all the objects, parsed apart from the stored objects */
+static int _wasp_if_bulk_read_dump(const char *ipv4_address, struct wasp_if_bulk_read *reads, int num_reads)
 {
+	struct wasp_if_bulk bulk;
+	struct bulk_obj dump;
+	struct store_index idx;
+	const struct store_obj *obj = NULL;
+	int count = 0;
 	int i = 0;
-	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
-		if (!strcmp(ipv4_address, devices[i])) {
-			return i;
+
+	memset(&bulk, 0, sizeof(bulk));
+	memset(&dump, 0, sizeof(dump));
+	bulk.objs = &dump;
+	bulk.num_objs = 1;
+	_wasp_if_bulk_fetch(&bulk, ipv4_address, "/wasp/r2/objects");
+
+	if (dump.status != 200 || !dump.json || object_store_parse(dump.json, dump.len, &idx)) {
+		for (i = 0; i < num_reads; i++) {
+			reads[i].status = dump.status == 200 ? -1 : dump.status;
+		}
+		free(dump.json);
+		return 0;
+	}
+	free(dump.json);
+
+	for (i = 0; i < num_reads; i++) {
+		obj = store_index_find(&idx, reads[i].obj_id);
+		if (!obj) {
+			reads[i].status = -1;
+		} else if (!_wasp_if_bulk_fill(&reads[i], obj->json, obj->len)) {
+			count++;
 		}
 	}
+	store_index_free(&idx);
 
-	return -1;
+	return count;
 }
 
-void _wasp_if_store_schema(
+int wasp_if_object_read_bulk(
 	const char *ipv4_address,
-	int pos,
-	const char *buf,
-	int len
+	struct wasp_if_bulk_read *reads,
+	int num_reads,
+	int cached
 )
 {
-	if ((strlen(buf) + pos + len) > MAX_LEN) {
-		return;
+	struct wasp_if_bulk bulk;
+	struct bulk_obj key;
+	struct bulk_obj *o = NULL;
+	int num_stored = 0;
+	int count = 0;
+	int index = 0;
+	int i = 0;
+	int j = 0;
+
+	index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index == -1 || num_reads < 0 || (num_reads && !reads)) {
+		return -1;
 	}
 
-	char *schs = NULL;
-	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
-	if (index == -1) {
-		return;
+	if (cached) {
+		return _wasp_if_bulk_read_stored(index, reads, num_reads);
+	}
+
+	/* the distinct objects, each fetched once */
+	memset(&bulk, 0, sizeof(bulk));
+	bulk.objs = calloc(num_reads ? num_reads : 1, sizeof(*bulk.objs));
+	if (!bulk.objs) {
+		return -1;
+	}
+	for (i = 0; i < num_reads; i++) {
+		bulk.objs[i].obj_id = reads[i].obj_id;
+	}
+	qsort(bulk.objs, num_reads, sizeof(*bulk.objs), _wasp_if_cmp_bulk_obj);
+	for (i = 0; i < num_reads; i++) {
+		if (!bulk.num_objs || bulk.objs[bulk.num_objs - 1].obj_id != bulk.objs[i].obj_id) {
+			bulk.objs[bulk.num_objs++].obj_id = bulk.objs[i].obj_id;
+		}
 	}
 
-	schs = schemas[index];
+	object_store_read_lock(&objects[index]);
+	num_stored = objects[index].idx.num_objs;
+	object_store_read_unlock(&objects[index]);
+
+	/* many objects - one download of all of them is cheaper than a GET each */
+	if (bulk.num_objs > WASP_IF_BULK_MAX_GETS || (num_stored && bulk.num_objs * 4 > num_stored)) {
+		free(bulk.objs);
+		return _wasp_if_bulk_read_dump(ipv4_address, reads, num_reads);
+	}
+
+	/* queue all the GETs, then wait once for all of them */
+	_wasp_if_bulk_fetch(&bulk, ipv4_address, NULL);
+
+	for (i = 0; i < num_reads; i++) {
+		key.obj_id = reads[i].obj_id;
+		o = bsearch(&key, bulk.objs, bulk.num_objs, sizeof(*bulk.objs), _wasp_if_cmp_bulk_obj);
+		if (o->status != 200 || !o->json) {
+			reads[i].status = o->status == 200 ? -1 : o->status;
+		} else if (!_wasp_if_bulk_fill(&reads[i], o->json, o->len)) {
+			count++;
+		}
+	}
 
-	if (!pos) {
-		memset(schs, 0, sizeof(*schs));
+	for (j = 0; j < bulk.num_objs; j++) {
+		free(bulk.objs[j].json);
 	}
+	free(bulk.objs);
 
-	strncpy(&schs[pos], buf, len);
+	return count;
 }
 
-void _wasp_if_store_object(
+void _wasp_if_notify_property_rcvd(
 	const char *ipv4_address,
-	int pos,
-	const char *buf,
-	int len
+	int obj_id,
+	const char *path,
+	const char *prop,
+	int prop_len,
+	const char *val,
+	int val_len
 )
 {
-	if ((strlen(buf) + pos + len) > MAX_LEN) {
-		return;
-	}
+	char update_path[WASP_IF_PATH_LEN];
+	char update_body[WASP_IF_BODY_LEN];
+	int index = 0;
 
-	char *objs = NULL;
-	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
-	if (index == -1) {
+	/* ctrl:meter updates go to the meter channel when enabled */
+	if (_wasp_if_notify_meter_rcvd(ipv4_address, obj_id, prop, prop_len, val, val_len)) {
 		return;
 	}
 
-	objs = objects[index];
-
-	if (!pos) {
-		memset(objs, 0, sizeof(*objs));
+	/* keep the stored objects current */
+	index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (index != -1) {
+		object_store_set_prop(&objects[index], obj_id, prop, prop_len, val, val_len);
 	}
 
-	strncpy(&objs[pos], buf, len);
-}
-
-void _wasp_if_store_single_object(const char *buf)
-{
-	memset(resp_buffer, 0, WASP_IF_RESP_BUF_LEN);
-	strncpy(resp_buffer, buf, WASP_IF_RESP_BUF_LEN-1);
-	resp_buffer[WASP_IF_RESP_BUF_LEN-1] = '\0';
-}
-
-int _wasp_if_get_last_err_code(void)
-{
-	return last_err_code;
+	if (!path) {
+		snprintf(update_path, sizeof(update_path), "/objects/%d", obj_id);
+		path = update_path;
+	}
+	snprintf(update_body, sizeof(update_body), "{\"%.*s\":%.*s}", prop_len, prop, val_len, val);
+	_wasp_if_notify_update_stream_rcvd(ipv4_address, path, update_body);
 }
 
-void _wasp_if_notify_request_complete()
+void _wasp_if_store_single_object(struct wasp_if_waiter *w, const char *buf)
 {
-	sem_post(&s_request_done);
+	strncpy(w->resp, buf, WASP_IF_RESP_BUF_LEN-1);
+	w->resp[WASP_IF_RESP_BUF_LEN-1] = '\0';
 }
 
-void _wasp_if_store_last_err_code(int code)
+void _wasp_if_notify_request_complete(struct wasp_if_waiter *w, int status)
 {
-	last_err_code = code;
+	w->status = status;
+	sem_post(&w->done);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -268,20 +2062,20 @@ int _wasp_if_object_set_property(
 	size_t update_body_len
 )
 {
-	if (update_body_len > WASP_IF_BODY_LEN) {
+	struct wasp_if_msg msg;
+	char path[WASP_IF_PATH_LEN];
+
+	snprintf(path, WASP_IF_PATH_LEN, "/wasp/r2/objects/%d", obj_id);
+	_wasp_if_msg_init(&msg, "PATCH", ipv4_address, path, NULL);
+	if (_wasp_if_msg_body(&msg, update_body, update_body_len)) {
 		/* size validation */
 		return -1;
 	}
 
-	char path[WASP_IF_PATH_LEN];
-	snprintf(path, WASP_IF_PATH_LEN, "/wasp/r2/objects/%d", obj_id);
-	_wasp_if_msg_init(&msg, "PATCH", ipv4_address, path, update_body);
-	_wasp_if_msg_write(&msg);
-	sem_wait(&s_request_done);
-
-	return last_err_code;
+	return _wasp_if_request(&msg);
 }
 
+/* when cached, returns with the store read lock held - release with _wasp_if_object_release() */
 int _wasp_if_object_get_property_obj(
 	const char *ipv4_address,
 	int obj_id,
@@ -290,12 +2084,9 @@ int _wasp_if_object_get_property_obj(
 	int *object_len
 )
 {
+	struct wasp_if_msg msg;
 	char buf[WASP_IF_BODY_LEN];
-	double num;
-	int koff, klen, voff, vlen, vtype;
-	int ret = 0;
-	int offset = 0;
-	const char *objs = NULL;
+	struct store_obj *obj = NULL;
 	int index = 0;
 
 	index = _wasp_if_ipv4_to_device_index(ipv4_address);
@@ -303,36 +2094,26 @@ int _wasp_if_object_get_property_obj(
 		return -1;
 	}
 
-	objs = objects[index];
-
 	if (cached) {
 		/* look up the property in the stored objects */
-		while (1) {
-			offset = json_next(objs, strlen(objs), offset, &koff, &klen, &voff, &vlen, &vtype);
-			if (offset == 0) {
-				break;
-			}
-
-			ret = json_get_number(&objs[voff], vlen, "$._id", &num);
-			if (ret != 0) {
-				if (obj_id != (int)num) {
-					continue;
-				}
-			}
+		object_store_read_lock(&objects[index]);
+		obj = store_index_find(&objects[index].idx, obj_id);
+		if (!obj) {
+			object_store_read_unlock(&objects[index]);
+			return -1;
+		}
 
-			*object = &objs[voff];
-			*object_len = vlen;
+		*object = obj->json;
+		*object_len = obj->len;
 
-			return 0;
-		}
+		return 0;
 	} else {
 		/* send a GET requst and wait on the response */
 		snprintf(buf, WASP_IF_BODY_LEN, "/wasp/r2/objects/%d", obj_id);
 		_wasp_if_msg_init(&msg, "GET", ipv4_address, buf, NULL);
-		_wasp_if_msg_write(&msg);
-		sem_wait(&s_request_done);
-		*object = resp_buffer;
-		*object_len = strlen(resp_buffer);
+		_wasp_if_request(&msg);
+		*object = waiter.resp;
+		*object_len = strlen(waiter.resp);
 
 		return 0;
 	}
@@ -340,6 +2121,14 @@ int _wasp_if_object_get_property_obj(
 	return -1;
 }
 
+static void _wasp_if_object_release(const char *ipv4_address, int cached)
+{
+	int index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (cached && index != -1) {
+		object_store_read_unlock(&objects[index]);
+	}
+}
+
 const char * _wasp_if_ipv4_to_auth_str(const char *ipv4_address)
 {
 	int i = 0;
@@ -357,7 +2146,7 @@ int _wasp_if_store_auth_str(const char *ipv4_address, const char *auth_str)
 	int i = 0;
 	for (i = 0; i < WASP_IF_MAX_DEVICES; i++) {
 		if (!strcmp(ipv4_address, devices[i])) {
-			strncpy(wasp_auth_strs[i], auth_str, WASP_IF_AUTH_STR_LEN);
+			strncpy(wasp_auth_strs[i], auth_str, WASP_IF_AUTH_STR_LEN - 1);
 			return 0;
 		}
 	}
@@ -367,6 +2156,21 @@ int _wasp_if_store_auth_str(const char *ipv4_address, const char *auth_str)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/* fields of a candidate object compared by wasp_if_get_obj_id() */
+enum obj_id_field {
+	OBJ_ID_TYPE,
+	OBJ_ID_IO_TYPE,
+	OBJ_ID_IO_DIR,
+	OBJ_ID_IO_IDX,
+	OBJ_ID_NUM_FIELDS
+};
+
+/* a string field that is present and differs, absent fields match anything */
+static int _wasp_if_field_differs(const struct json_field *f, const char *str)
+{
+	return f->type == JSON_TOK_STRING && !json_field_equals(f, str, strlen(str));
+}
+
 int wasp_if_get_obj_id(
 	const char *ipv4_address,
 	const char *obj_type,
@@ -377,12 +2181,12 @@ int wasp_if_get_obj_id(
 	size_t io_dir_len,
 	int io_idx)
 {
-	char buf[WASP_IF_BODY_LEN];
+	struct json_field fields[OBJ_ID_NUM_FIELDS];
 	double num;
-	int koff, klen, voff, vlen, vtype;
-	int ret = 0;
-	int offset = 0;
-	const char *objs = NULL;
+	int i = 0;
+	int id = -1;
+	const struct store_index *idx = NULL;
+	const struct store_obj *obj = NULL;
 	int index = 0;
 
 	index = _wasp_if_ipv4_to_device_index(ipv4_address);
@@ -398,57 +2202,47 @@ int wasp_if_get_obj_id(
 		return -1;
 	}
 
-	objs = objects[index];
+	json_field_init(&fields[OBJ_ID_TYPE], "_type");
+	json_field_init(&fields[OBJ_ID_IO_TYPE], "io_type");
+	json_field_init(&fields[OBJ_ID_IO_DIR], "io_dir");
+	json_field_init(&fields[OBJ_ID_IO_IDX], "io_idx");
 
-	while (1) {
-		offset = json_next(objs, strlen(objs), offset, &koff, &klen, &voff, &vlen, &vtype);
-		if (offset == 0) {
-			break;
-		}
+	object_store_read_lock(&objects[index]);
+	idx = &objects[index].idx;
 
-		ret = json_get_string(&objs[voff], vlen, "$._type", buf, sizeof(buf));
-		if (ret != -1) {
-			if (strcmp(obj_type, buf)) {
-				continue;
-			}
-		}
+	for (i = 0; i < idx->num_objs; i++) {
+		obj = &idx->objs[i];
 
-		if (io_type) {
-			ret = json_get_string(&objs[voff], vlen, "$.io_type", buf, sizeof(buf));
-			if (ret != -1) {
-				if (strcmp(io_type, buf)) {
-					continue;
-				}
-			}
+		/* all the compared fields in one pass over the object */
+		json_extract(obj->json, obj->len, fields, OBJ_ID_NUM_FIELDS);
+
+		if (_wasp_if_field_differs(&fields[OBJ_ID_TYPE], obj_type)) {
+			continue;
 		}
 
+		if (io_type && _wasp_if_field_differs(&fields[OBJ_ID_IO_TYPE], io_type)) {
+			continue;
+		}
 
-		if (io_dir) {
-			ret = json_get_string(&objs[voff], vlen, "$.io_dir", buf, sizeof(buf));
-			if (ret != -1) {
-				if (strcmp(io_dir, buf)) {
-					continue;
-				}
-			}
+		if (io_dir && _wasp_if_field_differs(&fields[OBJ_ID_IO_DIR], io_dir)) {
+			continue;
 		}
 
-		if (io_type && io_idx) {
-			ret = json_get_number(&objs[voff], vlen, "$.io_idx", &num);
-			if (ret != 0) {
-				if (io_idx != (int)num) {
-					continue;
-				}
-			}
+		if (io_type && io_idx && json_field_get_number(&fields[OBJ_ID_IO_IDX], &num) &&
+		    io_idx != (int)num) {
+			continue;
 		}
 
-		ret = json_get_number(&objs[voff], vlen, "$._id", &num);
-		if (ret != 0) {
-			return (int)num;
+		if (obj->id != -1) {
+			id = obj->id;
+			break;
 		}
 	}
 
-	/* not found */
-	return -1;
+	object_store_read_unlock(&objects[index]);
+
+	/* -1 if not found */
+	return id;
 }
 
 int wasp_if_get_ctrl_id(
@@ -458,12 +2252,12 @@ int wasp_if_get_ctrl_id(
 	int parent_id
 )
 {
-	char buf[WASP_IF_BODY_LEN];
+	struct json_field fields[2];
 	double num;
-	int koff, klen, voff, vlen, vtype;
-	int ret = 0;
-	int offset = 0;
-	const char *objs = NULL;
+	int i = 0;
+	int id = -1;
+	const struct store_index *idx = NULL;
+	const struct store_obj *obj = NULL;
 	int index = 0;
 
 	index = _wasp_if_ipv4_to_device_index(ipv4_address);
@@ -477,35 +2271,66 @@ int wasp_if_get_ctrl_id(
 		return -1;
 	}
 
-	objs = objects[index];
+	json_field_init(&fields[0], "_type");
+	json_field_init(&fields[1], "_parent");
 
-	while (1) {
+	object_store_read_lock(&objects[index]);
+	idx = &objects[index].idx;
 
-		offset = json_next(objs, strlen(objs), offset, &koff, &klen, &voff, &vlen, &vtype);
-		if (offset == 0) {
-			break;
-		}
+	for (i = 0; i < idx->num_objs; i++) {
+		obj = &idx->objs[i];
 
-		ret = json_get_string(&objs[voff], vlen, "$._type", buf, sizeof(buf));
-		if (ret != -1) {
-			if (strcmp(obj_type, buf)) {
-				continue;
-			}
+		json_extract(obj->json, obj->len, fields, 2);
+
+		if (_wasp_if_field_differs(&fields[0], obj_type)) {
+			continue;
 		}
 
-		ret = json_get_number(&objs[voff], vlen, "$._parent", &num);
-		if (ret != 0) {
-			if (parent_id != (int)num) {
-				continue;
-			}
+		if (json_field_get_number(&fields[1], &num) && parent_id != (int)num) {
+			continue;
 		}
 
-		ret = json_get_number(&objs[voff], vlen, "$._id", &num);
-		if (ret != 0) {
-			return (int)num;
+		if (obj->id != -1) {
+			id = obj->id;
+			break;
 		}
 	}
 
+	object_store_read_unlock(&objects[index]);
+
+	/* -1 if not found */
+	return id;
+}
+
+int wasp_if_object_get_property_str_h(
+	const char *ipv4_address,
+	int obj_id,
+	const struct json_path *prop_path,
+	char *prop,
+	size_t prop_len,
+	int cached
+)
+{
+	int ret = 0;
+	int object_len = 0;
+	const char *object;
+
+	if (prop_len > WASP_IF_OBJ_PROP_LEN) {
+		/* size validation */
+		return -1;
+	}
+
+	if (_wasp_if_object_get_property_obj(ipv4_address, obj_id, cached, &object, &object_len)) {
+		/* error */
+		return -1;
+	}
+
+	ret = json_path_get_string(prop_path, object, object_len, prop, prop_len);
+	_wasp_if_object_release(ipv4_address, cached);
+	if (ret != -1) {
+		return cached ? 0 : waiter.status;
+	}
+
 	/* not found */
 	return -1;
 }
@@ -520,62 +2345,89 @@ int wasp_if_object_get_property_str(
 	int cached
 )
 {
-	int ret = 0;
-	char buf[WASP_IF_BODY_LEN];
-	int object_len = 0;
-	const char *object;
+	struct json_path prop_path;
 
 	if (prop_name_len > WASP_IF_OBJ_PROP_LEN ||
-	    prop_len > WASP_IF_OBJ_PROP_LEN) {
+	    json_path_compile(&prop_path, prop_name, strlen(prop_name))) {
 		/* size validation */
 		return -1;
 	}
 
+	return wasp_if_object_get_property_str_h(ipv4_address, obj_id, &prop_path, prop, prop_len, cached);
+}
+
+int wasp_if_object_get_property_num_h(
+	const char *ipv4_address,
+	int obj_id,
+	const struct json_path *prop_path,
+	int *prop,
+	int cached
+)
+{
+	int ret = 0;
+	double num = 0;
+	int object_len = 0;
+	const char *object;
+
 	if (_wasp_if_object_get_property_obj(ipv4_address, obj_id, cached, &object, &object_len)) {
 		/* error */
 		return -1;
 	}
 
-	snprintf(buf, WASP_IF_BODY_LEN, "$.%s", prop_name);
-	ret = json_get_string(object, object_len, buf, prop, prop_len);
-	if (ret != -1) {
-		return cached ? 0 : last_err_code;
-	}
-
-	/* not found */
-	return -1;
+	ret = json_path_get_number(prop_path, object, object_len, &num);
+	_wasp_if_object_release(ipv4_address, cached);
+	if (ret != 0) {
+		*prop = (int)num;
+		return cached ? 0 : waiter.status;
+	}
+
+	/* not found */
+	return -1;
+}
+
+int wasp_if_object_get_property_num(
+	const char *ipv4_address,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	int *prop,
+	int cached
+)
+{
+	struct json_path prop_path;
+
+	if (prop_name_len > WASP_IF_OBJ_PROP_LEN ||
+	    json_path_compile(&prop_path, prop_name, strlen(prop_name))) {
+		/* size validation */
+		return -1;
+	}
+
+	return wasp_if_object_get_property_num_h(ipv4_address, obj_id, &prop_path, prop, cached);
 }
 
-int wasp_if_object_get_property_num(
+int wasp_if_object_get_property_bool_h(
 	const char *ipv4_address,
 	int obj_id,
-	const char *prop_name,
-	size_t prop_name_len,
+	const struct json_path *prop_path,
 	int *prop,
 	int cached
 )
 {
 	int ret = 0;
-	double num = 0;
-	char buf[WASP_IF_BODY_LEN];
+	int boolean = 0;
 	int object_len = 0;
 	const char *object;
 
-	if (prop_name_len > WASP_IF_OBJ_PROP_LEN) {
-		/* size validation */
-		return -1;
-	}
-
 	if (_wasp_if_object_get_property_obj(ipv4_address, obj_id, cached, &object, &object_len)) {
-		/* error */
+		/* not found */
 		return -1;
 	}
 
-	snprintf(buf, WASP_IF_BODY_LEN, "$.%s", prop_name);
-	ret = json_get_number(object, object_len, buf, &num);
+	ret = json_path_get_bool(prop_path, object, object_len, &boolean);
+	_wasp_if_object_release(ipv4_address, cached);
 	if (ret != 0) {
-		*prop = (int)num;
-		return cached ? 0 : last_err_code;
+		*prop = (int)boolean;
+		return cached ? 0 : waiter.status;
 	}
 
 	/* not found */
@@ -591,47 +2443,30 @@ int wasp_if_object_get_property_bool(
 	int cached
 )
 {
-	int ret = 0;
-	int boolean = 0;
-	char buf[WASP_IF_BODY_LEN];
-	int object_len = 0;
-	const char *object;
+	struct json_path prop_path;
 
-	if (prop_name_len > WASP_IF_OBJ_PROP_LEN) {
+	if (prop_name_len > WASP_IF_OBJ_PROP_LEN ||
+	    json_path_compile(&prop_path, prop_name, strlen(prop_name))) {
 		/* size validation */
 		return -1;
 	}
 
-	if (_wasp_if_object_get_property_obj(ipv4_address, obj_id, cached, &object, &object_len)) {
-		/* not found */
-		return -1;
-	}
-
-	snprintf(buf, WASP_IF_BODY_LEN, "$.%s", prop_name);
-	ret = json_get_bool(object, object_len, buf, &boolean);
-	if (ret != 0) {
-		*prop = (int)boolean;
-		return cached ? 0 : last_err_code;
-	}
-
-	/* not found */
-	return -1;
+	return wasp_if_object_get_property_bool_h(ipv4_address, obj_id, &prop_path, prop, cached);
 }
 
-int wasp_if_schema_get_property_str(
+int wasp_if_schema_get_property_str_h(
 	const char *ipv4_address,
 	const char *schema_id,
 	size_t schema_id_len,
-	const char *prop_name,
-	size_t prop_name_len,
+	const struct json_path *prop_path,
 	char *prop,
 	size_t prop_len
 )
 {
 	int ret = 0;
-	char buf[WASP_IF_BODY_LEN];
 	int index = 0;
-	char *schs = NULL;
+	const char *schs = NULL;
+	int schs_len = 0;
 	index = _wasp_if_ipv4_to_device_index(ipv4_address);
 	if (index == -1) {
 		/* device not found */
@@ -639,16 +2474,18 @@ int wasp_if_schema_get_property_str(
 	}
 
 	if (schema_id_len > WASP_IF_OBJ_PROP_LEN ||
-	    prop_name_len > WASP_IF_OBJ_PROP_LEN ||
 	    prop_len > WASP_IF_OBJ_PROP_LEN) {
 		/* size validation */
 		return -1;
 	}
 
-	schs = schemas[index];
+	if (_wasp_if_schema_get(index, schema_id, &schs, &schs_len)) {
+		/* schema not found */
+		return -1;
+	}
 
-	snprintf(buf, WASP_IF_BODY_LEN, "$.%s.%s", schema_id, prop_name);
-	ret = json_get_string(schs, strlen(schs), buf, prop, prop_len);
+	ret = json_path_get_string(prop_path, schs, schs_len, prop, prop_len);
+	schema_store_read_unlock(&schemas[index]);
 	if (ret != -1) {
 		return 0;
 	}
@@ -657,37 +2494,59 @@ int wasp_if_schema_get_property_str(
 	return -1;
 }
 
-int wasp_if_schema_get_property_num(
+int wasp_if_schema_get_property_str(
 	const char *ipv4_address,
 	const char *schema_id,
 	size_t schema_id_len,
 	const char *prop_name,
 	size_t prop_name_len,
+	char *prop,
+	size_t prop_len
+)
+{
+	struct json_path prop_path;
+
+	if (prop_name_len > WASP_IF_OBJ_PROP_LEN ||
+	    json_path_compile(&prop_path, prop_name, strlen(prop_name))) {
+		/* size validation */
+		return -1;
+	}
+
+	return wasp_if_schema_get_property_str_h(ipv4_address, schema_id, schema_id_len, &prop_path, prop, prop_len);
+}
+
+int wasp_if_schema_get_property_num_h(
+	const char *ipv4_address,
+	const char *schema_id,
+	size_t schema_id_len,
+	const struct json_path *prop_path,
 	int *prop
 )
 {
 	int ret = 0;
 	double num = 0;
-	char buf[WASP_IF_BODY_LEN];
 	int index = 0;
-	char *schs = NULL;
+	const char *schs = NULL;
+	int schs_len = 0;
 	index = _wasp_if_ipv4_to_device_index(ipv4_address);
 	if (index == -1) {
 		/* device not found */
 		return -1;
 	}
 
-	if (schema_id_len > WASP_IF_OBJ_PROP_LEN ||
-	    prop_name_len > WASP_IF_OBJ_PROP_LEN) {
+	if (schema_id_len > WASP_IF_OBJ_PROP_LEN) {
 		/* size validation */
 		return -1;
 	}
 
-	schs = schemas[index];
+	if (_wasp_if_schema_get(index, schema_id, &schs, &schs_len)) {
+		/* schema not found */
+		return -1;
+	}
 
-	snprintf(buf, WASP_IF_BODY_LEN, "$.%s.%s", schema_id, prop_name);
-	ret = json_get_number(schs, strlen(schs), buf, &num);
-	if (ret != -1) {
+	ret = json_path_get_number(prop_path, schs, schs_len, &num);
+	schema_store_read_unlock(&schemas[index]);
+	if (ret != 0) {
 		*prop = num;
 		return 0;
 	}
@@ -696,6 +2555,305 @@ int wasp_if_schema_get_property_num(
 	return -1;
 }
 
+int wasp_if_schema_get_property_num(
+	const char *ipv4_address,
+	const char *schema_id,
+	size_t schema_id_len,
+	const char *prop_name,
+	size_t prop_name_len,
+	int *prop
+)
+{
+	struct json_path prop_path;
+
+	if (prop_name_len > WASP_IF_OBJ_PROP_LEN ||
+	    json_path_compile(&prop_path, prop_name, strlen(prop_name))) {
+		/* size validation */
+		return -1;
+	}
+
+	return wasp_if_schema_get_property_num_h(ipv4_address, schema_id, schema_id_len, &prop_path, prop);
+}
+
+/* constraints of a property's schema checked before a write */
+enum prop_schema_field {
+	PROP_SCHEMA_TYPE,
+	PROP_SCHEMA_MINIMUM,
+	PROP_SCHEMA_MAXIMUM,
+	PROP_SCHEMA_ENUM,
+	PROP_SCHEMA_MIN_LENGTH,
+	PROP_SCHEMA_MAX_LENGTH,
+	PROP_SCHEMA_NUM_FIELDS
+};
+
+static const char * const prop_schema_keys[PROP_SCHEMA_NUM_FIELDS] = {
+	"type", "minimum", "maximum", "enum", "minLength", "maxLength"
+};
+
+/* a value being written, matched against the elements of a "type" or "enum" array */
+struct prop_write {
+	enum wasp_if_prop_type type;
+	int num;
+	const char *str;
+	size_t str_len;
+	int matched;           /* set by the callbacks */
+};
+
+static int _wasp_if_type_allows(const char *tok, int toklen, enum wasp_if_prop_type type)
+{
+	struct json_field f;
+
+	memset(&f, 0, sizeof(f));
+	f.type = JSON_TOK_STRING;
+	f.tok = tok;
+	f.toklen = toklen;
+	switch (type) {
+	case WASP_IF_PROP_NUM:
+		return json_field_equals(&f, "integer", 7) || json_field_equals(&f, "number", 6);
+	case WASP_IF_PROP_BOOL:
+		return json_field_equals(&f, "boolean", 7);
+	default:
+		return json_field_equals(&f, "string", 6);
+	}
+}
+
+static int _wasp_if_type_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	struct prop_write *w = (struct prop_write *)ud;
+
+	(void)koff;
+	(void)klen;
+
+	w->matched = _wasp_if_type_allows(&s[voff], vlen, w->type);
+
+	return w->matched;
+}
+
+static int _wasp_if_enum_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	struct prop_write *w = (struct prop_write *)ud;
+	struct json_field f;
+	double v = 0;
+
+	(void)koff;
+	(void)klen;
+
+	switch (w->type) {
+	case WASP_IF_PROP_NUM:
+		w->matched = json_get_number(&s[voff], vlen, "$", &v) && v == w->num;
+		break;
+	case WASP_IF_PROP_BOOL:
+		w->matched = w->num ? vlen == 4 && !memcmp(&s[voff], "true", 4) :
+			vlen == 5 && !memcmp(&s[voff], "false", 5);
+		break;
+	default:
+		memset(&f, 0, sizeof(f));
+		f.type = s[voff] == '"' ? JSON_TOK_STRING : JSON_TOK_INVALID;
+		f.tok = &s[voff];
+		f.toklen = vlen;
+		w->matched = json_field_equals(&f, w->str, w->str_len);
+		break;
+	}
+
+	return w->matched;
+}
+
+/* length in characters of a UTF-8 string, as minLength and maxLength count */
+static size_t _wasp_if_utf8_len(const char *s, size_t len)
+{
+	size_t n = 0;
+	size_t i = 0;
+
+	for (i = 0; i < len; i++) {
+		n += ((unsigned char)s[i] & 0xc0) != 0x80;
+	}
+
+	return n;
+}
+
+/*
+ * Clamp a number to the nearest integer within a minimum (up set) or
+ * maximum, e.g. 1 for a minimum of 0.5.  Returns nonzero if there is none.
+ */
+static int _wasp_if_clamp(int *num, double limit, int up)
+{
+	if (limit > INT_MAX || limit < INT_MIN) {
+		return -1;
+	}
+	*num = (int)limit;
+	if (up && *num < limit) {
+		(*num)++;
+	} else if (!up && *num > limit) {
+		(*num)--;
+	}
+
+	return 0;
+}
+
+/*
+ * Check a value against the schema of the property, clamping a number to
+ * minimum/maximum if configured.  Returns nonzero if the value is invalid;
+ * a property without a stored schema is valid.
+ */
+static int _wasp_if_validate_write(
+	const char *ipv4_address,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	struct prop_write *w
+)
+{
+	struct json_field schema_field;
+	struct json_field props_field;
+	struct json_field prop_field;
+	struct json_field fields[PROP_SCHEMA_NUM_FIELDS];
+	struct json_field *f = NULL;
+	char schema_id[WASP_IF_SCHEMA_ID_MAX_LEN];
+	struct store_obj *obj = NULL;
+	const char *schema = NULL;
+	int schema_len = 0;
+	double limit = 0;
+	double len = 0;
+	int invalid = 0;
+	int index = 0;
+	int i = 0;
+
+	index = _wasp_if_ipv4_to_device_index(ipv4_address);
+	if (!config.validate_writes || index == -1) {
+		return 0;
+	}
+
+	/* schema ID of the object */
+	json_field_init(&schema_field, "_schema");
+	object_store_read_lock(&objects[index]);
+	obj = store_index_find(&objects[index].idx, obj_id);
+	if (obj) {
+		json_extract(obj->json, obj->len, &schema_field, 1);
+	}
+	i = obj ? json_field_get_string(&schema_field, schema_id, sizeof(schema_id)) : -1;
+	object_store_read_unlock(&objects[index]);
+	if (i <= 0 || _wasp_if_schema_get(index, schema_id, &schema, &schema_len)) {
+		return 0;
+	}
+
+	/* the property's schema, "properties": { "<prop_name>": { ... } } */
+	json_field_init(&props_field, "properties");
+	json_field_init_len(&prop_field, prop_name, prop_name_len);
+	if (json_extract(schema, schema_len, &props_field, 1) != 1 || props_field.type != JSON_TOK_OBJECT ||
+	    json_extract(props_field.tok, props_field.toklen, &prop_field, 1) != 1 ||
+	    prop_field.type != JSON_TOK_OBJECT) {
+		schema_store_read_unlock(&schemas[index]);
+		return 0;
+	}
+	for (i = 0; i < PROP_SCHEMA_NUM_FIELDS; i++) {
+		json_field_init(&fields[i], prop_schema_keys[i]);
+	}
+	json_extract(prop_field.tok, prop_field.toklen, fields, PROP_SCHEMA_NUM_FIELDS);
+
+	/* "type": "integer" or e.g. "type": ["string", "null"] */
+	f = &fields[PROP_SCHEMA_TYPE];
+	if (f->type == JSON_TOK_STRING) {
+		invalid = !_wasp_if_type_allows(f->tok, f->toklen, w->type);
+	} else if (f->type == JSON_TOK_ARRAY) {
+		w->matched = 0;
+		json_foreach(f->tok, f->toklen, _wasp_if_type_cb, w);
+		invalid = !w->matched;
+	}
+
+	f = &fields[PROP_SCHEMA_ENUM];
+	if (!invalid && f->type == JSON_TOK_ARRAY) {
+		w->matched = 0;
+		json_foreach(f->tok, f->toklen, _wasp_if_enum_cb, w);
+		invalid = !w->matched;
+	}
+
+	if (!invalid && w->type == WASP_IF_PROP_NUM) {
+		if (json_field_get_number(&fields[PROP_SCHEMA_MINIMUM], &limit) && w->num < limit) {
+			invalid = !config.clamp_writes || _wasp_if_clamp(&w->num, limit, 1);
+		}
+		if (!invalid && json_field_get_number(&fields[PROP_SCHEMA_MAXIMUM], &limit) && w->num > limit) {
+			invalid = !config.clamp_writes || _wasp_if_clamp(&w->num, limit, 0);
+			/* no integer between e.g. a minimum of 0.2 and a maximum of 0.8 */
+			invalid |= json_field_get_number(&fields[PROP_SCHEMA_MINIMUM], &limit) && w->num < limit;
+		}
+	}
+
+	if (!invalid && w->type == WASP_IF_PROP_STR) {
+		len = _wasp_if_utf8_len(w->str, w->str_len);
+		if ((json_field_get_number(&fields[PROP_SCHEMA_MIN_LENGTH], &limit) && len < limit) ||
+		    (json_field_get_number(&fields[PROP_SCHEMA_MAX_LENGTH], &limit) && len > limit)) {
+			invalid = 1;
+		}
+	}
+	schema_store_read_unlock(&schemas[index]);
+
+	return invalid;
+}
+
+
+/* the value of a property write */
+static void _wasp_if_prop_value(struct json_builder *b, const struct prop_write *w)
+{
+	switch (w->type) {
+	case WASP_IF_PROP_NUM:
+		json_builder_int(b, w->num);
+		break;
+	case WASP_IF_PROP_BOOL:
+		json_builder_bool(b, w->num);
+		break;
+	default:
+		json_builder_string(b, w->str, w->str_len);
+		break;
+	}
+}
+
+/* send {<key>: <value>}, key is a property name, or with json set already a JSON string */
+static int _wasp_if_object_send_prop_value(
+	const char *ipv4_address,
+	int obj_id,
+	const char *key,
+	size_t key_len,
+	int json,
+	const struct prop_write *w
+)
+{
+	char update_body[WASP_IF_BODY_LEN];
+	struct json_builder b;
+	int len = 0;
+
+	json_builder_init(&b, update_body, sizeof(update_body));
+	json_builder_object(&b);
+	if (json) {
+		json_builder_key_json(&b, key, key_len);
+	} else {
+		json_builder_key(&b, key, key_len);
+	}
+	_wasp_if_prop_value(&b, w);
+	json_builder_close(&b);
+	len = json_builder_finish(&b);
+	if (len < 0) {
+		return -1;
+	}
+
+	return _wasp_if_object_set_property(ipv4_address, obj_id, update_body, len);
+}
+
+/* validate and send {"<prop_name>": <value>} */
+static int _wasp_if_object_set_prop_value(
+	const char *ipv4_address,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	struct prop_write *w
+)
+{
+	if (_wasp_if_validate_write(ipv4_address, obj_id, prop_name, prop_name_len, w)) {
+		/* rejected by the schema, not sent */
+		return 400;
+	}
+
+	return _wasp_if_object_send_prop_value(ipv4_address, obj_id, prop_name, prop_name_len, 0, w);
+}
 
 int wasp_if_object_set_property_num(
 	const char *ipv4_address,
@@ -705,16 +2863,14 @@ int wasp_if_object_set_property_num(
 	int val
 )
 {
-	char update_body[WASP_IF_BODY_LEN];
+	struct prop_write w = { WASP_IF_PROP_NUM, val, NULL, 0, 0 };
 
 	if (prop_name_len > WASP_IF_OBJ_PROP_LEN) {
 		/* size validation */
 		return -1;
 	}
 
-	snprintf(update_body, WASP_IF_BODY_LEN, "{\"%s\": %d}", prop_name, val);
-
-	return _wasp_if_object_set_property(ipv4_address, obj_id, update_body, sizeof(update_body));
+	return _wasp_if_object_set_prop_value(ipv4_address, obj_id, prop_name, prop_name_len, &w);
 }
 
 int wasp_if_object_set_property_bool(
@@ -725,16 +2881,14 @@ int wasp_if_object_set_property_bool(
 	int state
 )
 {
-	char update_body[WASP_IF_BODY_LEN];
+	struct prop_write w = { WASP_IF_PROP_BOOL, state, NULL, 0, 0 };
 
 	if (prop_name_len > WASP_IF_OBJ_PROP_LEN) {
 		/* size validation */
 		return -1;
 	}
 
-	snprintf(update_body, WASP_IF_BODY_LEN, "{\"%s\": %s}", prop_name, state ? "true" : "false");
-
-	return _wasp_if_object_set_property(ipv4_address, obj_id, update_body, sizeof(update_body));
+	return _wasp_if_object_set_prop_value(ipv4_address, obj_id, prop_name, prop_name_len, &w);
 }
 
 int wasp_if_object_set_property_str(
@@ -746,17 +2900,60 @@ int wasp_if_object_set_property_str(
 	size_t val_len
 )
 {
-	char update_body[WASP_IF_BODY_LEN];
+	struct prop_write w = { WASP_IF_PROP_STR, 0, val, strnlen(val, val_len), 0 };
 
 	if (prop_name_len > WASP_IF_OBJ_PROP_LEN ||
-	    val_len > WASP_IF_OBJ_PROP_LEN) {
+	    w.str_len > WASP_IF_OBJ_PROP_LEN) {
 		/* size validation */
 		return -1;
 	}
 
-	snprintf(update_body, WASP_IF_BODY_LEN, "{\"%s\": \"%s\"}", prop_name, val);
+	return _wasp_if_object_set_prop_value(ipv4_address, obj_id, prop_name, prop_name_len, &w);
+}
+
+int wasp_if_object_set_key_num(
+	const char *ipv4_address,
+	int obj_id,
+	const char *key,
+	size_t key_len,
+	int val
+)
+{
+	struct prop_write w = { WASP_IF_PROP_NUM, val, NULL, 0, 0 };
+
+	return _wasp_if_object_send_prop_value(ipv4_address, obj_id, key, key_len, 1, &w);
+}
+
+int wasp_if_object_set_key_bool(
+	const char *ipv4_address,
+	int obj_id,
+	const char *key,
+	size_t key_len,
+	int state
+)
+{
+	struct prop_write w = { WASP_IF_PROP_BOOL, state, NULL, 0, 0 };
+
+	return _wasp_if_object_send_prop_value(ipv4_address, obj_id, key, key_len, 1, &w);
+}
+
+int wasp_if_object_set_key_str(
+	const char *ipv4_address,
+	int obj_id,
+	const char *key,
+	size_t key_len,
+	const char *val,
+	size_t val_len
+)
+{
+	struct prop_write w = { WASP_IF_PROP_STR, 0, val, strnlen(val, val_len), 0 };
+
+	if (w.str_len > WASP_IF_OBJ_PROP_LEN) {
+		/* size validation */
+		return -1;
+	}
 
-	return _wasp_if_object_set_property(ipv4_address, obj_id, update_body, sizeof(update_body));
+	return _wasp_if_object_send_prop_value(ipv4_address, obj_id, key, key_len, 1, &w);
 }
 
 int wasp_if_object_set_multiple_properties(
@@ -765,15 +2962,100 @@ int wasp_if_object_set_multiple_properties(
 	size_t update_body_len
 )
 {
-	if (update_body_len > WASP_IF_BODY_LEN) {
+	struct wasp_if_msg msg;
+
+	_wasp_if_msg_init(&msg, "PATCH", ipv4_address, "/wasp/r2/objects", NULL);
+	if (_wasp_if_msg_body(&msg, update_body, update_body_len)) {
+		/* size validation */
+		return -1;
+	}
+
+	return _wasp_if_request(&msg);
+}
+
+void wasp_if_update_init(struct wasp_if_update *u, char *buf, size_t len)
+{
+	json_builder_init(&u->b, buf, len < INT_MAX ? (int)len : INT_MAX);
+	json_builder_array(&u->b);
+	u->obj_id = -1;
+}
+
+/* {"_id": <obj_id>, ... "<prop_name>": <value>}, continuing the element of the previous update of obj_id */
+static int _wasp_if_update_add(
+	struct wasp_if_update *u,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	const struct prop_write *w
+)
+{
+	if (prop_name_len > WASP_IF_OBJ_PROP_LEN) {
 		/* size validation */
 		return -1;
 	}
 
-	_wasp_if_msg_init(&msg, "PATCH", ipv4_address, "/wasp/r2/objects", update_body);
-	_wasp_if_msg_write(&msg);
-	sem_wait(&s_request_done);
+	if (obj_id != u->obj_id) {
+		if (u->obj_id != -1) {
+			json_builder_close(&u->b);
+		}
+		json_builder_object(&u->b);
+		json_builder_key(&u->b, "_id", 3);
+		json_builder_int(&u->b, obj_id);
+		u->obj_id = obj_id;
+	}
+	json_builder_key(&u->b, prop_name, prop_name_len);
+	_wasp_if_prop_value(&u->b, w);
+
+	return u->b.error;
+}
+
+int wasp_if_update_num(
+	struct wasp_if_update *u,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	int val
+)
+{
+	struct prop_write w = { WASP_IF_PROP_NUM, val, NULL, 0, 0 };
+
+	return _wasp_if_update_add(u, obj_id, prop_name, prop_name_len, &w);
+}
+
+int wasp_if_update_bool(
+	struct wasp_if_update *u,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	int state
+)
+{
+	struct prop_write w = { WASP_IF_PROP_BOOL, state, NULL, 0, 0 };
+
+	return _wasp_if_update_add(u, obj_id, prop_name, prop_name_len, &w);
+}
+
+int wasp_if_update_str(
+	struct wasp_if_update *u,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	const char *val,
+	size_t val_len
+)
+{
+	struct prop_write w = { WASP_IF_PROP_STR, 0, val, strnlen(val, val_len), 0 };
 
-	return last_err_code;
+	return _wasp_if_update_add(u, obj_id, prop_name, prop_name_len, &w);
 }
 
+int wasp_if_update_finish(struct wasp_if_update *u)
+{
+	if (u->obj_id != -1) {
+		json_builder_close(&u->b);
+		u->obj_id = -1;
+	}
+	json_builder_close(&u->b);
+
+	return json_builder_finish(&u->b);
+}
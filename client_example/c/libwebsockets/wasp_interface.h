@@ -7,11 +7,17 @@
 #define _WASP_INTERFACE_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include "json.h"
 
-#define WASP_IF_MAX_DEVICES 32      /* maximum number of WASP devices supported by this interface */
+#ifndef WASP_IF_MAX_DEVICES
+#define WASP_IF_MAX_DEVICES 32      /* maximum number of WASP devices supported by this interface,
+                                       may be raised at build time, e.g. -DWASP_IF_MAX_DEVICES=1024 */
+#endif
+#define WASP_IF_MAX_SHARDS 16       /* maximum number of device shards */
+#define WASP_IF_MAX_SERVICE_THREADS 64 /* maximum number of HTTP client threads, all shards */
 #define WASP_IF_METHOD_LEN 16
-#define WASP_IF_IPV4_ADDRESS_LEN 16
+#define WASP_IF_IPV4_ADDRESS_LEN 22 /* dotted IPv4 address, optionally with ":port" */
 #define WASP_IF_OBJ_TYPE_LEN 128
 #define WASP_IF_OBJ_PROP_LEN 128
 #define WASP_IF_UPDATE_STREAM_BODY_KEY_LEN 64
@@ -20,18 +26,237 @@
 #define WASP_IF_BODY_LEN 1024
 #define WASP_IF_RESP_BUF_LEN 1500
 #define WASP_IF_AUTH_ID_LEN 65
-#define WASP_IF_AUTH_STR_LEN 74
+#define WASP_IF_AUTH_STR_LEN (WASP_IF_AUTH_ID_LEN + 10) /* Hawk id="<id>" */
 #define WASP_IF_SCHEMA_ID_MAX_LEN 128
+#define WASP_IF_STREAM_MAX_PERIODS 8       /* maximum per-type entries in X-Wasp-Stream-Min-Update-Period */
+#define WASP_IF_STREAM_MAX_EXCLUDES 8      /* maximum entries in X-Wasp-Stream-Exclude-Obj-Type */
+#define WASP_IF_STREAM_HDR_LEN 512
+#define WASP_IF_METER_OBJ_TYPE "ctrl:meter"
+#define WASP_IF_METER_PROP_LEN 32
+#define WASP_IF_METER_MAX_VALS 8           /* maximum values (e.g. channels) kept per meter sample */
 
 typedef void (*async_cb_t)(const char *ipv4_address, const char *path, const char *update_body);
 
+/* stages of a request, see wasp_if_stats() */
+enum wasp_if_stage {
+	WASP_IF_STAGE_QUEUE,                         /* submitted until read by the HTTP client thread */
+	WASP_IF_STAGE_WAIT,                          /* waiting for the device's previous request or
+	                                                authorization, including a 401 re-authorization */
+	WASP_IF_STAGE_CONNECT,                       /* TCP connection */
+	WASP_IF_STAGE_DEVICE,                        /* request sent until the response headers arrive */
+	WASP_IF_STAGE_TRANSFER,                      /* response body */
+	WASP_IF_STAGE_TOTAL,                         /* submitted until completed */
+	WASP_IF_NUM_STAGES
+};
+
+/* requests of one wasp_if_object_read_bulk() call, private to wasp_interface.c */
+struct wasp_if_bulk;
+
+/* completion of a blocking request, private to wasp_interface.c */
+struct wasp_if_waiter;
+
 struct wasp_if_msg {
 	char method[WASP_IF_METHOD_LEN];             /* GET, PATCH, or POST */
 	char ipv4_address[WASP_IF_IPV4_ADDRESS_LEN]; /* dotted IPv4 device address */
 	char path[WASP_IF_PATH_LEN];                 /* endpoint, e.g. /wasp/r2/objects/3 */
 	char body[WASP_IF_BODY_LEN];                 /* PATCH content, e.g. {"active": false} */
-	int body_len;
+	int body_len;                                /* length of body */
 	int pos;
+	int flags;                                   /* WASP_IF_MSG_* */
+	uint64_t stage_us[WASP_IF_NUM_STAGES];       /* CLOCK_MONOTONIC start of each stage, 0 if not
+	                                                reached (TOTAL unused) */
+	struct wasp_if_bulk *bulk;                   /* request set of wasp_if_object_read_bulk(), NULL if none */
+	int bulk_slot;                               /* object of the set read by this request */
+	struct wasp_if_waiter *waiter;               /* application thread waiting for the response,
+	                                                NULL if none */
+};
+
+#define WASP_IF_MSG_RESYNC 0x1                   /* internal objects read after a stream reconnect */
+#define WASP_IF_MSG_REPLAYED 0x2                 /* resent after re-authorizing, not resent again */
+#define WASP_IF_MSG_CONNECT 0x4                  /* objects/schemas read of wasp_if_connect_to_devices() */
+#define WASP_IF_MSG_DIFF 0x8                     /* objects read of wasp_if_resync_device() */
+
+struct wasp_if_stream_period {
+	int period_ms;                               /* minimum time between updates */
+	char obj_type[WASP_IF_OBJ_TYPE_LEN];         /* object type, e.g. "ctrl:meter" */
+};
+
+/* update stream options, sent as X-Wasp-Stream-* headers on GET /wasp/u2/objects */
+struct wasp_if_stream_opts {
+	int default_period_ms;                       /* minimum update period for all types, 0 for none */
+	struct wasp_if_stream_period periods[WASP_IF_STREAM_MAX_PERIODS];
+	int num_periods;
+	char exclude_obj_types[WASP_IF_STREAM_MAX_EXCLUDES][WASP_IF_OBJ_TYPE_LEN];
+	int num_exclude_obj_types;
+};
+
+/* one ctrl:meter update read from the meter channel */
+struct wasp_if_meter_sample {
+	uint64_t timestamp_ns;                       /* CLOCK_MONOTONIC time the update was received */
+	int obj_id;                                  /* ID of the ctrl:meter object */
+	char prop[WASP_IF_METER_PROP_LEN];           /* updated property */
+	int num_vals;                                /* 1 for a number, array length for an array */
+	double vals[WASP_IF_METER_MAX_VALS];
+};
+
+/* what the update delivery queue does when full */
+enum wasp_if_overflow_policy {
+	WASP_IF_OVERFLOW_BLOCK,                      /* the HTTP client thread waits for space */
+	WASP_IF_OVERFLOW_DROP_OLDEST,                /* the oldest queued update is discarded */
+	WASP_IF_OVERFLOW_CONFLATE                    /* a queued update of the same object/property is
+	                                                replaced by the newer value, otherwise drop oldest */
+};
+
+/* HTTP client implementation */
+enum wasp_if_transport {
+	WASP_IF_TRANSPORT_LWS,                       /* libwebsockets */
+	WASP_IF_TRANSPORT_EPOLL                      /* built-in HTTP/1.1 client on epoll, Linux only,
+	                                                keeps connections to devices alive */
+};
+
+/* interface configuration, see wasp_if_config_init() for the defaults */
+struct wasp_if_config {
+	int dispatch_threads;                        /* update callback threads per shard, 0 to run the
+	                                                callback on the HTTP client thread */
+	size_t dispatch_queue_len;                   /* queued updates per dispatch thread */
+	enum wasp_if_overflow_policy overflow_policy;
+	int stream_backoff_min_ms;                   /* first update stream reconnect delay */
+	int stream_backoff_max_ms;                   /* reconnect delay limit, doubled per failed attempt */
+	int stream_resync;                           /* (1) : after a reconnect, re-read the objects and
+	                                                emit updates for properties changed meanwhile */
+	int auth_refresh_s;                          /* re-authorize each device this often, 0 to
+	                                                re-authorize only when a request gets a 401 */
+	int lazy_schemas;                            /* (1) : do not read all schemas at connect, read
+	                                                each schema the first time it is looked up */
+	size_t trace_events;                         /* flight recorder events kept, 0 to disable,
+	                                                see wasp_if_trace_dump() */
+	int shards;                                  /* device partitions, device index i belongs to
+	                                                shard (i % shards), each with its own
+	                                                transport context, HTTP client and dispatch
+	                                                threads */
+	int service_threads;                         /* HTTP client threads per shard, more than 1
+	                                                with lws needs libwebsockets built with
+	                                                LWS_MAX_SMP > 1; with more than 1 thread in all
+	                                                and dispatch_threads 0 the update callback must
+	                                                be thread safe */
+	int service_cpu_affinity;                    /* (1) : pin HTTP client thread i to CPU i */
+	enum wasp_if_transport transport;
+	int validate_writes;                         /* (1) : check the values of
+	                                                wasp_if_object_set_property_*() against the
+	                                                object's schema before sending them */
+	int clamp_writes;                            /* (1) : with validate_writes, set a number
+	                                                outside the schema's minimum/maximum to the
+	                                                nearest limit rather than rejecting it */
+};
+
+/* progress of one device in wasp_if_connect_to_devices() */
+enum wasp_if_connect_state {
+	WASP_IF_CONNECT_QUEUED,                      /* waiting for a download slot */
+	WASP_IF_CONNECT_STARTED,                     /* authorizing and reading the objects */
+	WASP_IF_CONNECT_OBJECTS,                     /* objects stored, reading the schemas */
+	WASP_IF_CONNECT_DONE,                        /* objects and schemas stored */
+	WASP_IF_CONNECT_FAILED                       /* request failed, see err_code */
+};
+
+/* one device of wasp_if_connect_to_devices() */
+struct wasp_if_connect_device {
+	unsigned int device_index;                   /* 0 to (WASP_IF_MAX_DEVICES - 1) */
+	const char *ipv4_address;                    /* dotted IPv4 device address */
+	int enable_update_stream;                    /* (1) : open the object update stream once connected */
+	const struct wasp_if_stream_opts *stream_opts; /* NULL for an unthrottled stream */
+};
+
+/* admission control of wasp_if_connect_to_devices() */
+struct wasp_if_connect_opts {
+	int max_downloads;                           /* devices downloading objects/schemas at once,
+	                                                0 for WASP_IF_CONNECT_MAX_DOWNLOADS */
+	int jitter_ms;                               /* random delay of up to jitter_ms before each
+	                                                device is started once it has a download
+	                                                slot, the delays of the slots overlap */
+};
+
+#define WASP_IF_CONNECT_MAX_DOWNLOADS 8
+
+typedef void (*connect_cb_t)(const char *ipv4_address, enum wasp_if_connect_state state, int err_code, void *user);
+
+/* update delivery queue counters, summed over all dispatch threads */
+struct wasp_if_dispatch_stats {
+	uint64_t enqueued;                           /* updates queued */
+	uint64_t delivered;                          /* updates passed to the callback */
+	uint64_t dropped;                            /* updates discarded because a queue was full */
+	uint64_t conflated;                          /* updates merged into a queued update */
+	uint64_t blocked;                            /* times the HTTP client thread waited for space */
+	size_t depth;                                /* updates currently queued */
+	size_t max_depth;                            /* highest depth of any queue */
+};
+
+/* latency of one request stage in microseconds */
+struct wasp_if_stage_stats {
+	uint64_t count;                              /* requests that reached the stage */
+	uint64_t mean_us;
+	uint64_t p50_us;
+	uint64_t p90_us;
+	uint64_t p99_us;
+	uint64_t p999_us;
+	uint64_t max_us;
+};
+
+/* request lifecycle statistics of a device, or of all devices */
+struct wasp_if_request_stats {
+	uint64_t requests;                           /* completed requests, including authorizations */
+	uint64_t errors;                             /* no connection or a status of 400 or more */
+	uint64_t replays;                            /* requests resent after a 401 */
+	struct wasp_if_stage_stats stages[WASP_IF_NUM_STAGES];
+};
+
+/* request methods, status classes and update event types of struct wasp_if_device_counters */
+enum wasp_if_method {
+	WASP_IF_METHOD_GET,
+	WASP_IF_METHOD_PATCH,
+	WASP_IF_METHOD_POST,
+	WASP_IF_NUM_METHODS
+};
+
+enum wasp_if_status_class {
+	WASP_IF_STATUS_2XX,
+	WASP_IF_STATUS_3XX,
+	WASP_IF_STATUS_4XX,
+	WASP_IF_STATUS_5XX,
+	WASP_IF_STATUS_ERROR,                        /* no connection or no valid response */
+	WASP_IF_NUM_STATUS
+};
+
+enum wasp_if_event_type {
+	WASP_IF_EVENT_OBJ,                           /* update:obj */
+	WASP_IF_EVENT_GROUP_PREFIX,                  /* update:group_prefix */
+	WASP_IF_EVENT_OTHER,
+	WASP_IF_NUM_EVENT_TYPES
+};
+
+/* monotonic counters of a device (uint64_t members only) */
+struct wasp_if_device_counters {
+	uint64_t requests[WASP_IF_NUM_METHODS][WASP_IF_NUM_STATUS]; /* completed requests */
+	uint64_t bytes_in;                           /* response and update stream bytes received */
+	uint64_t bytes_out;                          /* request body bytes sent */
+	uint64_t stream_events[WASP_IF_NUM_EVENT_TYPES]; /* update stream events received */
+	uint64_t stream_reconnects;                  /* update stream reconnect attempts */
+	uint64_t auth_requests;                      /* authorizations, including background refreshes */
+};
+
+/* counters and gauges of a device */
+struct wasp_if_device_metrics {
+	char ipv4_address[WASP_IF_IPV4_ADDRESS_LEN]; /* empty if no device has this index */
+	struct wasp_if_device_counters counters;
+	size_t queue_depth;                          /* requests waiting to be sent */
+	int num_objects;                             /* stored objects */
+	size_t objects_bytes;                        /* memory of the stored objects */
+	size_t schemas_bytes;                        /* memory of the stored schemas */
+};
+
+/* snapshot of the runtime metrics, see wasp_if_metrics_snapshot() */
+struct wasp_if_metrics {
+	struct wasp_if_device_metrics devices[WASP_IF_MAX_DEVICES]; /* by device index */
+	struct wasp_if_dispatch_stats dispatch;
 };
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -45,6 +270,138 @@ struct wasp_if_msg {
  */
 int wasp_if_init(async_cb_t u_cb);
 
+/**
+ * Fill in the default configuration: 1 dispatch thread with a
+ * 4096 entry queue that conflates updates of the same property, update
+ * stream reconnects backing off from 250 ms to 30 s, with resync, and a
+ * flight recorder of the last 65536 trace events, all devices in 1 shard
+ * served by 1 HTTP client thread.
+ *
+ * /param cfg - configuration to initialize
+ */
+void wasp_if_config_init(struct wasp_if_config *cfg);
+
+/**
+ * Start the WASP HTTP client interface with the given configuration.
+ *
+ * Update stream callbacks run on the dispatch threads, decoupled from the
+ * HTTP client thread by a bounded queue per dispatch thread.  Each device
+ * is served by one dispatch thread, so updates of a device are delivered
+ * in order.
+ *
+ * /param u_cb - object update stream callback function
+ * /param cfg - configuration, NULL for the defaults
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_init_ex(async_cb_t u_cb, const struct wasp_if_config *cfg);
+
+/**
+ * Read the update delivery queue counters.
+ *
+ * /param stats - counters to fill in
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_get_dispatch_stats(struct wasp_if_dispatch_stats *stats);
+
+/**
+ * Read the request latency of each stage of the request lifecycle, from
+ * per-device histograms recorded since the interface was started or the
+ * statistics were reset.  Percentiles are within about 3%.
+ *
+ * /param ipv4_address - dotted IPv4 device address, NULL for all devices
+ * /param stats - statistics to fill in
+ *
+ * /returns nonzero if the device is not found.
+ */
+int wasp_if_stats(const char *ipv4_address, struct wasp_if_request_stats *stats);
+
+/**
+ * Clear the request statistics.
+ *
+ * /param ipv4_address - dotted IPv4 device address, NULL for all devices
+ *
+ * /returns nonzero if the device is not found.
+ */
+int wasp_if_stats_reset(const char *ipv4_address);
+
+/**
+ * Read the runtime counters and gauges of all devices.  Counters are
+ * incremented per thread without locks, so the snapshot costs the
+ * network thread nothing.
+ *
+ * /param m - snapshot to fill in
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_metrics_snapshot(struct wasp_if_metrics *m);
+
+/**
+ * Format a snapshot in the Prometheus text exposition format.
+ *
+ * /param m - snapshot from wasp_if_metrics_snapshot()
+ * /param buf - text buffer, NUL terminated if len is not 0
+ * /param len - size of buf
+ *
+ * /returns the length of the whole text, len or more if buf is too small.
+ */
+size_t wasp_if_metrics_format(const struct wasp_if_metrics *m, char *buf, size_t len);
+
+/**
+ * Start writing the metrics in the Prometheus text format to a file
+ * every period_ms, e.g. for the node_exporter textfile collector.  The
+ * file is replaced atomically.  Only one metrics writer runs at a time.
+ *
+ * /param path - file to write
+ * /param period_ms - time between writes
+ *
+ * /returns nonzero on error or if a writer is already running.
+ */
+int wasp_if_metrics_write_file(const char *path, int period_ms);
+
+/**
+ * Start serving the metrics in the Prometheus text format on a local
+ * (unix domain) socket.  Each connection gets the current metrics, as an
+ * HTTP response if it sent an HTTP request, e.g.
+ * curl --unix-socket <path> http://localhost/metrics
+ *
+ * /param socket_path - path of the socket, replaced if it exists
+ *
+ * /returns nonzero on error or if a writer is already running.
+ */
+int wasp_if_metrics_listen(const char *socket_path);
+
+/**
+ * Stop the metrics writer started by wasp_if_metrics_write_file() or
+ * wasp_if_metrics_listen().
+ */
+void wasp_if_metrics_stop(void);
+
+/**
+ * Write the flight recorder to a file: the last trace events (request
+ * submit/send/complete, HTTP client callbacks, update stream reads,
+ * events and reconnects, authorizations) with nanosecond timestamps.
+ * Decode the file with wasp_trace_decode.
+ *
+ * /param path - file to write, replaced if it exists
+ *
+ * /returns nonzero on error or if the flight recorder is disabled.
+ */
+int wasp_if_trace_dump(const char *path);
+
+/**
+ * Install a signal handler that writes the flight recorder to a file,
+ * e.g. SIGUSR1 to take a dump of a running process.  The handler only
+ * makes async-signal-safe calls.
+ *
+ * /param signum - signal to handle
+ * /param path - file to write on each signal, replaced if it exists
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_trace_dump_on_signal(int signum, const char *path);
+
 /**
  * Connect to a WASP device, store the objects/schemas and
  * optionally open a connection to the object update stream.
@@ -61,6 +418,113 @@ int wasp_if_connect_to_device(
 	int enable_update_stream
 );
 
+/**
+ * Connect to a WASP device as wasp_if_connect_to_device(), opening the
+ * object update stream with the given stream options.
+ *
+ * /param device_index - 0 to (WASP_IF_MAX_DEVICES - 1)
+ * /param ipv4_address - dotted IPv4 device address
+ * /param enable_update_stream - (1) : open a connection to the object update stream
+ * /param stream_opts - update stream options, NULL for an unthrottled stream
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_connect_to_device_ex(
+	unsigned int device_index,
+	const char *ipv4_address,
+	int enable_update_stream,
+	const struct wasp_if_stream_opts *stream_opts
+);
+
+/**
+ * Change the update stream options of a connected device.  If the update
+ * stream is open it is reconnected so the device applies the new options.
+ *
+ * The options are sent as:
+ *   X-Wasp-Stream-Min-Update-Period: <default_ms>,<period_ms> <obj_type>,...
+ *   X-Wasp-Stream-Exclude-Obj-Type: <obj_type>,<obj_type>,...
+ *
+ * /param ipv4_address - dotted IPv4 device address
+ * /param stream_opts - update stream options, NULL to clear all options
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_set_stream_options(
+	const char *ipv4_address,
+	const struct wasp_if_stream_opts *stream_opts
+);
+
+/**
+ * Connect to many WASP devices concurrently.  Each device is authorized and
+ * its objects and schemas are read as wasp_if_connect_to_device() would, with
+ * at most max_downloads devices in progress at once.  Returns once every
+ * device is connected or has failed.  Must not be called concurrently with
+ * the other wasp_if_* request functions.
+ *
+ * /param devs - devices to connect
+ * /param num_devs - number of entries in devs
+ * /param opts - admission control, NULL for the defaults
+ * /param cb - called on the calling thread as each device changes state, may be NULL
+ * /param user - passed to cb
+ *
+ * /returns number of devices that failed to connect, -1 on invalid arguments.
+ */
+int wasp_if_connect_to_devices(
+	const struct wasp_if_connect_device *devs,
+	int num_devs,
+	const struct wasp_if_connect_opts *opts,
+	connect_cb_t cb,
+	void *user
+);
+
+/**
+ * Divert ctrl:meter updates of a connected device from the update stream
+ * callback into a lock-free ring buffer.  Samples are written by the HTTP
+ * client thread and drained by one application thread with
+ * wasp_if_meter_read(), so no locks or callbacks run on the network thread.
+ * The ctrl:meter objects are found again each time the device's objects are
+ * read (connect, resync, stream reconnect), so the channel may be enabled
+ * before the objects are read and meters added later are diverted too.
+ *
+ * /param ipv4_address - dotted IPv4 device address
+ * /param capacity - number of samples buffered, rounded up to a power of two.
+ *                   Ignored if the channel was enabled before.
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_meter_channel_enable(
+	const char *ipv4_address,
+	size_t capacity
+);
+
+/**
+ * Stop diverting ctrl:meter updates; they are delivered through the update
+ * stream callback again.  Buffered samples can still be read.
+ *
+ * /param ipv4_address - dotted IPv4 device address
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_meter_channel_disable(const char *ipv4_address);
+
+/**
+ * Read buffered meter samples, oldest first.  Only one thread may read
+ * the meter channel of a device.
+ *
+ * /param ipv4_address - dotted IPv4 device address
+ * /param samples - array to read into
+ * /param max_samples - length of samples
+ * /param dropped - if not NULL, total samples dropped because the ring was full
+ *
+ * /returns the number of samples read, -1 on error.
+ */
+int wasp_if_meter_read(
+	const char *ipv4_address,
+	struct wasp_if_meter_sample *samples,
+	int max_samples,
+	uint64_t *dropped
+);
+
 /**
  * Look up the object ID associated with given parameters
  *
@@ -168,6 +632,46 @@ int wasp_if_object_get_property_bool(
 	int cached
 );
 
+/*
+ * The wasp_if_*_get_property_*_h() getters take the property as a path
+ * compiled once with json_path_compile(), e.g. "level" or "$.label", rather
+ * than a name formatted into a path on each call.  Otherwise they are the
+ * same as the getters taking a property name.
+ */
+int wasp_if_object_get_property_str_h(
+	const char *ipv4_address,
+	int obj_id,
+	const struct json_path *prop_path,
+	char *prop,
+	size_t prop_len,
+	int cached
+);
+
+int wasp_if_object_get_property_num_h(
+	const char *ipv4_address,
+	int obj_id,
+	const struct json_path *prop_path,
+	int *prop,
+	int cached
+);
+
+int wasp_if_object_get_property_bool_h(
+	const char *ipv4_address,
+	int obj_id,
+	const struct json_path *prop_path,
+	int *prop,
+	int cached
+);
+
+/*
+ * With wasp_if_config.validate_writes (the default), the
+ * wasp_if_object_set_property_*() functions check the value against the
+ * property's schema in the stored schemas: its type, minimum, maximum, enum,
+ * minLength and maxLength.  A value the device would reject is not sent and
+ * 400 is returned, as the device would.  A property without a stored schema
+ * is sent unchecked.
+ */
+
 /**
  * Set a number-type property of an object
  *
@@ -213,7 +717,7 @@ int wasp_if_object_set_property_bool(
  * /param prop_name - the name of the property
  * /param prop_name_len - length of prop_name
  * /param val - the new value of the property
- * /param prop_name_len - length of val
+ * /param val_len - size of val, the value ends at its first NUL within it
  *
  * /return the HTTP status code, -1 on internal error
  */
@@ -226,12 +730,83 @@ int wasp_if_object_set_property_str(
 	size_t val_len
 );
 
+/*
+ * wasp_if_object_set_key_*() are the wasp_if_object_set_property_*()
+ * functions of the setters generated by wasp_schema_gen: the key is the
+ * property name already quoted and escaped as a JSON string, e.g.
+ * "\"level\"", and the value is sent as it is.  The generated setter
+ * checks the value against the property's schema itself, so no name is
+ * escaped or looked up in the stored schemas.
+ */
+
+/**
+ * Set a number-type property of an object by its JSON key, unchecked
+ *
+ * /param ipv4_address - the dotted IPv4 device address
+ * /param obj_id - the ID of the object
+ * /param key - the property name as a JSON string, e.g. "\"level\""
+ * /param key_len - length of key
+ * /param val - the new value of the property
+ *
+ * /return the HTTP status code, -1 on internal error
+ */
+int wasp_if_object_set_key_num(
+	const char *ipv4_address,
+	int obj_id,
+	const char *key,
+	size_t key_len,
+	int val
+);
+
+/**
+ * Set a boolean-type property of an object by its JSON key, unchecked
+ *
+ * /param ipv4_address - the dotted IPv4 device address
+ * /param obj_id - the ID of the object
+ * /param key - the property name as a JSON string
+ * /param key_len - length of key
+ * /param state - the new state of the property
+ *
+ * /return the HTTP status code, -1 on internal error
+ */
+int wasp_if_object_set_key_bool(
+	const char *ipv4_address,
+	int obj_id,
+	const char *key,
+	size_t key_len,
+	int state
+);
+
+/**
+ * Set a string-type property of an object by its JSON key, unchecked
+ *
+ * /param ipv4_address - the dotted IPv4 device address
+ * /param obj_id - the ID of the object
+ * /param key - the property name as a JSON string
+ * /param key_len - length of key
+ * /param val - the new value of the property, escaped when sent
+ * /param val_len - size of val, the value ends at its first NUL within it
+ *
+ * /return the HTTP status code, -1 on internal error
+ */
+int wasp_if_object_set_key_str(
+	const char *ipv4_address,
+	int obj_id,
+	const char *key,
+	size_t key_len,
+	const char *val,
+	size_t val_len
+);
+
 /**
  * Set multiple properties within an object in one request
  *
  * /param ipv4_address - the dotted IPv4 device address
- * /param update_body - the formatted JSON array properties, e.g. [{\"_id\":%d, \"active\":%s}, ...]
- * /param update_body_len - length of update_body
+ * /param update_body - the formatted JSON array properties, e.g. [{\"_id\":%d, \"active\":%s}, ...],
+ *                       see struct wasp_if_update
+ * /param update_body_len - exact length of update_body (e.g. from wasp_if_update_finish()),
+ *                          less than WASP_IF_BODY_LEN; the size of the buffer holding a
+ *                          shorter body is rejected
  *
  * /return the HTTP status code, -1 on internal error
  */
@@ -241,6 +816,174 @@ int wasp_if_object_set_multiple_properties(
 	size_t update_body_len
 );
 
+/*
+ * Body of wasp_if_object_set_multiple_properties() built from (object,
+ * property, value) updates in a caller owned buffer, e.g.
+ *
+ *	char body[WASP_IF_BODY_LEN];
+ *	struct wasp_if_update u;
+ *
+ *	wasp_if_update_init(&u, body, sizeof(body));
+ *	wasp_if_update_bool(&u, phantom_ctrl_id, "active", 6, 0);
+ *	wasp_if_update_num(&u, level_ctrl_id, "level", 5, 24);
+ *	len = wasp_if_update_finish(&u);
+ *	wasp_if_object_set_multiple_properties(ipv4_address, body, len);
+ *
+ * Consecutive updates of the same object share one array element.  Names
+ * and strings are escaped, a string ending at its first NUL within val_len,
+ * and nothing is allocated, so the buffer can be reused for the next batch.
+ */
+struct wasp_if_update {
+	struct json_builder b;
+	int obj_id;                                  /* object of the open element, -1 if none */
+};
+
+void wasp_if_update_init(struct wasp_if_update *u, char *buf, size_t len);
+
+/* add one update, returns nonzero if it does not fit in the buffer */
+int wasp_if_update_num(
+	struct wasp_if_update *u,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	int val
+);
+
+int wasp_if_update_bool(
+	struct wasp_if_update *u,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	int state
+);
+
+int wasp_if_update_str(
+	struct wasp_if_update *u,
+	int obj_id,
+	const char *prop_name,
+	size_t prop_name_len,
+	const char *val,
+	size_t val_len
+);
+
+/* close the array, returns the body length, -1 if it did not fit */
+int wasp_if_update_finish(struct wasp_if_update *u);
+
+/**
+ * Register a device and store the given objects and schemas without
+ * contacting it, e.g. to work offline from saved dumps or to benchmark
+ * lookups.  Replaces anything stored for the device index.
+ *
+ * /param device_index - 0 to (WASP_IF_MAX_DEVICES - 1)
+ * /param ipv4_address - dotted IPv4 device address
+ * /param objects_json - a /wasp/r2/objects dump
+ * /param objects_json_len - length of objects_json
+ * /param schemas_json - a /wasp/r2/schemas document, NULL for none
+ * /param schemas_json_len - length of schemas_json
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_load_device(
+	unsigned int device_index,
+	const char *ipv4_address,
+	const char *objects_json,
+	size_t objects_json_len,
+	const char *schemas_json,
+	size_t schemas_json_len
+);
+
+/**
+ * Read the objects of a connected device again, e.g. after it rebooted,
+ * and update the stored objects.  Only objects whose text changed are
+ * replaced, and an update is passed to the update stream callback for each
+ * property that differs from the stored value.
+ *
+ * /param ipv4_address - dotted IPv4 device address
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_resync_device(const char *ipv4_address);
+
+/* how wasp_if_object_read_bulk() reads a property */
+enum wasp_if_prop_type {
+	WASP_IF_PROP_NUM,
+	WASP_IF_PROP_BOOL,
+	WASP_IF_PROP_STR
+};
+
+/* one (object, property) pair of wasp_if_object_read_bulk() */
+struct wasp_if_bulk_read {
+	int obj_id;
+	const char *prop_name;                       /* as the wasp_if_object_get_property_*() prop_name */
+	enum wasp_if_prop_type type;
+	int status;                                  /* set to 0 if read, the HTTP status if the object
+	                                                could not be fetched, -1 if not found */
+	int num;                                     /* value of a NUM or BOOL property */
+	char str[WASP_IF_OBJ_PROP_LEN];              /* value of a STR property */
+};
+
+/* uncached bulk reads of more distinct objects than this fetch all the objects instead */
+#define WASP_IF_BULK_MAX_GETS 256
+
+/**
+ * Read many object properties of one device in one call.
+ *
+ * Uncached, each distinct object is fetched once.  A GET of each object is
+ * queued at once, so the caller waits once rather than once per property.
+ * The GETs are not concurrent: like all requests to a device they are sent
+ * one after another, each once the previous response is complete, on the
+ * device's kept alive connection with the epoll transport.  If the
+ * distinct objects exceed WASP_IF_BULK_MAX_GETS, or a quarter of the
+ * stored objects, all the objects are read with one GET /wasp/r2/objects
+ * into a private buffer instead; the stored objects are not changed and no
+ * updates are emitted.
+ *
+ * /param ipv4_address - dotted IPv4 device address
+ * /param reads - the properties to read, their status and value are set
+ * /param num_reads - number of entries in reads
+ * /param cached - (1) - read from stored objects, (0) - fetch the objects from the device
+ *
+ * /returns the number of properties read, -1 on error.
+ */
+int wasp_if_object_read_bulk(
+	const char *ipv4_address,
+	struct wasp_if_bulk_read *reads,
+	int num_reads,
+	int cached
+);
+
+/**
+ * Read the schemas of the stored objects of the given types, so later
+ * schema lookups do not wait on the device.  Only needed with lazy_schemas.
+ *
+ * /param ipv4_address - dotted IPv4 device address
+ * /param obj_types - object types, e.g. "ctrl:trim_level"
+ * /param num_types - number of entries in obj_types
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_schema_prefetch(
+	const char *ipv4_address,
+	const char * const *obj_types,
+	int num_types
+);
+
+/**
+ * Copy the whole /wasp/r2/schemas document of a device, reading it first
+ * if it is not stored (lazy_schemas), e.g. to generate code from it.
+ *
+ * /param ipv4_address - dotted IPv4 device address
+ * /param json - set to the NUL terminated copy, to be freed by the caller
+ * /param json_len - set to the length of json
+ *
+ * /returns nonzero on error.
+ */
+int wasp_if_schema_copy_all(
+	const char *ipv4_address,
+	char **json,
+	size_t *json_len
+);
+
 /**
  * Get a string-type property of an schema
  *
@@ -285,6 +1028,24 @@ int wasp_if_schema_get_property_num(
 	int *prop
 );
 
+/* schema getters taking a compiled property path, see wasp_if_object_get_property_str_h() */
+int wasp_if_schema_get_property_str_h(
+	const char *ipv4_address,
+	const char *schema_id,
+	size_t schema_id_len,
+	const struct json_path *prop_path,
+	char *prop,
+	size_t prop_len
+);
+
+int wasp_if_schema_get_property_num_h(
+	const char *ipv4_address,
+	const char *schema_id,
+	size_t schema_id_len,
+	const struct json_path *prop_path,
+	int *prop
+);
+
 //////////////////////////////////////////////////////////////////////////////////
 
 /**
@@ -317,22 +1078,34 @@ int _wasp_if_msg_write(
 /**
  * Read the request message
  *
+ * /param thread - HTTP client (lws service) thread whose requests to read
  * /param msg - the message to read into
  */
 int _wasp_if_msg_read(
+	int thread,
 	struct wasp_if_msg *msg
 );
 
 const char * _wasp_if_ipv4_to_auth_str(const char *ipv4_address);
 int _wasp_if_store_auth_str(const char *ipv4_address, const char *auth_str);
 int _wasp_if_ipv4_to_device_index(const char *ipv4_address);
+int _wasp_if_get_stream_headers(const char *ipv4_address, char *period, size_t period_len, char *exclude, size_t exclude_len);
 void _wasp_if_notify_objects_schemas_read(void);
 void _wasp_if_notify_update_stream_rcvd(const char *ipv4_address, const char *path, const char *update_body);
+void _wasp_if_notify_property_rcvd(const char *ipv4_address, int obj_id, const char *path, const char *prop, int prop_len, const char *val, int val_len);
+const struct wasp_if_config * _wasp_if_get_config(void);
 void _wasp_if_store_schema(const char *ipv4_address, int pos, const char *buf, int len);
+void _wasp_if_store_schemas_done(const char *ipv4_address, const char *schema_id);
 void _wasp_if_store_object(const char *ipv4_address, int pos, const char *buf, int len);
-void _wasp_if_store_single_object(const char *buf);
-int _wasp_if_get_last_err_code(void);
-void _wasp_if_store_last_err_code(int code);
-void _wasp_if_notify_request_complete(void);
+void _wasp_if_store_objects_done(const char *ipv4_address, int resync);
+int _wasp_if_notify_connect_progress(const char *ipv4_address, enum wasp_if_connect_state state, int err_code);
+void _wasp_if_store_single_object(struct wasp_if_waiter *w, const char *buf);
+void _wasp_if_bulk_data(struct wasp_if_bulk *bulk, int slot, int pos, const char *buf, int len);
+void _wasp_if_bulk_complete(struct wasp_if_bulk *bulk, int slot, int status);
+void _wasp_if_notify_request_complete(struct wasp_if_waiter *w, int status);
+uint64_t _wasp_if_time_us(void);
+void _wasp_if_record_request(const char *ipv4_address, const uint64_t *stage_us, int status, int replayed);
+void _wasp_if_trace(int type, int dev_index, int32_t a, int32_t b);
+int _wasp_if_path_obj_id(const char *path);
 
 #endif /*_WASP_INTERFACE_H */
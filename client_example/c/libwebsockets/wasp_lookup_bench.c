@@ -0,0 +1,215 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+/*
+ * Microbenchmark of the object and schema lookups that read the stored
+ * objects (cached=1) and schemas, over synthetic devices of increasing
+ * size loaded with wasp_if_load_device().  No device or network is used.
+ */
+
+#include "wasp_interface.h"
+#include "mock_dump.h"
+#include "bench_stats.h"
+#include "json_index.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_SIZES 16
+
+enum lookup_op {
+	OP_GET_OBJ_ID,
+	OP_GET_CTRL_ID,
+	OP_GET_NUM,
+	OP_GET_NUM_H,
+	OP_GET_STR,
+	OP_GET_BOOL,
+	OP_SCHEMA_NUM,
+	OP_SCHEMA_STR,
+	NUM_OPS
+};
+
+static const char *op_names[NUM_OPS] = {
+	"get_obj_id",
+	"get_ctrl_id",
+	"get_property_num",
+	"get_property_num_h",
+	"get_property_str",
+	"get_property_bool",
+	"schema_get_property_num",
+	"schema_get_property_str"
+};
+
+/* "level", compiled once for OP_GET_NUM_H */
+static struct json_path level_path;
+
+/* one lookup on block b, returns nonzero on failure */
+static int run_op(enum lookup_op op, const char *address, int b)
+{
+	const char *level = "level";
+	const char *schema = "_schema";
+	const char *active = "active";
+	const char *minimum = "properties.level.minimum";
+	const char *unit = "properties.level.wasp-unit";
+	char schema_id[WASP_IF_OBJ_PROP_LEN];
+	char str[WASP_IF_OBJ_PROP_LEN];
+	int val = 0;
+
+	switch (op) {
+	case OP_GET_OBJ_ID:
+		return wasp_if_get_obj_id(address, "block:io", 8, "analog", 6, "in", 2, b) == -1;
+	case OP_GET_CTRL_ID:
+		return wasp_if_get_ctrl_id(address, "ctrl:trim_level", 15, MOCK_DUMP_BLOCK_ID(b)) == -1;
+	case OP_GET_NUM:
+		return wasp_if_object_get_property_num(address, MOCK_DUMP_BLOCK_ID(b) + 1,
+			level, strlen(level), &val, 1) == -1;
+	case OP_GET_NUM_H:
+		return wasp_if_object_get_property_num_h(address, MOCK_DUMP_BLOCK_ID(b) + 1,
+			&level_path, &val, 1) == -1;
+	case OP_GET_STR:
+		return wasp_if_object_get_property_str(address, MOCK_DUMP_BLOCK_ID(b) + 1,
+			schema, strlen(schema), str, sizeof(str), 1) == -1;
+	case OP_GET_BOOL:
+		return wasp_if_object_get_property_bool(address, MOCK_DUMP_BLOCK_ID(b) + 2,
+			active, strlen(active), &val, 1) == -1;
+	case OP_SCHEMA_NUM:
+		snprintf(schema_id, sizeof(schema_id), "level_schema_%d", b % MOCK_DUMP_NUM_SCHEMAS);
+		return wasp_if_schema_get_property_num(address, schema_id, strlen(schema_id),
+			minimum, strlen(minimum), &val) == -1;
+	case OP_SCHEMA_STR:
+		snprintf(schema_id, sizeof(schema_id), "level_schema_%d", b % MOCK_DUMP_NUM_SCHEMAS);
+		return wasp_if_schema_get_property_str(address, schema_id, strlen(schema_id),
+			unit, strlen(unit), str, sizeof(str)) == -1;
+	default:
+		return 1;
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-o objects[,objects...]] [-S bytes[,bytes...]] [-l label_len]\n"
+		"          [-n max_calls] [-t max_ms]\n"
+		"  -o  device sizes in objects (default 10,100,1000,10000)\n"
+		"  -S  device sizes in bytes of the objects dump, instead of -o\n"
+		"  -l  block label length, to vary the object size\n"
+		"  -n  calls per lookup (default 100000)\n"
+		"  -t  time limit per lookup in ms (default 1000)\n", prog);
+}
+
+/* comma separated list of sizes */
+static int parse_sizes(const char *arg, size_t *sizes)
+{
+	char *end = NULL;
+	int n = 0;
+
+	while (*arg && n < MAX_SIZES) {
+		sizes[n++] = strtoul(arg, &end, 0);
+		if (*end != ',') {
+			break;
+		}
+		arg = end + 1;
+	}
+
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct mock_dump_cfg cfg = { 0, 0 };
+	size_t sizes[MAX_SIZES] = { 10, 100, 1000, 10000 };
+	char address[WASP_IF_IPV4_ADDRESS_LEN];
+	char *objects = NULL;
+	char *schemas = NULL;
+	size_t objects_len = 0;
+	size_t schemas_len = 0;
+	uint64_t *lat_ns = NULL;
+	uint64_t limit_ns = 0;
+	uint64_t start = 0;
+	uint64_t t0 = 0;
+	uint64_t load_ns = 0;
+	int num_sizes = 4;
+	int in_bytes = 0;
+	int max_calls = 100000;
+	int max_ms = 1000;
+	int errors = 0;
+	int op = 0;
+	int s = 0;
+	int i = 0;
+	int c = 0;
+
+	while ((c = getopt(argc, argv, "o:S:l:n:t:h")) != -1) {
+		switch (c) {
+		case 'o': num_sizes = parse_sizes(optarg, sizes); in_bytes = 0; break;
+		case 'S': num_sizes = parse_sizes(optarg, sizes); in_bytes = 1; break;
+		case 'l': cfg.label_len = atoi(optarg); break;
+		case 'n': max_calls = atoi(optarg); break;
+		case 't': max_ms = atoi(optarg); break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (!num_sizes || num_sizes > WASP_IF_MAX_DEVICES || max_calls < 1 || max_ms < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	lat_ns = calloc(max_calls, sizeof(*lat_ns));
+	if (!lat_ns || json_path_compile(&level_path, "level", 5) || wasp_if_init(NULL)) {
+		return 1;
+	}
+	limit_ns = (uint64_t)max_ms * 1000000;
+
+	for (s = 0; s < num_sizes; s++) {
+		if (in_bytes) {
+			cfg.num_blocks = mock_dump_blocks_for_size(&cfg, sizes[s]);
+		} else {
+			cfg.num_blocks = (sizes[s] + MOCK_DUMP_OBJS_PER_BLOCK - 1) / MOCK_DUMP_OBJS_PER_BLOCK;
+		}
+		if (cfg.num_blocks < 1) {
+			cfg.num_blocks = 1;
+		}
+
+		objects = mock_dump_objects(&cfg, &objects_len);
+		schemas = mock_dump_schemas(&cfg, &schemas_len);
+		snprintf(address, sizeof(address), "10.0.0.%d", s + 1);
+		start = bench_now_ns();
+		if (!objects || !schemas ||
+		    wasp_if_load_device(s, address, objects, objects_len, schemas, schemas_len)) {
+			printf("error loading %d objects\n", cfg.num_blocks * MOCK_DUMP_OBJS_PER_BLOCK);
+			return 1;
+		}
+		load_ns = bench_now_ns() - start;
+
+		printf("\n%d objects, %zu byte dump, %zu byte schemas\n",
+			cfg.num_blocks * MOCK_DUMP_OBJS_PER_BLOCK, objects_len, schemas_len);
+		printf("ingest %.3f ms, %.1f MB/s (%s index)\n", load_ns / 1e6,
+			(objects_len + schemas_len) * 1e3 / (load_ns ? load_ns : 1), json_index_impl());
+		bench_report_header("ns");
+
+		/* random blocks, so lookups are not always at the start of the store */
+		srand(1);
+		for (op = 0; op < NUM_OPS; op++) {
+			errors = 0;
+			start = bench_now_ns();
+			for (i = 0; i < max_calls; i++) {
+				t0 = bench_now_ns();
+				errors += run_op(op, address, rand() % cfg.num_blocks);
+				lat_ns[i] = bench_now_ns() - t0;
+				if (lat_ns[i] + t0 - start > limit_ns) {
+					i++;
+					break;
+				}
+			}
+			bench_report(op_names[op], lat_ns, i, bench_now_ns() - start, errors, 1);
+		}
+
+		free(objects);
+		free(schemas);
+	}
+
+	free(lat_ns);
+
+	return 0;
+}
@@ -0,0 +1,790 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+/*
+ * Generate a C header from the /wasp/r2/schemas document of a device (or a
+ * saved copy of it): for each schema, constant property IDs, value ranges,
+ * enum values, a perfect hash from property name to ID, and typed get/set
+ * functions of each property.  The getters use a json_path compiled by
+ * this tool and emitted as a constant, and the setters send the property
+ * name as a JSON string escaped by this tool, checking the value against
+ * the emitted ranges and enum values rather than the stored schema, so
+ * application code neither formats nor parses property names at runtime.
+ */
+
+#include "wasp_interface.h"
+#include "json.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define GEN_IDENT_LEN 96
+
+enum gen_type {
+	GEN_OTHER,             /* array, object, or no type: ID and path only */
+	GEN_NUM,
+	GEN_BOOL,
+	GEN_STR
+};
+
+struct gen_prop {
+	char name[WASP_IF_OBJ_PROP_LEN];   /* unescaped property name */
+	char ident[GEN_IDENT_LEN];         /* name as a C identifier */
+	enum gen_type type;
+	int has_min;
+	int has_max;
+	double min;
+	double max;
+	int min_len;                       /* minLength, -1 if none */
+	int max_len;                       /* maxLength, -1 if none */
+	const char *enum_tok;              /* "enum" array in the document, NULL if none */
+	int enum_len;
+};
+
+struct gen_schema {
+	char id[WASP_IF_SCHEMA_ID_MAX_LEN];
+	char ident[GEN_IDENT_LEN];
+	struct gen_prop *props;
+	int num_props;
+};
+
+struct gen {
+	struct gen_schema *schemas;
+	int num_schemas;
+	const char *prefix;
+	char upper[GEN_IDENT_LEN];         /* prefix in upper case */
+	FILE *out;
+	int error;
+};
+
+/* lower case C identifier of a name, made unique among the first n of idents */
+static void make_ident(const char *name, char *ident, const char *idents, size_t stride, int n)
+{
+	char base[GEN_IDENT_LEN - 11];     /* room for "_<suffix>" */
+	size_t len = 0;
+	unsigned int suffix = 1;
+	int i = 0;
+
+	for (len = 0; name[len] && len < sizeof(base) - 1; len++) {
+		base[len] = isalnum((unsigned char)name[len]) ? tolower((unsigned char)name[len]) : '_';
+	}
+	if (!len) {
+		base[len++] = '_';
+	}
+	base[len] = '\0';
+
+	strcpy(ident, base);
+	for (i = 0; i < n; i++) {
+		if (!strcmp(&idents[i * stride], ident)) {
+			snprintf(ident, GEN_IDENT_LEN, "%s_%u", base, ++suffix);
+			i = -1;
+		}
+	}
+}
+
+static void put_upper(FILE *out, const char *s)
+{
+	for (; *s; s++) {
+		fputc(toupper((unsigned char)*s), out);
+	}
+}
+
+/* a C string literal */
+static void put_cstr(FILE *out, const char *s, int len)
+{
+	int c = 0;
+	int i = 0;
+
+	fputc('"', out);
+	for (i = 0; i < len; i++) {
+		c = (unsigned char)s[i];
+		if (c == '"' || c == '\\') {
+			fprintf(out, "\\%c", c);
+		} else if (c < 0x20 || c >= 0x7f || c == '?') {
+			/* octal, so a following digit or trigraph is not taken as part of it */
+			fprintf(out, "\\%03o", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+/* json_foreach() callback counting the elements */
+static int count_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	(void)s;
+	(void)koff;
+	(void)klen;
+	(void)voff;
+	(void)vlen;
+	(void)ud;
+
+	return 0;
+}
+
+/* "integer" etc. of a "type" string token */
+static enum gen_type type_of(const char *tok, int toklen)
+{
+	char type[16];
+
+	if (json_get_string(tok, toklen, "$", type, sizeof(type)) <= 0) {
+		return GEN_OTHER;
+	}
+	if (!strcmp(type, "integer") || !strcmp(type, "number")) {
+		return GEN_NUM;
+	}
+	if (!strcmp(type, "boolean")) {
+		return GEN_BOOL;
+	}
+	if (!strcmp(type, "string")) {
+		return GEN_STR;
+	}
+
+	return GEN_OTHER;
+}
+
+/* the first type other than "null" of a "type" array, e.g. ["string", "null"] */
+static int type_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	enum gen_type *type = (enum gen_type *)ud;
+
+	(void)koff;
+	(void)klen;
+
+	*type = type_of(&s[voff], vlen);
+
+	return *type != GEN_OTHER;
+}
+
+enum prop_field {
+	PROP_TYPE,
+	PROP_MINIMUM,
+	PROP_MAXIMUM,
+	PROP_MIN_LENGTH,
+	PROP_MAX_LENGTH,
+	PROP_ENUM,
+	PROP_NUM_FIELDS
+};
+
+static const char * const prop_keys[PROP_NUM_FIELDS] = {
+	"type", "minimum", "maximum", "minLength", "maxLength", "enum"
+};
+
+static int prop_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	struct gen_schema *sch = (struct gen_schema *)ud;
+	struct json_field fields[PROP_NUM_FIELDS];
+	struct gen_prop *p = &sch->props[sch->num_props];
+	double v = 0;
+	int i = 0;
+
+	if (s[voff] != '{' || json_get_string(&s[koff], klen, "$", p->name, sizeof(p->name)) <= 0) {
+		return 0;
+	}
+	make_ident(p->name, p->ident, sch->props[0].ident, sizeof(*p), sch->num_props);
+
+	for (i = 0; i < PROP_NUM_FIELDS; i++) {
+		json_field_init(&fields[i], prop_keys[i]);
+	}
+	json_extract(&s[voff], vlen, fields, PROP_NUM_FIELDS);
+
+	if (fields[PROP_TYPE].type == JSON_TOK_STRING) {
+		p->type = type_of(fields[PROP_TYPE].tok, fields[PROP_TYPE].toklen);
+	} else if (fields[PROP_TYPE].type == JSON_TOK_ARRAY) {
+		json_foreach(fields[PROP_TYPE].tok, fields[PROP_TYPE].toklen, type_cb, &p->type);
+	}
+	p->has_min = json_field_get_number(&fields[PROP_MINIMUM], &p->min);
+	p->has_max = json_field_get_number(&fields[PROP_MAXIMUM], &p->max);
+	p->min_len = json_field_get_number(&fields[PROP_MIN_LENGTH], &v) ? (int)v : -1;
+	p->max_len = json_field_get_number(&fields[PROP_MAX_LENGTH], &v) ? (int)v : -1;
+	if (fields[PROP_ENUM].type == JSON_TOK_ARRAY) {
+		p->enum_tok = fields[PROP_ENUM].tok;
+		p->enum_len = fields[PROP_ENUM].toklen;
+	}
+	sch->num_props++;
+
+	return 0;
+}
+
+static int schema_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	struct gen *g = (struct gen *)ud;
+	struct gen_schema *sch = &g->schemas[g->num_schemas];
+	struct json_field props;
+	int n = 0;
+
+	if (s[voff] != '{' || json_get_string(&s[koff], klen, "$", sch->id, sizeof(sch->id)) <= 0) {
+		return 0;
+	}
+	make_ident(sch->id, sch->ident, g->schemas[0].ident, sizeof(*sch), g->num_schemas);
+
+	json_field_init(&props, "properties");
+	json_extract(&s[voff], vlen, &props, 1);
+	if (props.type == JSON_TOK_OBJECT) {
+		n = json_foreach(props.tok, props.toklen, count_cb, NULL);
+	}
+	if (n > 0) {
+		sch->props = calloc(n, sizeof(*sch->props));
+		if (!sch->props) {
+			g->error = 1;
+			return 1;
+		}
+		json_foreach(props.tok, props.toklen, prop_cb, sch);
+	}
+	g->num_schemas++;
+
+	return 0;
+}
+
+/*
+ * Find a table size and seed for which ((hash ^ seed) % size) differs for
+ * every name.  Returns nonzero if there is none, e.g. two names of the same
+ * hash.
+ */
+static int perfect_hash(const uint32_t *hashes, int n, int *size, uint32_t *seed)
+{
+	unsigned char *used = NULL;
+	unsigned char *tmp = NULL;
+	uint32_t slot = 0;
+	int i = 0;
+
+	for (*size = n ? n : 1; *size <= 64 * (n ? n : 1); (*size)++) {
+		tmp = realloc(used, *size);
+		if (!tmp) {
+			free(used);
+			return -1;
+		}
+		used = tmp;
+		for (*seed = 0; *seed < 4096; (*seed)++) {
+			memset(used, 0, *size);
+			for (i = 0; i < n; i++) {
+				slot = (hashes[i] ^ *seed) % *size;
+				if (used[slot]) {
+					break;
+				}
+				used[slot] = 1;
+			}
+			if (i == n) {
+				free(used);
+				return 0;
+			}
+		}
+	}
+	free(used);
+
+	return -1;
+}
+
+/*
+ * Emit the <table>_names and <table>_name_lens arrays and the lookup
+ * function fn of n names.  names is the first NUL terminated name, each
+ * following name stride bytes after the previous one.
+ */
+static void put_lookup(struct gen *g, const char *names, size_t stride, int n,
+	const char *table, const char *fn, const char *comment)
+{
+	uint32_t *hashes = calloc(n ? n : 1, sizeof(*hashes));
+	uint32_t seed = 0;
+	int *slots = NULL;
+	int size = 0;
+	int i = 0;
+
+	for (i = 0; hashes && i < n; i++) {
+		hashes[i] = json_hash(&names[i * stride], strlen(&names[i * stride]));
+	}
+	if (!hashes || perfect_hash(hashes, n, &size, &seed)) {
+		printf("no perfect hash found for %s\n", table);
+		free(hashes);
+		g->error = 1;
+		return;
+	}
+	slots = malloc(size * sizeof(*slots));
+	if (!slots) {
+		free(hashes);
+		g->error = 1;
+		return;
+	}
+	for (i = 0; i < size; i++) {
+		slots[i] = -1;
+	}
+	for (i = 0; i < n; i++) {
+		slots[(hashes[i] ^ seed) % size] = i;
+	}
+
+	fprintf(g->out, "static const char * const %s_names[%d] = {\n", table, n ? n : 1);
+	for (i = 0; i < n; i++) {
+		fprintf(g->out, "\t");
+		put_cstr(g->out, &names[i * stride], strlen(&names[i * stride]));
+		fprintf(g->out, ",\n");
+	}
+	fprintf(g->out, "%s};\n\n", n ? "" : "\tNULL\n");
+
+	fprintf(g->out, "static const int %s_name_lens[%d] = {", table, n ? n : 1);
+	for (i = 0; i < n; i++) {
+		fprintf(g->out, "%s%d", i ? ", " : " ", (int)strlen(&names[i * stride]));
+	}
+	fprintf(g->out, "%s };\n\n", n ? "" : " 0");
+
+	fprintf(g->out, "/* %s */\n", comment);
+	fprintf(g->out, "static inline int %s(const char *name, int len)\n{\n", fn);
+	fprintf(g->out, "\tstatic const short slots[%d] = {", size);
+	for (i = 0; i < size; i++) {
+		fprintf(g->out, "%s%s%d", i ? "," : "", i % 16 ? " " : "\n\t\t", slots[i]);
+	}
+	fprintf(g->out, "\n\t};\n");
+	fprintf(g->out, "\tint id = slots[(json_hash(name, len) ^ %uu) %% %d];\n\n", seed, size);
+	fprintf(g->out, "\treturn id >= 0 && %s_name_lens[id] == len && !memcmp(%s_names[id], name, (size_t)len) ? id : -1;\n}\n\n",
+		table, table);
+
+	free(slots);
+	free(hashes);
+}
+
+/* returns nonzero if the value was emitted, i.e. is of the property's type */
+static int put_enum_value(const char *s, int voff, int vlen, struct gen *g, enum gen_type type)
+{
+	char str[WASP_IF_OBJ_PROP_LEN];
+	double v = 0;
+	int len = 0;
+
+	if (type == GEN_STR) {
+		len = json_get_string(&s[voff], vlen, "$", str, sizeof(str));
+		if (len >= 0) {
+			fprintf(g->out, "\t");
+			put_cstr(g->out, str, len);
+			fprintf(g->out, ",\n");
+			return 1;
+		}
+	} else if (json_get_number(&s[voff], vlen, "$", &v)) {
+		fprintf(g->out, "\t%d,\n", (int)v);
+		return 1;
+	}
+
+	return 0;
+}
+
+struct enum_ctx {
+	struct gen *g;
+	enum gen_type type;
+	int n;                 /* values emitted */
+};
+
+static int enum_cb(const char *s, int koff, int klen, int voff, int vlen, void *ud)
+{
+	struct enum_ctx *e = (struct enum_ctx *)ud;
+
+	(void)koff;
+	(void)klen;
+
+	e->n += put_enum_value(s, voff, vlen, e->g, e->type);
+
+	return 0;
+}
+
+/* the json_path a getter evaluates, as json_path_compile() would compile the property name */
+static int put_path(struct gen *g, const char *name, const char *prefix)
+{
+	struct json_path path;
+	int i = 0;
+
+	/* a name with '.' or '[' is not a single key path */
+	if (strpbrk(name, ".[") || json_path_compile(&path, name, strlen(name))) {
+		return -1;
+	}
+
+	fprintf(g->out, "static const struct json_path %s_path = {\n\t%d,\n\t{", prefix, path.num_segs);
+	for (i = 0; i < path.num_segs; i++) {
+		fprintf(g->out, " { %d, %d, 0x%08xu }", path.segs[i].off, path.segs[i].len, path.segs[i].hash);
+	}
+	fprintf(g->out, " },\n\t");
+	put_cstr(g->out, path.keys, strlen(name));
+	fprintf(g->out, "\n};\n\n");
+
+	return 0;
+}
+
+/* the property name as a JSON string, e.g. "\"level\"", and its length, as setter arguments */
+static void put_key(struct gen *g, const char *name, int len)
+{
+	char key[6 * WASP_IF_OBJ_PROP_LEN + 3];  /* \u00XX escapes, quotes and NUL */
+	struct json_builder b;
+
+	json_builder_init(&b, key, sizeof(key));
+	json_builder_string(&b, name, len);
+	len = json_builder_finish(&b);
+	put_cstr(g->out, key, len);
+	fprintf(g->out, ", %d", len);
+}
+
+/* the start of a setter's schema checks, applied as wasp_if_object_set_property_*() would */
+static void put_check_begin(struct gen *g, int has_enum)
+{
+	fprintf(g->out, "\tconst struct wasp_if_config *c = _wasp_if_get_config();\n");
+	if (has_enum) {
+		fprintf(g->out, "\tint i = 0;\n");
+	}
+	fprintf(g->out, "\n\tif (c->validate_writes) {\n");
+}
+
+/* return 400 if the value was not found in the enum values */
+static void put_reject_enum(struct gen *g, const char *macro)
+{
+	fprintf(g->out, "\t\tif (i == %s_NUM_VALUES) {\n\t\t\treturn 400;\n\t\t}\n", macro);
+}
+
+/*
+ * A minimum rounded up (up set), or a maximum rounded down, to the int
+ * limit of a setter, e.g. 1 for a minimum of 0.5.  Returns 1 if no int is
+ * within the limit, -1 if every int is.
+ */
+static int int_limit(double limit, int up, int *v)
+{
+	if (limit > INT_MAX) {
+		return up ? 1 : -1;
+	}
+	if (limit < INT_MIN) {
+		return up ? -1 : 1;
+	}
+	*v = (int)limit;
+	if (up && *v < limit) {
+		(*v)++;
+	} else if (!up && *v > limit) {
+		(*v)--;
+	}
+
+	return 0;
+}
+
+/* reject, or with clamp_writes clamp, a number beyond an int limit */
+static void put_clamp(struct gen *g, const char *op, int limit, const char *macro, const char *name)
+{
+	fprintf(g->out, "\t\tif (val %s %d) {\n\t\t\t/* %s%s, as an int */\n\t\t\tif (!c->clamp_writes) {\n"
+		"\t\t\t\treturn 400;\n\t\t\t}\n\t\t\tval = %d;\n\t\t}\n", op, limit, macro, name, limit);
+}
+
+static void put_prop(struct gen *g, const struct gen_schema *sch, int id)
+{
+	const struct gen_prop *p = &sch->props[id];
+	struct enum_ctx e = { g, p->type, 0 };
+	char sprefix[2 * GEN_IDENT_LEN];
+	char prefix[3 * GEN_IDENT_LEN];
+	char macro[3 * GEN_IDENT_LEN];
+	int name_len = strlen(p->name);
+	int has_path = 0;
+	int has_enum = 0;
+	int min = 0;
+	int max = 0;
+	int lo = 0;
+	int hi = 0;
+	int i = 0;
+
+	snprintf(sprefix, sizeof(sprefix), "%s_%s", g->prefix, sch->ident);
+	snprintf(prefix, sizeof(prefix), "%s_%s", sprefix, p->ident);
+	for (i = 0; prefix[i]; i++) {
+		macro[i] = toupper((unsigned char)prefix[i]);
+	}
+	macro[i] = '\0';
+
+	fprintf(g->out, "/* %s.%s */\n", sch->id, p->name);
+	if (p->has_min) {
+		fprintf(g->out, "#define %s_MIN %.17g\n", macro, p->min);
+	}
+	if (p->has_max) {
+		fprintf(g->out, "#define %s_MAX %.17g\n", macro, p->max);
+	}
+	if (p->min_len >= 0) {
+		fprintf(g->out, "#define %s_MIN_LEN %d\n", macro, p->min_len);
+	}
+	if (p->max_len >= 0) {
+		fprintf(g->out, "#define %s_MAX_LEN %d\n", macro, p->max_len);
+	}
+	if (p->has_min || p->has_max || p->min_len >= 0 || p->max_len >= 0) {
+		fprintf(g->out, "\n");
+	}
+
+	if (p->enum_tok && (p->type == GEN_STR || p->type == GEN_NUM)) {
+		fprintf(g->out, "static const %s %s_values[] = {\n", p->type == GEN_STR ? "char * const" : "int", prefix);
+		json_foreach(p->enum_tok, p->enum_len, enum_cb, &e);
+		if (!e.n) {
+			/* none of the property's type, e.g. only null */
+			fprintf(g->out, "\t%s\n", p->type == GEN_STR ? "NULL" : "0");
+		}
+		fprintf(g->out, "};\n\n#define %s_NUM_VALUES %d\n\n", macro, e.n);
+	}
+	has_enum = e.n > 0;
+
+	has_path = !put_path(g, p->name, prefix);
+
+	switch (p->type) {
+	case GEN_NUM:
+	case GEN_BOOL:
+		if (has_path) {
+			fprintf(g->out, "static inline int %s_get_%s(const char *ipv4_address, int obj_id, int *val, int cached)\n{\n"
+				"\treturn wasp_if_object_get_property_%s_h(ipv4_address, obj_id, &%s_path, val, cached);\n}\n\n",
+				sprefix, p->ident, p->type == GEN_NUM ? "num" : "bool", prefix);
+		}
+		fprintf(g->out, "static inline int %s_set_%s(const char *ipv4_address, int obj_id, int val)\n{\n",
+			sprefix, p->ident);
+		lo = p->has_min ? int_limit(p->min, 1, &min) : -1;
+		hi = p->has_max ? int_limit(p->max, 0, &max) : -1;
+		if (p->type == GEN_NUM && (has_enum || lo != -1 || hi != -1)) {
+			put_check_begin(g, has_enum);
+			if (has_enum) {
+				fprintf(g->out, "\t\tfor (i = 0; i < %s_NUM_VALUES && %s_values[i] != val; i++) {\n\t\t}\n", macro, prefix);
+				put_reject_enum(g, macro);
+			}
+			if (lo == 1 || hi == 1 || (!lo && !hi && min > max)) {
+				fprintf(g->out, "\t\t/* no int within %s_MIN..%s_MAX */\n\t\treturn 400;\n", macro, macro);
+			} else {
+				if (!lo) {
+					put_clamp(g, "<", min, macro, "_MIN");
+				}
+				if (!hi) {
+					put_clamp(g, ">", max, macro, "_MAX");
+				}
+			}
+			fprintf(g->out, "\t}\n\n");
+		}
+		fprintf(g->out, "\treturn wasp_if_object_set_key_%s(ipv4_address, obj_id, ", p->type == GEN_NUM ? "num" : "bool");
+		put_key(g, p->name, name_len);
+		fprintf(g->out, ", val);\n}\n\n");
+		break;
+	case GEN_STR:
+		if (has_path) {
+			fprintf(g->out, "static inline int %s_get_%s(const char *ipv4_address, int obj_id, char *val, size_t val_len, int cached)\n{\n"
+				"\treturn wasp_if_object_get_property_str_h(ipv4_address, obj_id, &%s_path, val, val_len, cached);\n}\n\n",
+				sprefix, p->ident, prefix);
+		}
+		fprintf(g->out, "static inline int %s_set_%s(const char *ipv4_address, int obj_id, const char *val, size_t val_len)\n{\n",
+			sprefix, p->ident);
+		if (has_enum || p->min_len >= 0 || p->max_len >= 0) {
+			put_check_begin(g, has_enum);
+			/* the value ends at its first NUL, as wasp_if_object_set_key_str() sends it */
+			fprintf(g->out, "\t\tconst char *nul = (const char *)memchr(val, '\\0', val_len);\n\n"
+				"\t\tif (nul) {\n\t\t\tval_len = (size_t)(nul - val);\n\t\t}\n");
+			if (has_enum) {
+				fprintf(g->out, "\t\tfor (i = 0; i < %s_NUM_VALUES &&\n"
+					"\t\t     (strlen(%s_values[i]) != val_len || memcmp(%s_values[i], val, val_len)); i++) {\n\t\t}\n",
+					macro, prefix, prefix);
+				put_reject_enum(g, macro);
+			}
+			/* in code points, as the device counts them, and a string of at most maxLength bytes is not counted */
+			if (p->min_len >= 0) {
+				fprintf(g->out, "\t\tif (%s_utf8_len(val, val_len) < %s_MIN_LEN) {\n\t\t\treturn 400;\n\t\t}\n",
+					g->prefix, macro);
+			}
+			if (p->max_len >= 0) {
+				fprintf(g->out, "\t\tif (val_len > %s_MAX_LEN && %s_utf8_len(val, val_len) > %s_MAX_LEN) {\n\t\t\treturn 400;\n\t\t}\n",
+					macro, g->prefix, macro);
+			}
+			fprintf(g->out, "\t}\n\n");
+		}
+		fprintf(g->out, "\treturn wasp_if_object_set_key_str(ipv4_address, obj_id, ");
+		put_key(g, p->name, name_len);
+		fprintf(g->out, ", val, val_len);\n}\n\n");
+		break;
+	default:
+		break;
+	}
+}
+
+static void put_schema(struct gen *g, const struct gen_schema *sch)
+{
+	char table[2 * GEN_IDENT_LEN + 8];
+	char fn[2 * GEN_IDENT_LEN + 16];
+	char comment[WASP_IF_SCHEMA_ID_MAX_LEN + 64];
+	int i = 0;
+
+	fprintf(g->out, "/*\n * %s\n */\n\n", sch->id);
+	fprintf(g->out, "enum %s_%s_prop {\n", g->prefix, sch->ident);
+	for (i = 0; i < sch->num_props; i++) {
+		fprintf(g->out, "\t%s_", g->upper);
+		put_upper(g->out, sch->ident);
+		fprintf(g->out, "_");
+		put_upper(g->out, sch->props[i].ident);
+		fprintf(g->out, ",\n");
+	}
+	fprintf(g->out, "\t%s_", g->upper);
+	put_upper(g->out, sch->ident);
+	fprintf(g->out, "_NUM_PROPS\n};\n\n");
+
+	snprintf(table, sizeof(table), "%s_%s_prop", g->prefix, sch->ident);
+	snprintf(fn, sizeof(fn), "%s_%s_prop_id", g->prefix, sch->ident);
+	snprintf(comment, sizeof(comment), "property ID of a property name, -1 if not a property of %s", sch->id);
+	put_lookup(g, sch->num_props ? sch->props[0].name : "", sizeof(*sch->props), sch->num_props, table, fn, comment);
+
+	for (i = 0; i < sch->num_props; i++) {
+		put_prop(g, sch, i);
+	}
+}
+
+static void put_header(struct gen *g, const char *source)
+{
+	char table[GEN_IDENT_LEN + 16];
+	char fn[GEN_IDENT_LEN + 16];
+	int i = 0;
+
+	fprintf(g->out, "\n/* generated by wasp_schema_gen from %s, do not edit */\n\n", source);
+	fprintf(g->out, "#ifndef _%s_SCHEMAS_H\n#define _%s_SCHEMAS_H\n\n", g->upper, g->upper);
+	fprintf(g->out, "#include \"wasp_interface.h\"\n#include <string.h>\n\n");
+
+	fprintf(g->out, "/* code points of a UTF-8 string, as minLength/maxLength count them */\n");
+	fprintf(g->out, "static inline size_t %s_utf8_len(const char *s, size_t len)\n{\n"
+		"\tsize_t n = 0;\n\tsize_t i = 0;\n\n"
+		"\tfor (i = 0; i < len; i++) {\n\t\tn += ((unsigned char)s[i] & 0xc0) != 0x80;\n\t}\n\n"
+		"\treturn n;\n}\n\n", g->prefix);
+
+	fprintf(g->out, "enum %s_schema {\n", g->prefix);
+	for (i = 0; i < g->num_schemas; i++) {
+		fprintf(g->out, "\t%s_SCHEMA_", g->upper);
+		put_upper(g->out, g->schemas[i].ident);
+		fprintf(g->out, ",\n");
+	}
+	fprintf(g->out, "\t%s_NUM_SCHEMAS\n};\n\n", g->upper);
+
+	snprintf(table, sizeof(table), "%s_schema", g->prefix);
+	snprintf(fn, sizeof(fn), "%s_schema_id", g->prefix);
+	put_lookup(g, g->num_schemas ? g->schemas[0].id : "", sizeof(*g->schemas), g->num_schemas, table, fn,
+		"schema of a _schema ID, -1 if not one of the device's schemas");
+
+	for (i = 0; i < g->num_schemas; i++) {
+		put_schema(g, &g->schemas[i]);
+	}
+
+	fprintf(g->out, "#endif /* _%s_SCHEMAS_H */\n", g->upper);
+}
+
+static char * read_file(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+	long n = 0;
+
+	if (!f) {
+		return NULL;
+	}
+	if (!fseek(f, 0, SEEK_END) && (n = ftell(f)) >= 0 && !fseek(f, 0, SEEK_SET)) {
+		buf = malloc(n + 1);
+	}
+	if (buf && fread(buf, 1, n, f) != (size_t)n) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+	if (buf) {
+		buf[n] = '\0';
+		*len = n;
+	}
+
+	return buf;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s (-a a.b.c.d[:port] | -f schemas.json) [-p prefix] [-o header.h] [-E]\n"
+		"  -a  read /wasp/r2/schemas from the device\n"
+		"  -f  read a saved /wasp/r2/schemas document\n"
+		"  -p  prefix of the generated names, default \"wasp\"\n"
+		"  -o  output file, default <prefix>_schemas.h\n"
+		"  -E  built-in epoll HTTP/1.1 transport instead of libwebsockets\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct wasp_if_config cfg;
+	struct gen g;
+	const char *address = NULL;
+	const char *file = NULL;
+	const char *out_path = NULL;
+	char default_path[GEN_IDENT_LEN + 16];
+	char *json = NULL;
+	size_t len = 0;
+	int n = 0;
+	int i = 0;
+	int c = 0;
+
+	memset(&g, 0, sizeof(g));
+	g.prefix = "wasp";
+	wasp_if_config_init(&cfg);
+
+	while ((c = getopt(argc, argv, "a:f:p:o:Eh")) != -1) {
+		switch (c) {
+		case 'a': address = optarg; break;
+		case 'f': file = optarg; break;
+		case 'p': g.prefix = optarg; break;
+		case 'o': out_path = optarg; break;
+		case 'E': cfg.transport = WASP_IF_TRANSPORT_EPOLL; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (!address == !file || !g.prefix[0] || strlen(g.prefix) >= sizeof(g.upper) ||
+	    strspn(g.prefix, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_") != strlen(g.prefix) ||
+	    isdigit((unsigned char)g.prefix[0])) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (i = 0; g.prefix[i]; i++) {
+		g.upper[i] = toupper((unsigned char)g.prefix[i]);
+	}
+
+	if (file) {
+		json = read_file(file, &len);
+		if (!json) {
+			printf("error reading %s\n", file);
+			return 1;
+		}
+	} else {
+		cfg.lazy_schemas = 1;
+		if (wasp_if_init_ex(NULL, &cfg) || wasp_if_connect_to_device(0, address, 0) ||
+		    wasp_if_schema_copy_all(address, &json, &len)) {
+			printf("error reading the schemas of %s\n", address);
+			return 1;
+		}
+	}
+
+	n = json_foreach(json, len, count_cb, NULL);
+	if (n < 0 || json[strspn(json, " \t\r\n")] != '{') {
+		printf("%s is not a schemas document\n", file ? file : address);
+		return 1;
+	}
+	g.schemas = calloc(n ? n : 1, sizeof(*g.schemas));
+	if (!g.schemas) {
+		return 1;
+	}
+	json_foreach(json, len, schema_cb, &g);
+
+	/* not stdout, the interface prints its progress there */
+	if (!out_path) {
+		snprintf(default_path, sizeof(default_path), "%s_schemas.h", g.prefix);
+		out_path = default_path;
+	}
+	g.out = fopen(out_path, "w");
+	if (!g.out) {
+		printf("error opening %s\n", out_path);
+		return 1;
+	}
+	put_header(&g, file ? file : address);
+	if (fclose(g.out)) {
+		g.error = 1;
+	}
+	if (g.error) {
+		printf("error generating %s\n", out_path);
+		remove(out_path);
+		return 1;
+	}
+	printf("%d schemas written to %s\n", g.num_schemas, out_path);
+
+	for (i = 0; i < g.num_schemas; i++) {
+		free(g.schemas[i].props);
+	}
+	free(g.schemas);
+	free(json);
+
+	return 0;
+}
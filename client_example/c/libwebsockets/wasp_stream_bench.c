@@ -0,0 +1,195 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+/*
+ * Update stream ingest benchmark.  Opens the update stream of mock_device
+ * running with -r/-F (and optionally -x, -g, -k) and reports the sustained
+ * events/s, the delivery latency of update:obj events from the mock to the
+ * update callback, and the client CPU time per event.
+ */
+
+#include "wasp_interface.h"
+#include "mock_dump.h"
+#include "bench_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#define MAX_LAT_SAMPLES (1 << 20)
+
+static atomic_ulong obj_events;
+static atomic_ulong meter_vals;
+static atomic_ulong num_lat;
+static uint64_t lat_ns[MAX_LAT_SAMPLES];
+
+static void update_cb(const char *ipv4_address, const char *path, const char *update_body)
+{
+	const char *ts = strstr(update_body, "\"_ts\":");
+	const char *id = strrchr(path, '/');
+	uint64_t now = bench_now_ns();
+	unsigned long i = 0;
+
+	(void)ipv4_address;
+
+	/* update:obj events carry their send time */
+	if (ts) {
+		atomic_fetch_add(&obj_events, 1);
+		i = atomic_fetch_add(&num_lat, 1);
+		if (i < MAX_LAT_SAMPLES) {
+			lat_ns[i] = now - strtoull(ts + 6, NULL, 10);
+		}
+		return;
+	}
+
+	/* one level of an update:group_prefix event, ctrl:meter is the 5th object of a block */
+	if (id && atoi(id + 1) > 0 && atoi(id + 1) % MOCK_DUMP_OBJS_PER_BLOCK == 0) {
+		atomic_fetch_add(&meter_vals, 1);
+	}
+}
+
+static uint64_t cpu_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000 +
+		((uint64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-a a.b.c.d:port] [-c devices] [-t seconds] [-g group_meters] [-D dispatch_threads]\n"
+		"       [-S shards] [-T service_threads] [-A] [-E]\n"
+		"  -c  devices at consecutive addresses a.b.c.d, a.b.c.(d+1), ..., each\n"
+		"      with its own update stream from the mock device\n"
+		"  -g  meter levels per update:group_prefix event, as given to mock_device\n"
+		"      (default 16, the mock device default of all meters of 16 blocks)\n"
+		"  -D  update dispatch threads, 0 (default) runs the callback on the\n"
+		"      HTTP client thread so nothing is queued or conflated\n"
+		"  -S  device shards, each with its own transport context and dispatch threads\n"
+		"  -T  HTTP client threads per shard\n"
+		"  -A  pin HTTP client thread i to CPU i\n"
+		"  -E  built-in epoll HTTP/1.1 transport instead of libwebsockets\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct wasp_if_connect_device *devs = NULL;
+	struct wasp_if_dispatch_stats stats;
+	struct wasp_if_config cfg;
+	char (*addrs)[WASP_IF_IPV4_ADDRESS_LEN] = NULL;
+	const char *address = "127.0.0.1:8080";
+	unsigned int a0, a1, a2, a3;
+	uint64_t start = 0;
+	uint64_t cpu_start = 0;
+	uint64_t elapsed = 0;
+	uint64_t cpu = 0;
+	unsigned long events = 0;
+	unsigned long last = 0;
+	unsigned long n = 0;
+	int num_devices = 1;
+	int group_meters = 16;
+	int seconds = 10;
+	int port = 80;
+	int c = 0;
+	int i = 0;
+
+	wasp_if_config_init(&cfg);
+	cfg.dispatch_threads = 0;
+
+	while ((c = getopt(argc, argv, "a:c:t:g:D:S:T:AEh")) != -1) {
+		switch (c) {
+		case 'a': address = optarg; break;
+		case 'c': num_devices = atoi(optarg); break;
+		case 't': seconds = atoi(optarg); break;
+		case 'g': group_meters = atoi(optarg); break;
+		case 'D': cfg.dispatch_threads = atoi(optarg); break;
+		case 'S': cfg.shards = atoi(optarg); break;
+		case 'T': cfg.service_threads = atoi(optarg); break;
+		case 'A': cfg.service_cpu_affinity = 1; break;
+		case 'E': cfg.transport = WASP_IF_TRANSPORT_EPOLL; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (sscanf(address, "%u.%u.%u.%u:%d", &a0, &a1, &a2, &a3, &port) < 4 ||
+	    num_devices < 1 || num_devices > WASP_IF_MAX_DEVICES ||
+	    seconds < 1 || group_meters < 1 || cfg.dispatch_threads < 0 ||
+	    cfg.shards < 1 || cfg.service_threads < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	devs = calloc(num_devices, sizeof(*devs));
+	addrs = calloc(num_devices, sizeof(*addrs));
+	if (!devs || !addrs) {
+		return 1;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		snprintf(addrs[i], sizeof(addrs[i]), "%u.%u.%u.%u:%d", a0, a1, a2, a3 + i, port);
+		devs[i].device_index = i;
+		devs[i].ipv4_address = addrs[i];
+		devs[i].enable_update_stream = 1;
+	}
+
+	if (wasp_if_init_ex(update_cb, &cfg)) {
+		return 1;
+	}
+
+	if (wasp_if_connect_to_devices(devs, num_devices, NULL, NULL, NULL)) {
+		printf("error connecting to the devices\n");
+		return 1;
+	}
+
+	/* the rate once the stream is flowing */
+	while (!atomic_load(&obj_events) && !atomic_load(&meter_vals)) {
+		usleep(1000);
+	}
+	atomic_store(&obj_events, 0);
+	atomic_store(&meter_vals, 0);
+	atomic_store(&num_lat, 0);
+	start = bench_now_ns();
+	cpu_start = cpu_ns();
+
+	for (i = 0; i < seconds; i++) {
+		sleep(1);
+		events = atomic_load(&obj_events) + atomic_load(&meter_vals) / group_meters;
+		printf("%lu events/s\n", events - last);
+		last = events;
+	}
+
+	elapsed = bench_now_ns() - start;
+	cpu = cpu_ns() - cpu_start;
+	events = atomic_load(&obj_events) + atomic_load(&meter_vals) / group_meters;
+
+	printf("\n%lu events in %.1f s: %.0f events/s (%lu update:obj, %lu meter levels)\n",
+		events, elapsed / 1e9, events / (elapsed / 1e9),
+		atomic_load(&obj_events), atomic_load(&meter_vals));
+	printf("client CPU %.1f%%, %.2f us per event\n",
+		100.0 * cpu / elapsed, events ? cpu / 1e3 / events : 0.0);
+
+	if (cfg.dispatch_threads) {
+		wasp_if_get_dispatch_stats(&stats);
+		printf("dispatch: %llu delivered, %llu dropped, %llu conflated\n",
+			(unsigned long long)stats.delivered, (unsigned long long)stats.dropped,
+			(unsigned long long)stats.conflated);
+	}
+
+	n = atomic_load(&num_lat);
+	if (n) {
+		printf("\nupdate:obj latency, mock device write to update callback\n");
+		bench_report_header("us");
+		bench_report("update:obj", lat_ns, n < MAX_LAT_SAMPLES ? n : MAX_LAT_SAMPLES, elapsed, 0, 1000);
+	}
+
+	free(addrs);
+	free(devs);
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+
+/**********************************************
+(C) Copyright AudioScience Inc. 2020
+***********************************************/
+
+/*
+ * Print a flight recorder dump written by wasp_if_trace_dump(), one event
+ * per line, oldest first.
+ */
+
+#include "trace_ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *type_names[TRACE_NUM_TYPES] = {
+	"-", "req_submit", "req_send", "req_complete", "callback", "stream_read",
+	"stream_event", "stream_up", "stream_closed", "stream_reconnect",
+	"auth_start", "auth_done"
+};
+
+/* WASP_IF_METHOD_* and WASP_IF_EVENT_* names */
+static const char *methods[] = { "GET", "PATCH", "POST" };
+static const char *events[] = { "update:obj", "update:group_prefix", "other" };
+
+static void print_args(const struct trace_event *ev)
+{
+	switch (ev->type) {
+	case TRACE_REQ_SUBMIT:
+	case TRACE_REQ_SEND:
+		printf("%s obj=%d", ev->a >= 0 && ev->a < 3 ? methods[ev->a] : "?", ev->b);
+		break;
+	case TRACE_REQ_COMPLETE:
+		printf("status=%d total_us=%d", ev->a, ev->b);
+		break;
+	case TRACE_CALLBACK:
+		printf("reason=%d len=%d", ev->a, ev->b);
+		break;
+	case TRACE_STREAM_READ:
+		printf("len=%d buffered=%d", ev->a, ev->b);
+		break;
+	case TRACE_STREAM_EVENT:
+		printf("%s len=%d", ev->a >= 0 && ev->a < 3 ? events[ev->a] : "?", ev->b);
+		break;
+	case TRACE_STREAM_UP:
+	case TRACE_AUTH_DONE:
+		printf("status=%d", ev->a);
+		break;
+	case TRACE_STREAM_CLOSED:
+		printf("restart=%d", ev->a);
+		break;
+	case TRACE_STREAM_RECONNECT:
+		printf("delay_ms=%d attempts=%d", ev->a, ev->b);
+		break;
+	default:
+		break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_file_header hdr;
+	struct trace_event ev;
+	struct tm tm;
+	FILE *f = NULL;
+	uint64_t first = 0;
+	uint64_t n = 0;
+	int64_t wall_ns = 0;
+	time_t wall_s = 0;
+	char wall[32];
+
+	if (argc != 2) {
+		printf("usage: %s trace_file\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		printf("error opening %s\n", argv[1]);
+		return 1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, TRACE_FILE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.event_size != sizeof(ev)) {
+		printf("%s is not a trace dump\n", argv[1]);
+		fclose(f);
+		return 1;
+	}
+
+	printf("# %llu events, %llu older events overwritten\n",
+		(unsigned long long)hdr.num_events, (unsigned long long)hdr.lost_events);
+	printf("# %12s %-26s %7s %3s %-16s\n", "rel_us", "time", "tid", "dev", "event");
+
+	for (n = 0; n < hdr.num_events && fread(&ev, sizeof(ev), 1, f) == 1; n++) {
+		if (ev.type == TRACE_NONE || ev.type >= TRACE_NUM_TYPES) {
+			continue;
+		}
+		if (!first) {
+			first = ev.ts_ns;
+		}
+
+		wall_ns = (int64_t)ev.ts_ns + hdr.realtime_offset_ns;
+		wall_s = wall_ns / 1000000000;
+		localtime_r(&wall_s, &tm);
+		strftime(wall, sizeof(wall), "%Y-%m-%d %H:%M:%S", &tm);
+
+		printf("%14.3f %s.%06d %7u %3d %-16s ", (ev.ts_ns - first) / 1000.0, wall,
+			(int)(wall_ns % 1000000000 / 1000), ev.tid, ev.dev, type_names[ev.type]);
+		print_args(&ev);
+		printf("\n");
+	}
+	if (n < hdr.num_events) {
+		printf("# truncated after %llu events\n", (unsigned long long)n);
+	}
+
+	fclose(f);
+
+	return 0;
+}